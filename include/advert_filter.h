@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// advertising data (AD) structure types, Bluetooth Core Supplement part A
+constexpr uint8_t AD_TYPE_UUID16_INCOMPLETE = 0x02;
+constexpr uint8_t AD_TYPE_UUID16_COMPLETE = 0x03;
+constexpr uint8_t AD_TYPE_NAME_SHORT = 0x08;
+constexpr uint8_t AD_TYPE_NAME_COMPLETE = 0x09;
+constexpr uint8_t AD_TYPE_SERVICE_DATA16 = 0x16;
+
+// Matches raw advertisement bytes ([length][type][data...] structures) without
+// copying them; runs on the NimBLE host task for every advert the scan receives,
+// so it must not allocate.
+
+// calls `match(type, data, length)` for each AD structure until it returns true
+template <typename Match>
+bool forEachAdStructure(const uint8_t *payload, size_t length, Match match) {
+    size_t pos = 0;
+    while (pos + 1 < length) {
+        uint8_t fieldLength = payload[pos];
+        if (fieldLength == 0 || pos + 1 + fieldLength > length) {
+            return false; // padding or a truncated structure ends the payload
+        }
+        if (match(payload[pos + 1], payload + pos + 2, (size_t)(fieldLength - 1))) {
+            return true;
+        }
+        pos += 1 + fieldLength;
+    }
+    return false;
+}
+
+// listed as a 16 bit service UUID or carried as 16 bit service data
+bool advertHasService16(const uint8_t *payload, size_t length, uint16_t uuid) {
+    return forEachAdStructure(payload, length, [uuid](uint8_t type, const uint8_t *data, size_t dataLength) {
+        if (type == AD_TYPE_UUID16_INCOMPLETE || type == AD_TYPE_UUID16_COMPLETE) {
+            for (size_t i = 0; i + 1 < dataLength; i += 2) {
+                if ((data[i] | (data[i + 1] << 8)) == uuid) {
+                    return true;
+                }
+            }
+        } else if (type == AD_TYPE_SERVICE_DATA16 && dataLength >= 2) {
+            return (data[0] | (data[1] << 8)) == uuid;
+        }
+        return false;
+    });
+}
+
+// the (shortened or complete) local name contains `needle`, like String::indexOf() >= 0
+bool advertNameContains(const uint8_t *payload, size_t length, const char *needle) {
+    size_t needleLength = strlen(needle);
+    return forEachAdStructure(payload, length, [needle, needleLength](uint8_t type, const uint8_t *data, size_t dataLength) {
+        if ((type != AD_TYPE_NAME_SHORT && type != AD_TYPE_NAME_COMPLETE) || dataLength < needleLength) {
+            return false;
+        }
+        for (size_t i = 0; i + needleLength <= dataLength; i++) {
+            if (memcmp(data + i, needle, needleLength) == 0) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "event_log.h"
+
+// Capture of the BLE side of a session for the replay driver in the native build
+// (native/bench/ble_replay.h): every advert of a scale, connection event, subscription,
+// indication and measurement publish, timestamped in microseconds, and the duration of each
+// operation recordLatency() times, so the replay serves the GATT and network round trips of the
+// capture. A record is a few bytes of binary; it goes out with the log lines as "TRACE <hex>",
+// so the deferred log pipeline carries it and a serial capture holds text and trace in order.
+
+enum class TraceType : uint8_t {
+    ADVERT = 1,      // address (6 bytes, as NimBLEAddress::getVal()), address type, advert payload
+    CONNECT_START,   // the BLE task asks for the link
+    CONNECTED,       // the link is up, the BLE task sets up the session
+    CONNECT_FAILED,  // reason (1 byte)
+    DISCONNECTED,    // reason (1 byte)
+    SUBSCRIBED,      // the session waits for indications
+    INDICATION,      // the frame as the scale sent it
+    OPERATION,       // an Operation (1 byte) and its duration in ms (4 bytes little endian), scale TRACE_NO_SCALE
+    PUBLISHED,       // a measurement of the scale went out at QoS 1
+};
+
+constexpr uint8_t TRACE_NO_SCALE = 0xFF; // recordLatency() does not know the session, the replay assigns it
+
+constexpr size_t TRACE_HEADER_SIZE = 8; // type, scale, timestamp in 6 bytes little endian
+constexpr size_t TRACE_RECORD_SIZE = LOG_DATA; // a record is a single log event
+constexpr size_t TRACE_DATA_SIZE = TRACE_RECORD_SIZE - TRACE_HEADER_SIZE;
+
+// write a trace of the scales' adverts, connections, indications and operation times to Serial
+// ("TRACE" lines), for the replay driver of the native build
+bool bleTrace = false;
+
+struct TraceRecord {
+    TraceType type = TraceType::ADVERT;
+    uint8_t scale = 0; // index of the scale session
+    uint64_t atUs = 0; // esp_timer_get_time(), 48 bits last 8.9 years
+    uint8_t length = 0;
+    uint8_t data[TRACE_DATA_SIZE] = {};
+};
+
+// `data` is cut at TRACE_DATA_SIZE; returns the record size
+inline size_t encodeTrace(uint8_t *out, TraceType type, uint8_t scale, uint64_t atUs, const uint8_t *data, size_t length) {
+    out[0] = uint8_t(type);
+    out[1] = scale;
+    for (size_t i = 0; i < 6; i++) {
+        out[2 + i] = uint8_t(atUs >> (8 * i));
+    }
+    length = length < TRACE_DATA_SIZE ? length : TRACE_DATA_SIZE;
+    if (length) {
+        memcpy(out + TRACE_HEADER_SIZE, data, length); // a record without data passes no buffer
+    }
+    return TRACE_HEADER_SIZE + length;
+}
+
+inline bool decodeTrace(const uint8_t *in, size_t length, TraceRecord &record) {
+    if (length < TRACE_HEADER_SIZE || length > TRACE_RECORD_SIZE || in[0] < uint8_t(TraceType::ADVERT) ||
+        in[0] > uint8_t(TraceType::PUBLISHED)) {
+        return false;
+    }
+    record.type = TraceType(in[0]);
+    record.scale = in[1];
+    record.atUs = 0;
+    for (size_t i = 0; i < 6; i++) {
+        record.atUs |= uint64_t(in[2 + i]) << (8 * i);
+    }
+    record.length = length - TRACE_HEADER_SIZE;
+    memcpy(record.data, in + TRACE_HEADER_SIZE, record.length);
+    return true;
+}
+
+// any task; bypasses LOG_LEVEL, a capture is asked for explicitly. `length` is what `data`
+// holds, the record takes at most TRACE_DATA_SIZE of it
+inline void writeTrace(TraceType type, uint8_t scale, const uint8_t *data = nullptr, size_t length = 0) {
+    uint8_t record[TRACE_RECORD_SIZE];
+    size_t size = encodeTrace(record, type, scale, esp_timer_get_time(), data, length);
+    eventLog.write(LOG_LEVEL_ERROR, "TRACE ", LogBytes{record, size});
+}
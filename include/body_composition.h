@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Body Composition Measurement (0x2a9c) decoder. The flags say which optional
+// fields follow the mandatory body fat percentage, in the order of BCM_FIELDS;
+// the fields are read byte by byte, so the payload needs no alignment.
+
+constexpr uint16_t BCM_FLAG_IMPERIAL = 0x0001; // masses in lb, height in inches
+constexpr uint16_t BCM_FLAG_MULTIPLE_PACKET = 0x1000;
+constexpr uint16_t BCM_FAT_UNSUCCESSFUL = 0xFFFF; // the scale could not measure
+constexpr uint8_t BCM_USER_UNKNOWN = 0xFF;
+constexpr float KG_PER_LB = 0.45359237f;
+constexpr float M_PER_INCH = 0.0254f;
+
+enum class BcmField : uint8_t {
+    TIME_STAMP,
+    USER_ID,
+    BASAL_METABOLISM,
+    MUSCLE_PERCENTAGE,
+    MUSCLE_MASS,
+    FAT_FREE_MASS,
+    SOFT_LEAN_MASS,
+    BODY_WATER_MASS,
+    IMPEDANCE,
+    WEIGHT,
+    HEIGHT,
+};
+
+struct BcmFieldDescriptor {
+    uint16_t flag;
+    uint8_t size;
+    BcmField field;
+};
+
+constexpr BcmFieldDescriptor BCM_FIELDS[] = {
+    {0x0002, 7, BcmField::TIME_STAMP},        {0x0004, 1, BcmField::USER_ID},
+    {0x0008, 2, BcmField::BASAL_METABOLISM},  {0x0010, 2, BcmField::MUSCLE_PERCENTAGE},
+    {0x0020, 2, BcmField::MUSCLE_MASS},       {0x0040, 2, BcmField::FAT_FREE_MASS},
+    {0x0080, 2, BcmField::SOFT_LEAN_MASS},    {0x0100, 2, BcmField::BODY_WATER_MASS},
+    {0x0200, 2, BcmField::IMPEDANCE},         {0x0400, 2, BcmField::WEIGHT},
+    {0x0800, 2, BcmField::HEIGHT},
+};
+
+// flags, body fat percentage and the fields the flags announce
+constexpr size_t bcmFrameLength(uint16_t flags) {
+    size_t length = 4;
+    for (const auto &descriptor : BCM_FIELDS) {
+        length += (flags & descriptor.flag) ? descriptor.size : 0;
+    }
+    return length;
+}
+
+static_assert(bcmFrameLength(0x051e) == 20, "the Shape100 frame: time stamp, user, BMR, muscle, water, weight");
+
+// Mass and height resolution as announced in the Body Composition Feature (0x2a9b),
+// indexed by its bits 11..14 and 15..17; index 0 (not specified) is the finest one
+constexpr float BCM_MASS_RESOLUTION_KG[] = {0.005f, 0.5f, 0.2f, 0.1f, 0.05f, 0.02f, 0.01f, 0.005f};
+constexpr float BCM_MASS_RESOLUTION_LB[] = {0.01f, 1.0f, 0.5f, 0.2f, 0.1f, 0.05f, 0.02f, 0.01f};
+constexpr float BCM_HEIGHT_RESOLUTION_M[] = {0.001f, 0.01f, 0.005f, 0.001f};
+constexpr float BCM_HEIGHT_RESOLUTION_INCH[] = {0.1f, 1.0f, 0.5f, 0.1f};
+
+// one measurement in SI units; `flags` has every field that arrived, over all packets
+struct BodyComposition {
+    uint16_t flags = 0;
+    float fatPercentage = 0.0f;
+    uint16_t year = 0;
+    uint8_t month = 0;
+    uint8_t day = 0;
+    uint8_t hour = 0;
+    uint8_t minute = 0;
+    uint8_t second = 0;
+    uint8_t userID = BCM_USER_UNKNOWN;
+    uint16_t basalMetabolismKj = 0;
+    float musclePercentage = 0.0f;
+    float muscleMassKg = 0.0f;
+    float fatFreeMassKg = 0.0f;
+    float softLeanMassKg = 0.0f;
+    float bodyWaterMassKg = 0.0f;
+    float impedanceOhm = 0.0f;
+    float weightKg = 0.0f;
+    float heightM = 0.0f;
+
+    bool has(BcmField field) const {
+        for (const auto &descriptor : BCM_FIELDS) {
+            if (descriptor.field == field) {
+                return flags & descriptor.flag;
+            }
+        }
+        return false;
+    }
+};
+
+enum class BcmResult : uint8_t {
+    COMPLETE,
+    PENDING,      // first packet of a multiple packet measurement
+    TRUNCATED,    // shorter than its flags announce
+    UNSUCCESSFUL, // the scale reported a failed measurement
+};
+
+inline uint16_t readUint16Le(const uint8_t *data) {
+    return data[0] | (data[1] << 8);
+}
+
+// Keeps the first packet of a multiple packet measurement until the second one
+// arrives. Not thread safe, one decoder per frame consumer.
+class BodyCompositionDecoder {
+  public:
+    explicit BodyCompositionDecoder(uint8_t massResolution = 0, uint8_t heightResolution = 0)
+        : massResolution_(massResolution & 0x07), heightResolution_(heightResolution & 0x03) {}
+
+    BcmResult decode(const uint8_t *data, size_t length) {
+        if (length < 4) {
+            return BcmResult::TRUNCATED;
+        }
+        uint16_t flags = readUint16Le(data);
+        if (length < bcmFrameLength(flags)) {
+            return BcmResult::TRUNCATED;
+        }
+        bool multiplePacket = flags & BCM_FLAG_MULTIPLE_PACKET;
+        if (!(multiplePacket && pending_)) {
+            result_ = BodyComposition(); // a single packet, or the first one of two
+        }
+        pending_ = multiplePacket && !pending_;
+
+        uint16_t fat = readUint16Le(data + 2);
+        if (fat == BCM_FAT_UNSUCCESSFUL) {
+            pending_ = false;
+            return BcmResult::UNSUCCESSFUL;
+        }
+        result_.fatPercentage = fat * 0.1f;
+
+        bool imperial = flags & BCM_FLAG_IMPERIAL;
+        float massKg = imperial ? BCM_MASS_RESOLUTION_LB[massResolution_] * KG_PER_LB : BCM_MASS_RESOLUTION_KG[massResolution_];
+        float heightM = imperial ? BCM_HEIGHT_RESOLUTION_INCH[heightResolution_] * M_PER_INCH : BCM_HEIGHT_RESOLUTION_M[heightResolution_];
+
+        const uint8_t *field = data + 4;
+        for (const auto &descriptor : BCM_FIELDS) {
+            if (!(flags & descriptor.flag)) {
+                continue;
+            }
+            switch (descriptor.field) {
+                case BcmField::TIME_STAMP:
+                    result_.year = readUint16Le(field);
+                    result_.month = field[2];
+                    result_.day = field[3];
+                    result_.hour = field[4];
+                    result_.minute = field[5];
+                    result_.second = field[6];
+                    break;
+                case BcmField::USER_ID: result_.userID = field[0]; break;
+                case BcmField::BASAL_METABOLISM: result_.basalMetabolismKj = readUint16Le(field); break;
+                case BcmField::MUSCLE_PERCENTAGE: result_.musclePercentage = readUint16Le(field) * 0.1f; break;
+                case BcmField::MUSCLE_MASS: result_.muscleMassKg = readUint16Le(field) * massKg; break;
+                case BcmField::FAT_FREE_MASS: result_.fatFreeMassKg = readUint16Le(field) * massKg; break;
+                case BcmField::SOFT_LEAN_MASS: result_.softLeanMassKg = readUint16Le(field) * massKg; break;
+                case BcmField::BODY_WATER_MASS: result_.bodyWaterMassKg = readUint16Le(field) * massKg; break;
+                case BcmField::IMPEDANCE: result_.impedanceOhm = readUint16Le(field) * 0.1f; break;
+                case BcmField::WEIGHT: result_.weightKg = readUint16Le(field) * massKg; break;
+                case BcmField::HEIGHT: result_.heightM = readUint16Le(field) * heightM; break;
+            }
+            field += descriptor.size;
+        }
+        result_.flags |= flags & ~(BCM_FLAG_IMPERIAL | BCM_FLAG_MULTIPLE_PACKET);
+        return pending_ ? BcmResult::PENDING : BcmResult::COMPLETE;
+    }
+
+    const BodyComposition &result() const {
+        return result_;
+    }
+
+    // drops a first packet whose second one never came, e.g. after a disconnect
+    void reset() {
+        pending_ = false;
+    }
+
+  private:
+    uint8_t massResolution_;
+    uint8_t heightResolution_;
+    bool pending_ = false;
+    BodyComposition result_;
+};
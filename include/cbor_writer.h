@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The few CBOR (RFC 8949) items the measurement payload needs, written into a
+// caller's buffer. Like snprintf, length() keeps counting past the end of the
+// buffer, so an overflow shows as length() > size.
+class CborWriter {
+  public:
+    CborWriter(uint8_t *buffer, size_t size) : buffer_(buffer), size_(size) {}
+
+    void array(uint32_t count) {
+        head(4, count);
+    }
+
+    void uint(uint32_t value) {
+        head(0, value);
+    }
+
+    // tag 1: the following uint is seconds since 1970
+    void epochTime(uint32_t seconds) {
+        head(6, 1);
+        head(0, seconds);
+    }
+
+    size_t length() const {
+        return length_;
+    }
+
+    bool overflowed() const {
+        return length_ > size_;
+    }
+
+  private:
+    // major type in the top 3 bits, the argument inline below 24 or in 1, 2 or 4 bytes after it
+    void head(uint8_t major, uint32_t value) {
+        uint8_t type = major << 5;
+        if (value < 24) {
+            put(type | value);
+        } else if (value <= 0xFF) {
+            put(type | 24);
+            put(value);
+        } else if (value <= 0xFFFF) {
+            put(type | 25);
+            put(value >> 8);
+            put(value);
+        } else {
+            put(type | 26);
+            put(value >> 24);
+            put(value >> 16);
+            put(value >> 8);
+            put(value);
+        }
+    }
+
+    void put(uint8_t byte) {
+        if (length_ < size_) {
+            buffer_[length_] = byte;
+        }
+        length_++;
+    }
+
+    uint8_t *buffer_;
+    size_t size_;
+    size_t length_ = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size FreeRTOS queue of commands into one task, storage included, so it never
+// touches the heap. post() does not block and wakes the receiver through its task
+// notification, which is what the receiving task blocks on between its passes.
+template <typename T, size_t Depth>
+class CommandQueue {
+  public:
+    void begin() {
+        handle_ = xQueueCreateStatic(Depth, sizeof(T), storage_, &queue_);
+    }
+
+    void setReceiver(TaskHandle_t receiver) {
+        receiver_ = receiver;
+    }
+
+    // false when the queue is full or not created yet; the receiver is woken either way
+    bool post(const T &command) {
+        bool queued = handle_ != nullptr && xQueueSend(handle_, &command, 0) == pdTRUE;
+        if (!queued) {
+            dropped_++;
+        }
+        if (receiver_ != nullptr) {
+            xTaskNotifyGive(receiver_);
+        }
+        return queued;
+    }
+
+    bool receive(T &command) {
+        return handle_ != nullptr && xQueueReceive(handle_, &command, 0) == pdTRUE;
+    }
+
+    uint32_t dropped() const {
+        return dropped_;
+    }
+
+  private:
+    uint8_t storage_[Depth * sizeof(T)];
+    StaticQueue_t queue_;
+    QueueHandle_t handle_ = nullptr;
+    TaskHandle_t receiver_ = nullptr;
+    uint32_t dropped_ = 0; // only the task posting writes it
+};
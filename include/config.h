@@ -9,3 +9,47 @@ static const char MQTT_SERVER_IP[] = "MQTT_SERVER_IP";
 static const uint16_t MQTT_SERVER_PORT = 1883;
 static const char MQTT_SERVER_USER[] = "MQTT_SERVER_USER";
 static const char MQTT_SERVER_PASSWORD[] = "MQTT_SERVER_PASSWORD";
+
+// NTP server used to sync the module time
+static const char NTP_SERVER[] = "pool.ntp.org";
+
+// Scales the bridge serves, each with a BLE session of its own and the MQTT topic prefix its
+// measurements go out under. An empty address takes the first scale found that no other entry
+// has claimed and keeps its address in NVS; a fixed one ("aa:bb:cc:dd:ee:ff", public address)
+// tells identical scales apart from the start. At most CONFIG_BT_NIMBLE_MAX_CONNECTIONS entries
+// (3 unless the build raises it), the bridge holds a link to each of them at once.
+struct ScaleConfig {
+    const char *name; // matched against the advertised name, the Body Composition service always matches
+    const char *address;
+    const char *topic;
+};
+
+static constexpr ScaleConfig SCALES[] = {
+    {"Shape100", "", "smartscale/"},
+};
+
+// Users registered on the scale whose stored measurements are fetched by the history sync
+// (user index 1..8 and the 4 digit consent code chosen when the user was created on the scale)
+struct ScaleUser {
+    uint8_t index;
+    uint16_t consentCode;
+};
+
+static const ScaleUser SCALE_USERS[] = {
+    {1, 0},
+};
+
+// Height in cm of the users 1..8 for the BMI of smartscale/trend, 0 leaves it out
+static const uint8_t USER_HEIGHT_CM[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+// Mass Measurement Resolution of the scale's Body Composition Feature (0x2a9b):
+// 1 = 0.5 kg, 2 = 0.2 kg, 3 = 0.1 kg (Shape100), ... 7 = 0.005 kg; the lb steps are twice as fine
+static const uint8_t SCALE_MASS_RESOLUTION = 3;
+
+// Duty cycle of the BLE scan that waits for the scale: the radio listens for SCAN_WINDOW_MS
+// every interval and the SoC sleeps in between. Hours in which the scale is usually used get
+// SCAN_BUSY_INTERVAL_MS, the others SCAN_QUIET_INTERVAL_MS; an interval equal to the window
+// scans continuously.
+static const uint16_t SCAN_WINDOW_MS = 30;
+static const uint16_t SCAN_BUSY_INTERVAL_MS = 60;
+static const uint16_t SCAN_QUIET_INTERVAL_MS = 600;
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+// Log levels: LOG_LEVEL (a build flag, -D LOG_LEVEL=LOG_LEVEL_INFO) compiles every event above
+// it out, its arguments included
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+constexpr size_t LOG_ARGS = 6;          // arguments an event carries
+constexpr size_t LOG_DATA = 48;         // bytes of its string arguments and raw bytes, longer ones are cut
+constexpr size_t LOG_RING_CAPACITY = 16; // events per producing task, the longest burst of a pass at DEBUG is 11
+constexpr size_t LOG_PRODUCERS = 6;     // rings: the NimBLE host task and any other, setup() and the app tasks
+constexpr size_t LOG_LINE_SIZE = 160;
+
+enum class LogArgType : uint8_t { INT, UINT, DOUBLE, TEXT, BYTES };
+
+// one log line as its caller left it: the format string (a literal, it outlives the event) and
+// the arguments in binary, formatted only when the log task writes the line
+struct LogEvent {
+    const char *format;
+    unsigned long at; // millis()
+    uint8_t level;
+    uint8_t argCount;
+    uint8_t dataLength;
+    LogArgType types[LOG_ARGS];
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        struct {
+            uint8_t offset; // TEXT and BYTES: where in data
+            uint8_t length;
+        } data;
+    } args[LOG_ARGS];
+    char data[LOG_DATA];
+};
+
+// raw bytes for the log, written as hex; see LOG_INFO_BYTES()
+struct LogBytes {
+    const void *data;
+    size_t length;
+};
+
+// Single-producer/single-consumer ring of log events in the manner of FrameQueue: the event is
+// written in place, plain atomic loads and stores only.
+class LogRing {
+  public:
+    // producer side; nullptr and a counted drop when the ring is full
+    LogEvent *reserve() {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == LOG_RING_CAPACITY) {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots_[head % LOG_RING_CAPACITY];
+    }
+
+    void commit() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer side
+    const LogEvent *front() const {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        return tail == head_.load(std::memory_order_acquire) ? nullptr : &slots_[tail % LOG_RING_CAPACITY];
+    }
+
+    void pop() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint32_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    LogEvent slots_[LOG_RING_CAPACITY];
+    std::atomic<uint32_t> head_{0};    // written by the producer only
+    std::atomic<uint32_t> tail_{0};    // written by the consumer only
+    std::atomic<uint32_t> dropped_{0}; // written by the producer only
+};
+
+// Deferred logging: a task that logs copies the format pointer and its arguments into a ring of
+// its own and wakes the log task, which formats and writes the lines to Serial when nothing
+// more important runs. A caller never formats, never waits for the UART and never allocates.
+// Tasks are told apart by their handle; the NimBLE host task and any task not registered share
+// ring 0, which only the host task writes in this firmware.
+class EventLog {
+  public:
+    // writes every event in the caller instead, as Serial.printf() did, e.g. to see the last
+    // lines before a crash
+    bool synchronous = false;
+
+    // before the task runs or with the scheduler suspended, so no task looks up its ring meanwhile
+    void registerTask(TaskHandle_t task) {
+        for (size_t i = 1; i < producerCount_; i++) {
+            if (producers_[i] == task) {
+                return;
+            }
+        }
+        if (task != nullptr && producerCount_ < LOG_PRODUCERS) {
+            producers_[producerCount_++] = task;
+        }
+    }
+
+    void setDrainTask(TaskHandle_t task) {
+        drainTask_ = task;
+    }
+
+    template <typename... Args>
+    void write(uint8_t level, const char *format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_ARGS, "more log arguments than LOG_ARGS");
+        LogEvent local;
+        LogEvent *event = synchronous ? &local : ring().reserve();
+        if (event == nullptr) {
+            return;
+        }
+        event->format = format;
+        event->at = millis();
+        event->level = level;
+        event->argCount = 0;
+        event->dataLength = 0;
+        int unpack[] = {0, (capture(*event, args), 0)...};
+        (void)unpack;
+        publish(*event);
+    }
+
+    // the log task's pass: writes the oldest waiting event, false when there is none
+    bool drainOne() {
+        size_t oldest = LOG_PRODUCERS;
+        for (size_t i = 0; i < LOG_PRODUCERS; i++) {
+            uint32_t dropped = rings_[i].dropped();
+            if (dropped != reportedDrops_[i]) {
+                Serial.printf("%lu log events dropped\n", (unsigned long)(dropped - reportedDrops_[i]));
+                reportedDrops_[i] = dropped;
+            }
+            const LogEvent *event = rings_[i].front();
+            if (event != nullptr && (oldest == LOG_PRODUCERS || long(event->at - rings_[oldest].front()->at) < 0)) {
+                oldest = i;
+            }
+        }
+        if (oldest == LOG_PRODUCERS) {
+            return false;
+        }
+        print(*rings_[oldest].front());
+        rings_[oldest].pop();
+        return true;
+    }
+
+    uint32_t dropped() const {
+        uint32_t dropped = 0;
+        for (const LogRing &ring : rings_) {
+            dropped += ring.dropped();
+        }
+        return dropped;
+    }
+
+    // "[millis] " and the event's format with its arguments, cut at `size`
+    static size_t format(const LogEvent &event, char *line, size_t size) {
+        size_t length = clamp(snprintf(line, size, "[%lu] ", event.at), size);
+        size_t arg = 0;
+        const char *f = event.format;
+        while (*f != '\0' && length + 1 < size) {
+            if (*f != '%' || f[1] == '%') {
+                line[length++] = *f;
+                f += *f == '%' ? 2 : 1;
+                continue;
+            }
+            // flags, width and precision are kept, the length modifier follows the stored type
+            char spec[16];
+            size_t specLength = 0;
+            spec[specLength++] = *f++;
+            while (*f != '\0' && strchr("-+ #0123456789.", *f) && specLength < sizeof(spec) - 4) {
+                spec[specLength++] = *f++;
+            }
+            while (*f != '\0' && strchr("hlzjt", *f)) {
+                f++;
+            }
+            char conversion = *f != '\0' ? *f++ : 's';
+            if (arg >= event.argCount) {
+                length += clamp(snprintf(line + length, size - length, "?"), size - length);
+                continue;
+            }
+            length += formatArg(event, arg++, spec, specLength, conversion, line + length, size - length);
+        }
+        // raw bytes after the text
+        for (; arg < event.argCount && length + 1 < size; arg++) {
+            if (event.types[arg] == LogArgType::BYTES) {
+                length += formatArg(event, arg, nullptr, 0, 'x', line + length, size - length);
+            }
+        }
+        line[length] = '\0';
+        return length;
+    }
+
+  private:
+    LogRing &ring() {
+        TaskHandle_t current = xTaskGetCurrentTaskHandle();
+        for (size_t i = 1; i < producerCount_; i++) {
+            if (producers_[i] == current) {
+                return rings_[i];
+            }
+        }
+        return rings_[0];
+    }
+
+    void publish(const LogEvent &event) {
+        if (synchronous) {
+            print(event);
+            return;
+        }
+        ring().commit();
+        if (drainTask_ != nullptr) {
+            xTaskNotifyGive(drainTask_);
+        }
+    }
+
+    static void print(const LogEvent &event) {
+        char line[LOG_LINE_SIZE];
+        format(event, line, sizeof(line) - 1);
+        Serial.println(line);
+    }
+
+    static size_t clamp(int written, size_t size) {
+        return written < 0 ? 0 : (size_t)written < size ? (size_t)written : size - 1;
+    }
+
+    static size_t formatArg(const LogEvent &event, size_t arg, char *spec, size_t specLength, char conversion, char *out,
+                            size_t size) {
+        const auto &value = event.args[arg];
+        switch (event.types[arg]) {
+            case LogArgType::INT:
+            case LogArgType::UINT:
+                if (conversion == 'c') {
+                    spec[specLength++] = 'c';
+                    spec[specLength] = '\0';
+                    return clamp(snprintf(out, size, spec, int(value.i)), size);
+                }
+                spec[specLength++] = 'l';
+                spec[specLength++] = 'l';
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                return clamp(event.types[arg] == LogArgType::INT ? snprintf(out, size, spec, (long long)value.i)
+                                                                 : snprintf(out, size, spec, (unsigned long long)value.u),
+                             size);
+            case LogArgType::DOUBLE:
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                return clamp(snprintf(out, size, spec, value.d), size);
+            case LogArgType::TEXT:
+                spec[specLength++] = 's';
+                spec[specLength] = '\0';
+                return clamp(snprintf(out, size, spec, event.data + value.data.offset), size);
+            case LogArgType::BYTES: {
+                size_t length = 0;
+                for (size_t i = 0; i < value.data.length && length + 2 < size; i++) {
+                    length += clamp(snprintf(out + length, size - length, "%02x", uint8_t(event.data[value.data.offset + i])),
+                                    size - length);
+                }
+                return length;
+            }
+        }
+        return 0;
+    }
+
+    template <typename T>
+    static void capture(LogEvent &event, T value) {
+        size_t i = event.argCount++;
+        if constexpr (std::is_floating_point<T>::value) {
+            event.types[i] = LogArgType::DOUBLE;
+            event.args[i].d = value;
+        } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+            event.types[i] = LogArgType::INT;
+            event.args[i].i = value;
+        } else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+            event.types[i] = LogArgType::UINT;
+            event.args[i].u = (uint64_t)value;
+        } else if constexpr (std::is_same<T, LogBytes>::value) {
+            event.types[i] = LogArgType::BYTES;
+            copyData(event, i, value.data, value.length, false);
+        } else {
+            static_assert(std::is_convertible<T, const char *>::value, "log arguments are numbers, strings or LogBytes");
+            const char *text = value != nullptr ? value : "(null)";
+            event.types[i] = LogArgType::TEXT;
+            copyData(event, i, text, strlen(text), true);
+        }
+    }
+
+    // a copy, so the caller's buffer may change before the log task gets to the event
+    static void copyData(LogEvent &event, size_t arg, const void *data, size_t length, bool terminate) {
+        size_t room = LOG_DATA - event.dataLength - (terminate ? 1 : 0);
+        length = length < room ? length : room;
+        event.args[arg].data.offset = event.dataLength;
+        event.args[arg].data.length = length;
+        memcpy(event.data + event.dataLength, data, length);
+        event.dataLength += length;
+        if (terminate) {
+            event.data[event.dataLength++] = '\0';
+        }
+    }
+
+    LogRing rings_[LOG_PRODUCERS];
+    TaskHandle_t producers_[LOG_PRODUCERS] = {};
+    size_t producerCount_ = 1; // ring 0 has no handle
+    TaskHandle_t drainTask_ = nullptr;
+    uint32_t reportedDrops_[LOG_PRODUCERS] = {}; // by the log task
+};
+
+EventLog eventLog;
+
+// compile-time check of the format against its arguments, never called
+inline void logFormatCheck(const char *format, ...) __attribute__((format(printf, 1, 2)));
+inline void logFormatCheck(const char *format, ...) {}
+
+#define LOG_EVENT(level, ...)                                                                                              \
+    do {                                                                                                                   \
+        if (false) {                                                                                                       \
+            logFormatCheck(__VA_ARGS__);                                                                                   \
+        }                                                                                                                  \
+        eventLog.write(level, __VA_ARGS__);                                                                                \
+    } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_EVENT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_EVENT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_INFO_BYTES(text, data, length) eventLog.write(LOG_LEVEL_INFO, text, LogBytes{data, length})
+#else
+#define LOG_INFO(...) do {} while (0)
+#define LOG_INFO_BYTES(text, data, length) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_EVENT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_DEBUG_BYTES(text, data, length) eventLog.write(LOG_LEVEL_DEBUG, text, LogBytes{data, length})
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#define LOG_DEBUG_BYTES(text, data, length) do {} while (0)
+#endif
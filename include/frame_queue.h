@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// large enough for a Body Composition Measurement with every optional field present
+constexpr size_t FRAME_MAX_LENGTH = 32;
+
+struct RawFrame {
+    unsigned long receivedAt = 0; // millis() when the indication arrived
+    uint8_t length = 0;
+    uint8_t scale = 0; // index of the scale session it arrived on
+    uint8_t data[FRAME_MAX_LENGTH];
+};
+
+// Fixed-capacity single-producer/single-consumer ring of raw indication frames.
+// The NimBLE host task pushes, the publish task pops; no locks and no heap allocation.
+// Only plain atomic loads/stores are used (no read-modify-write), which the
+// ESP32-C3 handles without the RISC-V A extension.
+template <size_t Capacity>
+class FrameQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  public:
+    // producer side; returns false and counts a drop when the frame does not fit
+    bool push(const uint8_t *data, size_t length, unsigned long receivedAt, uint8_t scale = 0) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (length > FRAME_MAX_LENGTH || head - tail_.load(std::memory_order_acquire) == Capacity) {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        RawFrame &slot = slots_[head & (Capacity - 1)];
+        slot.receivedAt = receivedAt;
+        slot.length = length;
+        slot.scale = scale;
+        memcpy(slot.data, data, length);
+
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer side; a frame turned away before push(), e.g. one too long to copy out
+    void countDrop() {
+        dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // consumer side
+    bool pop(RawFrame &out) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        const RawFrame &slot = slots_[tail & (Capacity - 1)];
+        out.receivedAt = slot.receivedAt;
+        out.length = slot.length;
+        out.scale = slot.scale;
+        memcpy(out.data, slot.data, slot.length);
+
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+    // frames accepted since boot, readable from either side
+    uint32_t pushedCount() const {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    uint32_t droppedCount() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    RawFrame slots_[Capacity];
+    std::atomic<uint32_t> head_{0}; // written by the producer only
+    std::atomic<uint32_t> tail_{0}; // written by the consumer only
+    std::atomic<uint32_t> dropped_{0}; // written by the producer only
+};
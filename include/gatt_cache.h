@@ -0,0 +1,180 @@
+#pragma once
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
+
+constexpr uint8_t GATT_CACHE_VERSION = 1; // bump when GattHandles changes
+constexpr uint32_t GATT_OP_TIMEOUT_MS = 2000;
+
+// Address of the scale and the value/CCCD handles the firmware uses. The layout has
+// no padding, so two copies can be compared with memcmp.
+struct GattHandles {
+    uint8_t version = GATT_CACHE_VERSION;
+    uint8_t addressType = 0;
+    char address[18] = ""; // "aa:bb:cc:dd:ee:ff"
+    uint16_t batteryLevel = 0;
+    uint16_t currentTime = 0;
+    uint16_t bodyComposition = 0;
+    uint16_t bodyCompositionCccd = 0;
+    uint16_t userControlPoint = 0; // 0 when the scale has no User Data Service
+    uint16_t userControlPointCccd = 0;
+};
+
+// "aa:bb:cc:dd:ee:ff" into a char[18], without the std::string of NimBLEAddress::toString()
+void formatAddress(const NimBLEAddress &address, char *buffer, size_t size) {
+    const uint8_t *val = address.getVal(); // least significant byte first
+    snprintf(buffer, size, "%02x:%02x:%02x:%02x:%02x:%02x", val[5], val[4], val[3], val[2], val[1], val[0]);
+}
+
+// the address bytes and type in one word, never 0, so a single atomic can publish an address to the
+// NimBLE host task
+uint64_t packAddress(const NimBLEAddress &address) {
+    const uint8_t *val = address.getVal();
+    uint64_t packed = uint64_t(1) << 56 | uint64_t(address.getType()) << 48;
+    for (int i = 0; i < 6; i++) {
+        packed |= uint64_t(val[i]) << (8 * i);
+    }
+    return packed;
+}
+
+// Handles found by the last full service discovery, persisted in NVS so the next
+// connection can skip the scan and the discovery.
+class GattCache {
+  public:
+    void begin(const char *name = "gatt") {
+        prefs_.begin(name, false);
+        GattHandles stored;
+        if (prefs_.getBytes("handles", &stored, sizeof(stored)) == sizeof(stored) && stored.version == GATT_CACHE_VERSION &&
+            stored.bodyComposition != 0) {
+            handles_ = stored;
+            address_ = NimBLEAddress(std::string(handles_.address), handles_.addressType);
+            matchKey_ = packAddress(address_);
+        }
+    }
+
+    bool valid() const {
+        return matchKey_ != 0;
+    }
+
+    const GattHandles &handles() const {
+        return handles_;
+    }
+
+    const NimBLEAddress &address() const {
+        return address_;
+    }
+
+    // one atomic load, no allocation, so the scan callback on the NimBLE host task can use it
+    bool matches(const NimBLEAddress &address) const {
+        return matchKey_ == packAddress(address);
+    }
+
+    // only writes NVS when something changed
+    void store(const GattHandles &handles) {
+        if (valid() && memcmp(&handles, &handles_, sizeof(handles)) == 0) {
+            return;
+        }
+        handles_ = handles;
+        address_ = NimBLEAddress(std::string(handles_.address), handles_.addressType);
+        matchKey_ = packAddress(address_);
+        prefs_.putBytes("handles", &handles_, sizeof(handles_));
+    }
+
+    void invalidate() {
+        matchKey_ = 0;
+        prefs_.remove("handles");
+    }
+
+  private:
+    Preferences prefs_;
+    GattHandles handles_;
+    NimBLEAddress address_; // handles_ and address_ belong to the BLE task
+    std::atomic<uint64_t> matchKey_{0}; // packAddress(address_) while valid, 0 otherwise
+};
+
+// Blocking read/write by attribute handle through the NimBLE host API, for a
+// connection that skipped the discovery and therefore has no NimBLERemoteCharacteristic.
+// One operation at a time. The host task completes it into gattOp, never into the caller's
+// buffer, and gives the semaphore the BLE task blocks on. `state` holds the id of the operation
+// and its phase in one word, so a completion after the timeout, or of an earlier operation,
+// finds it abandoned or gone and changes nothing.
+constexpr size_t GATT_OP_DATA_MAX = 20; // a read answer in one ATT packet at the default MTU
+constexpr uint32_t GATT_OP_PENDING = 0;
+constexpr uint32_t GATT_OP_CLAIMED = 1; // the completion is being written, the semaphore follows
+constexpr uint32_t GATT_OP_ABANDONED = 2; // timed out, a late completion is dropped
+
+struct GattOp {
+    std::atomic<uint32_t> state{0}; // id << 2 | phase
+    int status = 0;
+    uint8_t data[GATT_OP_DATA_MAX];
+    size_t length = 0;
+    SemaphoreHandle_t done = nullptr;
+    StaticSemaphore_t doneBuffer;
+};
+
+GattOp gattOp;
+
+// runs on the NimBLE host task; `arg` is the state of the operation while pending
+int onGattOpComplete(uint16_t connHandle, const ble_gatt_error *error, ble_gatt_attr *attr, void *arg) {
+    uint32_t pending = (uint32_t)(uintptr_t)arg;
+    if (!gattOp.state.compare_exchange_strong(pending, pending | GATT_OP_CLAIMED)) {
+        return 0;
+    }
+    gattOp.status = error->status;
+    if (error->status == 0 && attr && attr->om) {
+        size_t length = OS_MBUF_PKTLEN(attr->om);
+        if (length > sizeof(gattOp.data)) {
+            length = sizeof(gattOp.data);
+        }
+        os_mbuf_copydata(attr->om, 0, length, gattOp.data);
+        gattOp.length = length;
+    }
+    xSemaphoreGive(gattOp.done);
+    return 0;
+}
+
+void *beginGattOp() {
+    if (gattOp.done == nullptr) {
+        gattOp.done = xSemaphoreCreateBinaryStatic(&gattOp.doneBuffer);
+    }
+    gattOp.status = 0;
+    gattOp.length = 0;
+    uint32_t pending = ((gattOp.state.load() >> 2) + 1) << 2 | GATT_OP_PENDING;
+    gattOp.state = pending;
+    return (void *)(uintptr_t)pending;
+}
+
+bool waitForGattOp(int rc, void *arg) {
+    if (rc != 0) {
+        return false;
+    }
+    if (xSemaphoreTake(gattOp.done, pdMS_TO_TICKS(GATT_OP_TIMEOUT_MS)) != pdTRUE) {
+        uint32_t pending = (uint32_t)(uintptr_t)arg;
+        if (gattOp.state.compare_exchange_strong(pending, pending | GATT_OP_ABANDONED)) {
+            return false;
+        }
+        xSemaphoreTake(gattOp.done, portMAX_DELAY); // claimed just before the timeout, the give is on its way
+    }
+    return gattOp.status == 0;
+}
+
+bool gattReadByHandle(uint16_t connHandle, uint16_t handle, uint8_t *out, size_t &length) {
+    void *arg = beginGattOp();
+    if (!waitForGattOp(ble_gattc_read(connHandle, handle, onGattOpComplete, arg), arg)) {
+        length = 0;
+        return false;
+    }
+    length = gattOp.length < length ? gattOp.length : length;
+    memcpy(out, gattOp.data, length);
+    return true;
+}
+
+bool gattWriteByHandle(uint16_t connHandle, uint16_t handle, const uint8_t *data, size_t length) {
+    void *arg = beginGattOp();
+    return waitForGattOp(ble_gattc_write_flat(connHandle, handle, data, length, onGattOpComplete, arg), arg);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include <atomic>
+
+constexpr uint8_t MAX_SCALE_USERS = 8; // user indexes 1..8, the scale reports 255 for an unknown user
+constexpr uint32_t SCALE_TIME_YEAR = 1UL << 26; // a year in a packed scale timestamp, see packScaleTime()
+
+// Per-user "last seen" scale timestamp, persisted in NVS, so a history sync only
+// publishes the stored measurements that were not delivered before. The indication callback
+// checks it too and drops a repeated frame before it is queued, decoded or published.
+// A frame a year or more before the mark is no stored measurement: the scale's clock was
+// reset (battery swap), and the mark starts again from that frame.
+class HistoryCursor {
+  public:
+    void begin(const char *name = "history") {
+        prefs_.begin(name, false);
+        uint32_t stored[MAX_SCALE_USERS] = {};
+        prefs_.getBytes("lastSeen", stored, sizeof(stored));
+        for (uint8_t i = 0; i < MAX_SCALE_USERS; i++) {
+            lastSeen_[i].store(stored[i], std::memory_order_relaxed);
+        }
+    }
+
+    bool isNew(uint8_t userID, uint32_t scaleTime) const {
+        if (userID == 0 || userID > MAX_SCALE_USERS) {
+            return true;
+        }
+        uint32_t lastSeen = lastSeen_[userID - 1].load(std::memory_order_relaxed);
+        return scaleTime > lastSeen || clockStepsBack(scaleTime, lastSeen);
+    }
+
+    // NimBLE host task: a frame at or before the newest one published or still queued for this
+    // user is a repeat. lastSeen_ is written by the publish task, queued_ by this one
+    bool isRepeat(uint8_t userID, uint32_t scaleTime) const {
+        if (userID == 0 || userID > MAX_SCALE_USERS) {
+            return false;
+        }
+        uint32_t lastSeen = lastSeen_[userID - 1].load(std::memory_order_relaxed);
+        uint32_t queued = queued_[userID - 1].load(std::memory_order_relaxed);
+        uint32_t newest = lastSeen > queued ? lastSeen : queued;
+        return scaleTime <= newest && !clockStepsBack(scaleTime, newest);
+    }
+
+    // NimBLE host task: a frame of `userID` went into the frame queue
+    void queued(uint8_t userID, uint32_t scaleTime) {
+        if (userID == 0 || userID > MAX_SCALE_USERS) {
+            return;
+        }
+        uint32_t queued = queued_[userID - 1].load(std::memory_order_relaxed);
+        if (scaleTime > queued || clockStepsBack(scaleTime, queued)) {
+            queued_[userID - 1].store(scaleTime, std::memory_order_relaxed);
+        }
+    }
+
+    // publish task: the only writer of lastSeen_
+    void advance(uint8_t userID, uint32_t scaleTime) {
+        if (!isNew(userID, scaleTime) || userID == 0 || userID > MAX_SCALE_USERS) {
+            return;
+        }
+        lastSeen_[userID - 1].store(scaleTime, std::memory_order_relaxed);
+        uint32_t stored[MAX_SCALE_USERS];
+        for (uint8_t i = 0; i < MAX_SCALE_USERS; i++) {
+            stored[i] = lastSeen_[i].load(std::memory_order_relaxed);
+        }
+        prefs_.putBytes("lastSeen", stored, sizeof(stored));
+    }
+
+    void clear() {
+        prefs_.clear();
+        for (uint8_t i = 0; i < MAX_SCALE_USERS; i++) {
+            lastSeen_[i].store(0, std::memory_order_relaxed);
+            queued_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+  private:
+    static bool clockStepsBack(uint32_t scaleTime, uint32_t mark) {
+        return mark >= SCALE_TIME_YEAR && scaleTime <= mark - SCALE_TIME_YEAR;
+    }
+
+    Preferences prefs_;
+    // each word on its own: a frame is compared with one user's marks only
+    std::atomic<uint32_t> lastSeen_[MAX_SCALE_USERS] = {};
+    std::atomic<uint32_t> queued_[MAX_SCALE_USERS] = {}; // not persisted, the queue does not survive a reboot either
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ble_trace.h"
+
+// Fixed-bucket latency histograms for the stats topic. Bucket 0 counts 0 ms,
+// bucket i durations from 2^(i-1) up to 2^i ms and the last one everything
+// from 65.5 s on, so a histogram is 80 bytes however long the module runs.
+
+constexpr size_t HISTOGRAM_BUCKETS = 18;
+
+class LatencyHistogram {
+  public:
+    void record(uint32_t ms) {
+        size_t bucket = 0;
+        while (bucket + 1 < HISTOGRAM_BUCKETS && ms >= (1UL << bucket)) {
+            bucket++;
+        }
+        counts_[bucket]++;
+        count_++;
+        if (ms > max_) {
+            max_ = ms;
+        }
+    }
+
+    uint32_t count() const {
+        return count_;
+    }
+
+    uint32_t max() const {
+        return max_;
+    }
+
+    // upper bound of the bucket holding the p-th percentile, never above the maximum
+    uint32_t percentile(uint8_t p) const {
+        uint32_t rank = (uint64_t(count_) * p + 99) / 100;
+        uint32_t seen = 0;
+        for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+            seen += counts_[bucket];
+            if (seen >= rank && seen > 0) {
+                uint32_t upper = bucket + 1 < HISTOGRAM_BUCKETS ? (1UL << bucket) : max_;
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return 0;
+    }
+
+    // "name":[count,p50,p90,max] for the stats message, returns what snprintf returns
+    int format(char *buffer, size_t size, const char *name) const {
+        return snprintf(buffer, size, "\"%s\":[%lu,%lu,%lu,%lu]", name, (unsigned long)count_, (unsigned long)percentile(50),
+                        (unsigned long)percentile(90), (unsigned long)max_);
+    }
+
+  private:
+    uint32_t counts_[HISTOGRAM_BUCKETS] = {};
+    uint32_t count_ = 0;
+    uint32_t max_ = 0;
+};
+
+// the major operations of a session, timed around the blocking calls
+enum class Operation : uint8_t {
+    SCAN,           // scan or direct connect started until the scale was found, includes the wait for a step-on
+    CONNECT,        // pClient->connect() after a scan
+    DISCOVERY,      // one getService()
+    TIME_WRITE,     // current time written to the scale
+    SUBSCRIBE,      // indications of the Body Composition Measurement enabled
+    WIFI_ASSOCIATE, // WiFi.begin() until connected
+    MQTT_CONNECT,   // mqttClient.connect()
+    PUBLISH,        // QoS 1 publish until its PUBACK
+    COUNT
+};
+
+constexpr const char *OPERATION_NAMES[] = {"scan", "connect", "discovery", "timeWrite", "subscribe", "wifi", "mqtt", "puback"};
+
+static_assert(sizeof(OPERATION_NAMES) / sizeof(OPERATION_NAMES[0]) == size_t(Operation::COUNT), "one name per Operation");
+
+LatencyHistogram operationLatency[size_t(Operation::COUNT)];
+
+void recordLatency(Operation operation, unsigned long ms) {
+    operationLatency[size_t(operation)].record(ms);
+    if (bleTrace) {
+        uint8_t data[5] = {uint8_t(operation), uint8_t(ms), uint8_t(ms >> 8), uint8_t(ms >> 16), uint8_t(ms >> 24)};
+        writeTrace(TraceType::OPERATION, TRACE_NO_SCALE, data, sizeof(data));
+    }
+}
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <Arduino.h>
-#include <ArduinoJson.h>
+
+#include "body_composition.h"
+#include "cbor_writer.h"
+#include "event_log.h"
+#include "measurement_log.h"
 
 struct Measurement {
     char time[25] = "";
+    uint32_t scaleTime = 0; // packed scale timestamp, orders the measurements of a user
     uint8_t pID = 0;
+    uint8_t scale = 0; // index of the scale session
     float weightKg = 0.0;
     float fatPercentage = 0.0;
     float waterPercentage = 0.0;
@@ -14,65 +20,144 @@ struct Measurement {
 
 Measurement measurement;
 
-float decodeMassKg(uint16_t raw) {
-    if (raw == 0) {
-        return 0.0f;
-    }
-
-    float kg = raw * 0.1f;
-    return kg;
+// years 2000..2063 packed into 32 bits, compares like the timestamp itself
+uint32_t packScaleTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+    uint32_t years = year >= 2000 ? (year - 2000) & 0x3F : 0;
+    return (years << 26) | ((uint32_t)month << 22) | ((uint32_t)day << 17) | ((uint32_t)hour << 12) | ((uint32_t)minute << 6) | second;
 }
 
-// the data comes in the form: "1e050000e9070c1a12261e020000000000004b03"
-// which is hex-encoded bytes
-
-#pragma pack(push, 1)
-struct BodyCompositionFrame {
-    uint16_t flags;
-    uint16_t fatPercentage;
-    uint16_t year;
-    uint8_t month;
-    uint8_t day;
-    uint8_t hour;
-    uint8_t minute;
-    uint8_t second;
-    uint8_t userID;
-    uint16_t basalMetabolism;
-    uint16_t musclePercentage;
-    uint16_t waterMass;
-    uint16_t weight;
-};
-#pragma pack(pop)
+// seconds since 1970 of a packed scale timestamp, read as UTC like the "Z" time of the JSON
+uint32_t scaleTimeToUnix(uint32_t scaleTime) {
+    int32_t year = 2000 + (scaleTime >> 26);
+    uint32_t month = (scaleTime >> 22) & 0x0F;
+    uint32_t day = (scaleTime >> 17) & 0x1F;
+    // days since 1970-01-01 of the proleptic Gregorian calendar, with the year starting in March
+    year -= month <= 2;
+    uint32_t era = year / 400;
+    uint32_t yearOfEra = year - era * 400;
+    uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    uint32_t days = era * 146097 + dayOfEra - 719468;
+    return days * 86400 + ((scaleTime >> 12) & 0x1F) * 3600 + ((scaleTime >> 6) & 0x3F) * 60 + (scaleTime & 0x3F);
+}
 
-bool buildMeasurementFromBodyCompositionFrame(const uint8_t *data, size_t length) {
-    if (length < sizeof(BodyCompositionFrame)) {
-        Serial.println("Body composition payload truncated");
+// user and packed timestamp of a single packet frame that carries both, read without decoding
+// it; false for any other frame, those are only told apart after the decode
+bool frameKey(const uint8_t *data, size_t length, uint8_t &userID, uint32_t &scaleTime) {
+    if (length < 4) {
         return false;
     }
+    uint16_t flags = readUint16Le(data);
+    constexpr uint16_t KEYED = 0x0002 | 0x0004; // time stamp and user ID, the first two fields
+    if ((flags & KEYED) != KEYED || (flags & BCM_FLAG_MULTIPLE_PACKET) || length < bcmFrameLength(flags) ||
+        readUint16Le(data + 2) == BCM_FAT_UNSUCCESSFUL) {
+        return false;
+    }
+    const uint8_t *time = data + 4;
+    scaleTime = packScaleTime(readUint16Le(time), time[2], time[3], time[4], time[5], time[6]);
+    userID = data[11];
+    return true;
+}
 
-    // map the raw data to the struct
-    const BodyCompositionFrame* frame = reinterpret_cast<const BodyCompositionFrame*>(data);
-
-    measurement.fatPercentage = frame->fatPercentage / 10.0f;
-    measurement.pID = frame->userID;
-    measurement.musclePercentage = frame->musclePercentage / 10.0f;
+// the data comes in the form: "1e050000e9070c1a12261e020000000000004b03"
+// which is hex-encoded bytes, the flags (0x051e) say which fields follow; `decoder` is the one
+// of the scale the frame came from, it holds the first packet of a multiple packet measurement
+BcmResult buildMeasurementFromBodyCompositionFrame(BodyCompositionDecoder &decoder, const uint8_t *data, size_t length) {
+    BcmResult result = decoder.decode(data, length);
+    if (result == BcmResult::TRUNCATED) {
+        LOG_ERROR("Body composition payload truncated");
+    }
+    if (result != BcmResult::COMPLETE) {
+        return result;
+    }
+    const BodyComposition &frame = decoder.result();
 
-    float bodyWaterMassKg = decodeMassKg(frame->waterMass);
-    measurement.weightKg = decodeMassKg(frame->weight);
+    measurement.fatPercentage = frame.fatPercentage;
+    measurement.pID = frame.userID;
+    measurement.weightKg = frame.weightKg;
+    measurement.musclePercentage = frame.musclePercentage;
+    if (!frame.has(BcmField::MUSCLE_PERCENTAGE) && frame.weightKg > 0.0f) {
+        measurement.musclePercentage = (frame.muscleMassKg / frame.weightKg) * 100.0f;
+    }
 
-    snprintf(measurement.time, sizeof(measurement.time), "%04u-%02u-%02uT%02u:%02u:%02uZ",
-             frame->year, frame->month, frame->day, frame->hour, frame->minute, frame->second);
+    uint16_t year = frame.year;
+    uint8_t month = frame.month, day = frame.day, hour = frame.hour, minute = frame.minute, second = frame.second;
+    if (!frame.has(BcmField::TIME_STAMP)) {
+        // no time stamp in the frame, the scale clock was set from ours at connect
+        time_t now;
+        struct tm timeinfo;
+        time(&now);
+        localtime_r(&now, &timeinfo);
+        year = timeinfo.tm_year + 1900;
+        month = timeinfo.tm_mon + 1;
+        day = timeinfo.tm_mday;
+        hour = timeinfo.tm_hour;
+        minute = timeinfo.tm_min;
+        second = timeinfo.tm_sec;
+    }
+    // the fields of a broken frame are not checked, the modulo keeps each to its width so the
+    // string always fits
+    snprintf(measurement.time, sizeof(measurement.time), "%04u-%02u-%02uT%02u:%02u:%02uZ", year % 10000u, month % 100u,
+             day % 100u, hour % 100u, minute % 100u, second % 100u);
+    measurement.scaleTime = packScaleTime(year, month, day, hour, minute, second);
 
     if (measurement.weightKg > 0.0f) {
-        measurement.waterPercentage = (bodyWaterMassKg / measurement.weightKg) * 100.0f;
+        measurement.waterPercentage = (frame.bodyWaterMassKg / measurement.weightKg) * 100.0f;
     } else {
         measurement.waterPercentage = 0.0f;
     }
 
-    return true;
+    return BcmResult::COMPLETE;
 }
 
+uint16_t toTenths(float value) {
+    return value > 0.0f ? (uint16_t)lroundf(value * 10.0f) : 0;
+}
+
+// appends the measurement to the log in flash, where it waits for the broker
 void storeMeasurement() {
-    Serial.printf("personID %d - %s: weight:%4.1fkg, fat:%4.1f%%, water:%4.1f%%, muscle:%4.1f%%\n", measurement.pID, measurement.time, measurement.weightKg, measurement.fatPercentage, measurement.waterPercentage,
+    LOG_INFO("personID %d - %s: weight:%4.1fkg, fat:%4.1f%%, water:%4.1f%%, muscle:%4.1f%%", measurement.pID, measurement.time, measurement.weightKg, measurement.fatPercentage, measurement.waterPercentage,
                   measurement.musclePercentage);
+
+    LogRecord record;
+    record.scaleTime = measurement.scaleTime;
+    record.weight = toTenths(measurement.weightKg);
+    record.fat = toTenths(measurement.fatPercentage);
+    record.water = toTenths(measurement.waterPercentage);
+    record.muscle = toTenths(measurement.musclePercentage);
+    record.userID = measurement.pID;
+    record.scale = measurement.scale;
+    measurementLog.append(record);
+}
+
+// a packed scale timestamp as "2025-12-26T18:38:30Z", the time of the measurement JSON
+void formatScaleTime(char *buffer, size_t size, uint32_t t) {
+    snprintf(buffer, size, "%04u-%02u-%02uT%02u:%02u:%02uZ", (unsigned)(2000 + (t >> 26)), (unsigned)((t >> 22) & 0x0F),
+             (unsigned)((t >> 17) & 0x1F), (unsigned)((t >> 12) & 0x1F), (unsigned)((t >> 6) & 0x3F), (unsigned)(t & 0x3F));
+}
+
+// the measurement a log record was stored from, for publishing
+void loadMeasurement(const LogRecord &record) {
+    formatScaleTime(measurement.time, sizeof(measurement.time), record.scaleTime);
+    measurement.scaleTime = record.scaleTime;
+    measurement.pID = record.userID;
+    measurement.scale = record.scale;
+    measurement.weightKg = record.weight / 10.0f;
+    measurement.fatPercentage = record.fat / 10.0f;
+    measurement.waterPercentage = record.water / 10.0f;
+    measurement.musclePercentage = record.muscle / 10.0f;
+}
+
+constexpr size_t MEASUREMENT_CBOR_MAX = 21; // array head, p_id, tagged time, four tenths of up to 3 bytes
+
+// a log record as the CBOR array [p_id, time, weight, fat, water, muscle]: time tagged as
+// seconds since 1970, weight in 0.1 kg and the percentages in 0.1 %, all integers
+void writeMeasurementCbor(CborWriter &cbor, const LogRecord &record) {
+    cbor.array(6);
+    cbor.uint(record.userID);
+    cbor.epochTime(scaleTimeToUnix(record.scaleTime));
+    cbor.uint(record.weight);
+    cbor.uint(record.fat);
+    cbor.uint(record.water);
+    cbor.uint(record.muscle);
 }
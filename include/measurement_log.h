@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+constexpr uint32_t MEASUREMENT_LOG_CAPACITY = 64; // records kept while the broker is unreachable
+constexpr size_t SLOT_KEY_SIZE = 12;               // "r" and a slot number of up to 10 digits, NVS allows 15 characters
+
+// One measurement as stored in flash, in the resolution it is published with.
+// No padding, a record is written as one NVS blob.
+struct LogRecord {
+    uint32_t seq = 0;       // position in the log, 0 is never used
+    uint32_t scaleTime = 0; // packed scale timestamp, see packScaleTime()
+    uint16_t weight = 0;    // 0.1 kg
+    uint16_t fat = 0;       // 0.1 %
+    uint16_t water = 0;     // 0.1 %
+    uint16_t muscle = 0;    // 0.1 %
+    uint8_t userID = 0;
+    uint8_t scale = 0;      // index into SCALES (config.h), 0 in records of the single-scale firmware
+    uint8_t reserved[2] = {};
+};
+
+static_assert(sizeof(LogRecord) == 20, "LogRecord is stored as is");
+
+// Append-only ring of measurements in NVS: a measurement is appended before it is
+// published and stays until the broker acknowledged it, so neither a network
+// outage nor a reboot loses it. Slot keys rotate with the sequence number and
+// NVS writes every update to the next free entry of its pages, so the flash wear
+// spreads over the whole partition. Only the acknowledged sequence number is
+// rewritten, once per published batch.
+class MeasurementLog {
+  public:
+    void begin() {
+        prefs_.begin("mlog", false);
+        acked_ = prefs_.getUInt("acked", 0);
+        next_ = acked_ + 1;
+        LogRecord record;
+        for (uint32_t slot = 0; slot < MEASUREMENT_LOG_CAPACITY; slot++) {
+            if (readSlot(slot, record) && record.seq >= next_) {
+                next_ = record.seq + 1;
+            }
+        }
+    }
+
+    uint32_t pendingCount() const {
+        return next_ - firstPendingSeq();
+    }
+
+    // older records were overwritten once the ring was full
+    uint32_t firstPendingSeq() const {
+        uint32_t first = acked_ + 1;
+        return next_ - first > MEASUREMENT_LOG_CAPACITY ? next_ - MEASUREMENT_LOG_CAPACITY : first;
+    }
+
+    // 0 while the log is empty
+    uint32_t newestSeq() const {
+        return next_ - 1;
+    }
+
+    uint32_t droppedCount() const {
+        return dropped_;
+    }
+
+    void append(LogRecord &record) {
+        if (pendingCount() == MEASUREMENT_LOG_CAPACITY) {
+            dropped_++; // the oldest unacknowledged record makes room
+        }
+        record.seq = next_++;
+        char key[SLOT_KEY_SIZE];
+        prefs_.putBytes(slotKey(record.seq % MEASUREMENT_LOG_CAPACITY, key), &record, sizeof(record));
+    }
+
+    // false when the slot no longer holds `seq` (overwritten, or lost with a corrupted NVS entry)
+    bool read(uint32_t seq, LogRecord &record) {
+        return readSlot(seq % MEASUREMENT_LOG_CAPACITY, record) && record.seq == seq;
+    }
+
+    // everything up to and including `seq` reached the broker
+    void ack(uint32_t seq) {
+        if (seq <= acked_ || seq >= next_) {
+            return;
+        }
+        acked_ = seq;
+        prefs_.putUInt("acked", acked_);
+    }
+
+  private:
+    static const char *slotKey(uint32_t slot, char *key) {
+        snprintf(key, SLOT_KEY_SIZE, "r%lu", (unsigned long)slot);
+        return key;
+    }
+
+    bool readSlot(uint32_t slot, LogRecord &record) {
+        char key[SLOT_KEY_SIZE];
+        return prefs_.getBytes(slotKey(slot, key), &record, sizeof(record)) == sizeof(record) && record.seq != 0;
+    }
+
+    Preferences prefs_;
+    uint32_t acked_ = 0;
+    uint32_t next_ = 1;
+    uint32_t dropped_ = 0;
+};
+
+MeasurementLog measurementLog;
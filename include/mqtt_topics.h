@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+
+// MQTT topics the module publishes, joined with the main topic at compile time
+// so a publish needs no String concatenation.
+
+enum class Topic : unsigned char {
+    BOOT_TIME,
+    BATTERY_LEVEL,
+    MEASUREMENT,
+    MEASUREMENT_BATCH,
+    MEASUREMENT_TIME,
+    MEASUREMENT_COUNT,
+    LOOP_COUNT,
+    WIFI_ON_TIME,
+    LATENCY_SAVED,
+    DEPARTURE_TIME,
+    BACK_TO_BACK,
+    STATS,
+    TREND,
+    COUNT
+};
+
+constexpr const char *TOPIC_NAMES[] = {
+    "bootTime",
+    "battery",
+    "measurement",
+    "measurementBatch",
+    "measurementTime",
+    "measurementCount",
+    "loopCount",
+    "wifiOnTime",
+    "latencySaved",
+    "departureTime",
+    "backToBackSessions",
+    "stats",
+    "trend",
+};
+
+static_assert(sizeof(TOPIC_NAMES) / sizeof(TOPIC_NAMES[0]) == size_t(Topic::COUNT), "one name per Topic");
+
+constexpr size_t TOPIC_MAX_LENGTH = 48; // including the terminator
+
+constexpr size_t constexprLength(const char *s) {
+    size_t length = 0;
+    while (s[length] != '\0') {
+        length++;
+    }
+    return length;
+}
+
+constexpr bool topicsFit(const char *prefix) {
+    for (const char *name : TOPIC_NAMES) {
+        if (constexprLength(prefix) + constexprLength(name) >= TOPIC_MAX_LENGTH) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct TopicTable {
+    char topics[size_t(Topic::COUNT)][TOPIC_MAX_LENGTH];
+
+    constexpr const char *operator[](Topic topic) const {
+        return topics[size_t(topic)];
+    }
+};
+
+constexpr TopicTable joinTopics(const char *prefix) {
+    TopicTable table{};
+    for (size_t i = 0; i < size_t(Topic::COUNT); i++) {
+        size_t length = 0;
+        for (const char *c = prefix; *c != '\0'; c++) {
+            table.topics[i][length++] = *c;
+        }
+        for (const char *c = TOPIC_NAMES[i]; *c != '\0'; c++) {
+            table.topics[i][length++] = *c;
+        }
+    }
+    return table;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+
+#include "latency_stats.h"
+#include "mqtt_topics.h"
+
+constexpr size_t QOS1_IN_FLIGHT_MAX = 32; // unacknowledged messages, bounds how far publishing runs ahead
+constexpr uint8_t MQTT_PUBLISH_QOS1 = 0x32;
+constexpr uint8_t MQTT_PUBACK = 0x40;
+
+// QoS 1 publishing next to PubSubClient, which publishes at QoS 0 only and drops the
+// PUBACKs it reads. The PUBLISH packets go out through PubSubClient::write() on the
+// same connection and poll() reads the PUBACKs from the socket, so mqttClient.loop()
+// must not run while messages are in flight. Any other packet, a PINGRESP above all, is
+// left to mqttClient.loop(): it keeps the keep-alive state, a PINGRESP read here would
+// leave its ping outstanding and time the connection out. Every message is tagged with
+// the oldest log record it carries, 0 for none.
+class Qos1Publisher {
+  public:
+    Qos1Publisher(PubSubClient &mqtt, WiFiClient &socket) : mqtt_(mqtt), socket_(socket) {}
+
+    // false if the window is full or the connection did not take the packet. A packet not taken
+    // whole leaves the stream out of step with the broker, so the connection is closed: the
+    // message goes out again after the reconnect, never on the same socket
+    bool publish(const char *topic, const uint8_t *payload, size_t length, bool retained, uint32_t seq) {
+        if (inFlight_ == QOS1_IN_FLIGHT_MAX) {
+            return false;
+        }
+        size_t topicLength = strlen(topic);
+        if (topicLength >= TOPIC_MAX_LENGTH) {
+            return false;
+        }
+        nextPacketId_ = nextPacketId_ == 0xFFFF ? 1 : nextPacketId_ + 1;
+
+        // fixed header, topic and packet id in one write, the payload in a second one
+        uint8_t head[5 + 2 + TOPIC_MAX_LENGTH + 2];
+        size_t headLength = 0;
+        head[headLength++] = MQTT_PUBLISH_QOS1 | (retained ? 1 : 0);
+        size_t remaining = 2 + topicLength + 2 + length;
+        do {
+            uint8_t digit = remaining & 0x7F;
+            remaining >>= 7;
+            head[headLength++] = digit | (remaining > 0 ? 0x80 : 0);
+        } while (remaining > 0);
+        head[headLength++] = topicLength >> 8;
+        head[headLength++] = topicLength;
+        memcpy(head + headLength, topic, topicLength);
+        headLength += topicLength;
+        head[headLength++] = nextPacketId_ >> 8;
+        head[headLength++] = nextPacketId_;
+
+        if (mqtt_.write(head, headLength) != headLength || mqtt_.write(payload, length) != length) {
+            socket_.stop(); // not a DISCONNECT, its bytes would complete the broken packet
+            return false;
+        }
+        messages_[inFlight_++] = {nextPacketId_, seq, millis()};
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained, uint32_t seq) {
+        return publish(topic, reinterpret_cast<const uint8_t *>(payload), strlen(payload), retained, seq);
+    }
+
+    // reads what the broker sent; a packet other than a PUBACK goes to mqttClient.loop(),
+    // which reads one packet per call
+    void poll() {
+        while (socket_.available() > 0) {
+            if (rxStep_ == RxStep::HEADER && socket_.peek() != MQTT_PUBACK) {
+                int available = socket_.available();
+                if (!mqtt_.loop() || socket_.available() >= available) {
+                    break; // the connection timed out, or loop() did not get to the packet
+                }
+                continue;
+            }
+            int byte = socket_.read();
+            if (byte < 0) {
+                break;
+            }
+            consume(byte);
+        }
+    }
+
+    size_t inFlight() const {
+        return inFlight_;
+    }
+
+    // every log record below this one has been acknowledged, 0 if none is in flight
+    uint32_t oldestSeqInFlight() const {
+        uint32_t oldest = 0;
+        for (size_t i = 0; i < inFlight_; i++) {
+            if (messages_[i].seq != 0 && (oldest == 0 || messages_[i].seq < oldest)) {
+                oldest = messages_[i].seq;
+            }
+        }
+        return oldest;
+    }
+
+    bool timedOut(unsigned long timeoutMs) const {
+        return inFlight_ > 0 && millis() - messages_[0].sentAt > timeoutMs;
+    }
+
+    // the connection is gone, so are the acknowledgements still to come
+    void clear() {
+        inFlight_ = 0;
+        rxStep_ = RxStep::HEADER;
+    }
+
+  private:
+    enum class RxStep : uint8_t { HEADER, LENGTH, BODY };
+
+    struct Message {
+        uint16_t packetId;
+        uint32_t seq;
+        unsigned long sentAt;
+    };
+
+    void consume(uint8_t byte) {
+        switch (rxStep_) {
+            case RxStep::HEADER:
+                rxHeader_ = byte;
+                rxRemaining_ = 0;
+                rxShift_ = 0;
+                rxStep_ = RxStep::LENGTH;
+                break;
+            case RxStep::LENGTH:
+                rxRemaining_ |= uint32_t(byte & 0x7F) << rxShift_;
+                rxShift_ += 7;
+                if (!(byte & 0x80)) {
+                    rxRead_ = 0;
+                    rxPacketId_ = 0;
+                    rxStep_ = rxRemaining_ > 0 ? RxStep::BODY : RxStep::HEADER;
+                }
+                break;
+            case RxStep::BODY:
+                if (rxRead_ < 2) {
+                    rxPacketId_ = (rxPacketId_ << 8) | byte;
+                }
+                if (++rxRead_ == rxRemaining_) {
+                    if (rxHeader_ == MQTT_PUBACK && rxRemaining_ == 2) {
+                        acknowledge(rxPacketId_);
+                    }
+                    rxStep_ = RxStep::HEADER;
+                }
+                break;
+        }
+    }
+
+    // kept in send order, so messages_[0] is always the oldest
+    void acknowledge(uint16_t packetId) {
+        for (size_t i = 0; i < inFlight_; i++) {
+            if (messages_[i].packetId == packetId) {
+                recordLatency(Operation::PUBLISH, millis() - messages_[i].sentAt);
+                for (size_t j = i + 1; j < inFlight_; j++) {
+                    messages_[j - 1] = messages_[j];
+                }
+                inFlight_--;
+                return;
+            }
+        }
+    }
+
+    PubSubClient &mqtt_;
+    WiFiClient &socket_;
+    Message messages_[QOS1_IN_FLIGHT_MAX];
+    size_t inFlight_ = 0;
+    uint16_t nextPacketId_ = 0;
+    RxStep rxStep_ = RxStep::HEADER;
+    uint8_t rxHeader_ = 0;
+    uint32_t rxRemaining_ = 0;
+    uint8_t rxShift_ = 0;
+    uint32_t rxRead_ = 0;
+    uint16_t rxPacketId_ = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+constexpr uint8_t SCAN_HOURS = 24;
+constexpr uint16_t SCAN_PLAN_MIN_SESSIONS = 14; // scan every hour as busy until this many sessions were counted
+constexpr uint16_t SCAN_PLAN_MAX_SESSIONS = 1024; // the counts are halved here, so changed habits take over
+
+// One scan window every interval: the controller listens for windowMs and the SoC can sleep
+// for the rest. An advert of the scale is missed with probability 1 - window / interval.
+struct ScanParams {
+    uint16_t windowMs;
+    uint16_t intervalMs;
+
+    bool operator==(const ScanParams &other) const {
+        return windowMs == other.windowMs && intervalMs == other.intervalMs;
+    }
+
+    bool operator!=(const ScanParams &other) const {
+        return !(*this == other);
+    }
+
+    // percent of the adverts of the scale that fall between two windows
+    uint8_t missPercent() const {
+        return intervalMs == 0 ? 100 : 100 - 100UL * windowMs / intervalMs;
+    }
+};
+
+// Duty cycle of the scan that waits for the scale, by hour of the day. The sessions of the
+// last weeks are counted per local hour in NVS; an hour that, with its two neighbours, saw
+// at least its share of them gets the busy (denser) scan, every other hour the quiet one.
+class ScanSchedule {
+  public:
+    void begin(ScanParams quiet, ScanParams busy) {
+        quiet_ = quiet;
+        busy_ = busy;
+        prefs_.begin("scanplan", false);
+        prefs_.getBytes("hours", sessions_, sizeof(sessions_));
+    }
+
+    // `hour` is the local hour a session started in, -1 without a synced clock
+    void recordSession(int hour) {
+        if (hour < 0 || hour >= SCAN_HOURS) {
+            return;
+        }
+        if (total() >= SCAN_PLAN_MAX_SESSIONS) {
+            for (uint16_t &count : sessions_) {
+                count /= 2;
+            }
+        }
+        sessions_[hour]++;
+        prefs_.putBytes("hours", sessions_, sizeof(sessions_));
+    }
+
+    bool busy(int hour) const {
+        if (hour < 0 || hour >= SCAN_HOURS) {
+            return true; // no clock, no plan
+        }
+        uint32_t sessions = total();
+        if (sessions < SCAN_PLAN_MIN_SESSIONS) {
+            return true;
+        }
+        uint32_t nearby = sessions_[(hour + SCAN_HOURS - 1) % SCAN_HOURS] + sessions_[hour] + sessions_[(hour + 1) % SCAN_HOURS];
+        return nearby * SCAN_HOURS >= sessions * 3;
+    }
+
+    ScanParams paramsAt(int hour) const {
+        return busy(hour) ? busy_ : quiet_;
+    }
+
+    // forgets the counted sessions
+    void clear() {
+        memset(sessions_, 0, sizeof(sessions_));
+        prefs_.putBytes("hours", sessions_, sizeof(sessions_));
+    }
+
+  private:
+    uint32_t total() const {
+        uint32_t sessions = 0;
+        for (uint16_t count : sessions_) {
+            sessions += count;
+        }
+        return sessions;
+    }
+
+    Preferences prefs_;
+    ScanParams quiet_ = {};
+    ScanParams busy_ = {};
+    uint16_t sessions_[SCAN_HOURS] = {};
+};
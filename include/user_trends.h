@@ -0,0 +1,146 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <math.h>
+
+#include "history_cursor.h"
+#include "measurement_helpers.h"
+
+constexpr float TREND_AVERAGE_DAYS = 7.0f; // time constant of the moving averages
+constexpr float TREND_SLOPE_DAYS = 14.0f;  // time constant of the weight slope
+constexpr uint8_t TREND_DAYS = 7;          // window of the weight min and max
+
+// Running statistics of one user, folded in one measurement at a time. The moving averages
+// weigh a measurement by the time since the previous one, so two weigh-ins on one morning
+// count about as much as one; the slope follows the weight average the same way (Holt's
+// linear smoothing for irregular intervals).
+struct UserTrend {
+    uint32_t scaleTime = 0; // packed, of the newest measurement folded in, 0 before the first
+    float weight = 0.0f;    // moving averages in kg and %, 0 until the scale reported one
+    float fat = 0.0f;
+    float water = 0.0f;
+    float muscle = 0.0f;
+    float slope = 0.0f;     // kg per day
+    uint16_t count = 0;     // measurements folded in, stops at 65535
+    uint16_t day = 0;       // days since 1970 of the newest measurement
+    uint16_t dayMin[TREND_DAYS] = {}; // weight in 0.1 kg per day of the window, slot day % TREND_DAYS, 0 for none
+    uint16_t dayMax[TREND_DAYS] = {};
+
+    // lightest and heaviest weight in 0.1 kg of the last TREND_DAYS days
+    uint16_t windowMin() const {
+        uint16_t lightest = 0;
+        for (uint16_t tenths : dayMin) {
+            lightest = tenths && (!lightest || tenths < lightest) ? tenths : lightest;
+        }
+        return lightest;
+    }
+
+    uint16_t windowMax() const {
+        uint16_t heaviest = 0;
+        for (uint16_t tenths : dayMax) {
+            heaviest = tenths > heaviest ? tenths : heaviest;
+        }
+        return heaviest;
+    }
+};
+
+static_assert(sizeof(UserTrend) == 56, "UserTrend is stored as is");
+
+// moves `average` towards `value`, a gap of `days` weighs the new value with 1 - e^(-days / tau)
+inline void foldAverage(float &average, float value, float days, float tau) {
+    if (value <= 0.0f) {
+        return; // not measured this time
+    }
+    average = average > 0.0f ? average + (1.0f - expf(-days / tau)) * (value - average) : value;
+}
+
+// The UserTrend of every user (1..8), in NVS with one entry per user, so an update costs a
+// constant time and one NVS write however long the history already is.
+class UserTrends {
+  public:
+    void begin(const char *name = "trends") {
+        prefs_.begin(name, false);
+        for (uint8_t i = 0; i < MAX_SCALE_USERS; i++) {
+            char key[4];
+            prefs_.getBytes(keyOf(key, i + 1), &trends_[i], sizeof(UserTrend));
+        }
+    }
+
+    // folds a measurement in; false and nothing changed for an unknown user or a measurement
+    // not newer than the last one folded in
+    bool fold(uint8_t userID, uint32_t scaleTime, float weightKg, float fatPercentage, float waterPercentage,
+              float musclePercentage) {
+        if (userID == 0 || userID > MAX_SCALE_USERS) {
+            return false;
+        }
+        UserTrend &trend = trends_[userID - 1];
+        if (scaleTime <= trend.scaleTime) {
+            return false;
+        }
+        uint32_t at = scaleTimeToUnix(scaleTime);
+        float days = trend.count ? (at - scaleTimeToUnix(trend.scaleTime)) / 86400.0f : 0.0f;
+
+        if (weightKg > 0.0f && trend.weight > 0.0f) {
+            float predicted = trend.weight + trend.slope * days;
+            float level = predicted + (1.0f - expf(-days / TREND_AVERAGE_DAYS)) * (weightKg - predicted);
+            if (days > 0.0f) {
+                float beta = 1.0f - expf(-days / TREND_SLOPE_DAYS);
+                trend.slope += beta * ((level - trend.weight) / days - trend.slope);
+            }
+            trend.weight = level;
+        } else {
+            foldAverage(trend.weight, weightKg, days, TREND_AVERAGE_DAYS);
+        }
+        foldAverage(trend.fat, fatPercentage, days, TREND_AVERAGE_DAYS);
+        foldAverage(trend.water, waterPercentage, days, TREND_AVERAGE_DAYS);
+        foldAverage(trend.muscle, musclePercentage, days, TREND_AVERAGE_DAYS);
+
+        // a day of the window that passed without a measurement drops out
+        uint16_t day = at / 86400;
+        for (uint32_t passed = trend.day + 1; trend.count && passed <= day && passed <= uint32_t(trend.day + TREND_DAYS); passed++) {
+            trend.dayMin[passed % TREND_DAYS] = 0;
+            trend.dayMax[passed % TREND_DAYS] = 0;
+        }
+        uint16_t tenths = toTenths(weightKg);
+        uint16_t &lightest = trend.dayMin[day % TREND_DAYS];
+        uint16_t &heaviest = trend.dayMax[day % TREND_DAYS];
+        if (tenths) {
+            lightest = !lightest || tenths < lightest ? tenths : lightest;
+            heaviest = tenths > heaviest ? tenths : heaviest;
+        }
+
+        trend.day = day;
+        trend.scaleTime = scaleTime;
+        trend.count += trend.count < UINT16_MAX ? 1 : 0;
+        char key[4];
+        prefs_.putBytes(keyOf(key, userID), &trend, sizeof(UserTrend));
+        return true;
+    }
+
+    // nullptr for an unknown user or one without a measurement yet
+    const UserTrend *of(uint8_t userID) const {
+        if (userID == 0 || userID > MAX_SCALE_USERS || trends_[userID - 1].count == 0) {
+            return nullptr;
+        }
+        return &trends_[userID - 1];
+    }
+
+    void clear() {
+        prefs_.clear();
+        for (UserTrend &trend : trends_) {
+            trend = UserTrend();
+        }
+    }
+
+  private:
+    static const char *keyOf(char *key, uint8_t userID) {
+        key[0] = 'u';
+        key[1] = '0' + userID;
+        key[2] = '\0';
+        return key;
+    }
+
+    Preferences prefs_;
+    UserTrend trends_[MAX_SCALE_USERS];
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+// Scan hot path: a crowded advertising environment (beacons, phones, TVs) fed
+// through the firmware's onResult(), next to the String-based filter it replaced.
+// Reports adverts per second and the heap traffic per million adverts.
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "heap_counter.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t ADVERT_RUN = 1000000;
+constexpr size_t ADVERT_POOL = 512; // distinct devices in range
+
+inline std::string randomMac(std::mt19937 &rng) {
+    char mac[18];
+    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", uniform(rng, 0, 255), uniform(rng, 0, 255),
+             uniform(rng, 0, 255), uniform(rng, 0, 255), uniform(rng, 0, 255), uniform(rng, 0, 255));
+    return mac;
+}
+
+inline void appendAd(std::vector<uint8_t> &payload, uint8_t type, const std::vector<uint8_t> &data) {
+    payload.push_back(uint8_t(data.size() + 1));
+    payload.push_back(type);
+    payload.insert(payload.end(), data.begin(), data.end());
+}
+
+inline std::vector<uint8_t> randomBytes(std::mt19937 &rng, size_t count) {
+    std::vector<uint8_t> bytes(count);
+    for (auto &b : bytes) {
+        b = uniform(rng, 0, 255);
+    }
+    return bytes;
+}
+
+// what a scan in an apartment block picks up; none of it is the scale
+inline std::vector<NimBLEAdvertisedDevice> crowdAdverts(std::mt19937 &rng, size_t count) {
+    static const char *NAMES[] = {"[TV] Samsung 7 Series", "LE-Bose QC35", "Galaxy Watch5 (4F2A)", "Mi Smart Band 6",
+                                  "JBL Flip 5", "Tile", "Apple Pencil", "ELK-BLEDOM", "Shape", "Shape200x"};
+    std::vector<NimBLEAdvertisedDevice> adverts;
+    for (size_t i = 0; i < count; i++) {
+        std::vector<uint8_t> payload;
+        appendAd(payload, 0x01, {0x06});
+        switch (uniform(rng, 0, 3)) {
+            case 0: { // iBeacon
+                std::vector<uint8_t> data = {0x4c, 0x00, 0x02, 0x15};
+                auto rest = randomBytes(rng, 21);
+                data.insert(data.end(), rest.begin(), rest.end());
+                appendAd(payload, 0xFF, data);
+                break;
+            }
+            case 1: { // Eddystone
+                appendAd(payload, AD_TYPE_UUID16_COMPLETE, {0xaa, 0xfe});
+                std::vector<uint8_t> data = {0xaa, 0xfe, 0x10};
+                auto rest = randomBytes(rng, 17);
+                data.insert(data.end(), rest.begin(), rest.end());
+                appendAd(payload, AD_TYPE_SERVICE_DATA16, data);
+                break;
+            }
+            case 2: { // phone, TV, headphones
+                appendAd(payload, AD_TYPE_UUID16_INCOMPLETE, {0x0f, 0x18, 0x9f, 0xfe, 0x0d, 0x18});
+                std::string name = NAMES[uniform(rng, 0, sizeof(NAMES) / sizeof(NAMES[0]) - 1)];
+                appendAd(payload, AD_TYPE_NAME_COMPLETE, std::vector<uint8_t>(name.begin(), name.end()));
+                break;
+            }
+            default: // vendor manufacturer data (Microsoft Swift Pair and the like)
+                appendAd(payload, 0xFF, randomBytes(rng, uniform(rng, 8, 26)));
+                break;
+        }
+        adverts.emplace_back(randomMac(rng), payload);
+    }
+    return adverts;
+}
+
+// the scan callback of the previous firmware, for comparison
+inline bool legacyScaleFilter(const NimBLEAdvertisedDevice *advertisedDevice) {
+    if (advertisedDevice->haveName()) {
+        String name = advertisedDevice->getName().c_str();
+        String mac = advertisedDevice->getAddress().toString().c_str();
+        return name.indexOf(SCALES[0].name) >= 0;
+    }
+    return false;
+}
+
+template <typename Filter>
+inline uint32_t runAdvertFilter(const char *label, const std::vector<NimBLEAdvertisedDevice> &adverts, Filter filter) {
+    uint64_t allocationsBefore = heap.allocations;
+    uint64_t bytesBefore = heap.bytes;
+    int64_t liveBefore = heap.live;
+    uint32_t matched = 0;
+
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < ADVERT_RUN; i++) {
+        matched += filter(&adverts[i % adverts.size()]) ? 1 : 0;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    double perMillion = 1e6 / ADVERT_RUN;
+    printf("%-22s %6.2f Madverts/s   %9.0f allocs %11.0f bytes %+6lld heap delta\n", label, ADVERT_RUN / seconds / 1e6,
+           (heap.allocations - allocationsBefore) * perMillion, (heap.bytes - bytesBefore) * perMillion,
+           (long long)((heap.live - liveBefore) * perMillion));
+    return matched;
+}
+
+inline int runAdvertFilterBench(const Options &options) {
+    std::mt19937 rng(options.seed);
+    std::vector<NimBLEAdvertisedDevice> adverts = crowdAdverts(rng, ADVERT_POOL);
+    int result = 0;
+
+    printf("== advert filter (%u adverts from %zu devices, per million adverts) ==\n", ADVERT_RUN, ADVERT_POOL);
+    ensureFirmwareStarted();
+    ScaleSession &session = scales[0];
+    session.gattCache.invalidate(); // an unknown scale, so every advert is checked for the name and the service
+    NimBLEScanCallbacks *callbacks = &scanCallbacks;
+    uint32_t matched = runAdvertFilter("onResult (raw bytes)", adverts, [callbacks, &session](const NimBLEAdvertisedDevice *device) {
+        callbacks->onResult(device);
+        return session.found.load();
+    });
+    matched += runAdvertFilter("String filter (old)", adverts, legacyScaleFilter);
+    if (matched) {
+        printf("FAIL: %u crowd adverts taken for the scale\n", matched);
+        result = 1;
+    }
+
+    // what has to match: name, advertised service, cached address; and a truncated payload must not
+    std::vector<uint8_t> byService;
+    appendAd(byService, 0x01, {0x06});
+    appendAd(byService, AD_TYPE_UUID16_COMPLETE, {0x0f, 0x18, 0x1b, 0x18});
+    std::vector<uint8_t> truncated = {0x02, 0x01, 0x06, 0x1e, 0x09, 'S', 'h', 'a', 'p', 'e', '1', '0', '0'};
+
+    GattHandles cached;
+    snprintf(cached.address, sizeof(cached.address), "%s", "c0:ff:ee:00:00:01");
+    cached.bodyComposition = 1;
+
+    // a session with a cached address only takes that scale, one without takes any
+    struct Case {
+        const char *name;
+        NimBLEAdvertisedDevice advert;
+        bool cache;
+        bool expected;
+    };
+    Case cases[] = {
+        {"name", NimBLEAdvertisedDevice("Shape100", randomMac(rng)), false, true},
+        {"service 0x181b", NimBLEAdvertisedDevice(randomMac(rng), byService), false, true},
+        {"truncated", NimBLEAdvertisedDevice(randomMac(rng), truncated), false, false},
+        {"cached address", NimBLEAdvertisedDevice("c0:ff:ee:00:00:01", adverts[0].getPayload()), true, true},
+        {"name, other scale cached", NimBLEAdvertisedDevice("Shape100", randomMac(rng)), true, false},
+    };
+    for (const auto &c : cases) {
+        if (c.cache) {
+            session.gattCache.store(cached);
+            session.lastSeenAt = millis();
+        }
+        if ((sessionForAdvert(&c.advert) == &session) != c.expected) {
+            printf("FAIL: %s advert %s\n", c.name, c.expected ? "not matched" : "matched");
+            result = 1;
+        }
+    }
+    session.gattCache.invalidate();
+    return result;
+}
+
+} // namespace bench
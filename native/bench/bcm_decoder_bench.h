@@ -0,0 +1,192 @@
+#pragma once
+
+// Body Composition Measurement decoder: replays captured payloads, checks every
+// flag combination against an encoder, and compares the throughput with the
+// packed-struct cast it replaced.
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+
+namespace bench {
+
+constexpr uint32_t DECODE_RUN = 2000000;
+
+struct CapturedFrame {
+    const char *name;
+    const char *hex;
+    BcmResult expected;
+    float weightKg; // after the last packet of the measurement
+};
+
+// the Shape100 frame from measurement_helpers.h, then synthesized ones for the
+// flags it never sets (mass resolution 3: 0.1 kg / 0.2 lb)
+const CapturedFrame CAPTURED_FRAMES[] = {
+    {"shape100", "1e050000e9070c1a12261e020000000000004b03", BcmResult::COMPLETE, 84.3f},
+    {"imperial", "0504c800039d03", BcmResult::COMPLETE, 185.0f * KG_PER_LB},
+    {"multi 1/2", "1e10e700e9070b03070f0001641b8701", BcmResult::PENDING, 0.0f},
+    {"multi 2/2", "0017e700a4010714c802", BcmResult::COMPLETE, 71.2f},
+    {"all fields", "fe0fbb00e907020e15053b048f199201380173022701c3016e140303f406", BcmResult::COMPLETE, 77.1f},
+    {"unsuccessful", "0600ffffe907030106000002", BcmResult::UNSUCCESSFUL, 0.0f},
+    {"truncated", "1e050000e9070101010101", BcmResult::TRUNCATED, 0.0f},
+};
+
+inline std::vector<uint8_t> fromHex(const char *hex) {
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoul(std::string(hex + i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+// the decoder of the previous firmware, for comparison
+#pragma pack(push, 1)
+struct LegacyBodyCompositionFrame {
+    uint16_t flags;
+    uint16_t fatPercentage;
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t userID;
+    uint16_t basalMetabolism;
+    uint16_t musclePercentage;
+    uint16_t waterMass;
+    uint16_t weight;
+};
+#pragma pack(pop)
+
+inline bool legacyDecode(const uint8_t *data, size_t length, BodyComposition &out) {
+    if (length < sizeof(LegacyBodyCompositionFrame)) {
+        return false;
+    }
+    const LegacyBodyCompositionFrame *frame = reinterpret_cast<const LegacyBodyCompositionFrame *>(data);
+    out.fatPercentage = frame->fatPercentage / 10.0f;
+    out.userID = frame->userID;
+    out.musclePercentage = frame->musclePercentage / 10.0f;
+    out.bodyWaterMassKg = frame->waterMass * 0.1f;
+    out.weightKg = frame->weight * 0.1f;
+    out.year = frame->year;
+    return true;
+}
+
+// raw value of every field, derived from its flag so each combination decodes to known numbers
+inline uint16_t rawFieldValue(uint16_t flag) {
+    return static_cast<uint16_t>(flag * 3 + 17);
+}
+
+inline std::vector<uint8_t> encodeBcm(uint16_t flags, uint16_t fat) {
+    std::vector<uint8_t> frame = {uint8_t(flags), uint8_t(flags >> 8), uint8_t(fat), uint8_t(fat >> 8)};
+    for (const auto &descriptor : BCM_FIELDS) {
+        if (!(flags & descriptor.flag)) {
+            continue;
+        }
+        uint16_t raw = rawFieldValue(descriptor.flag);
+        for (uint8_t i = 0; i < descriptor.size; i++) {
+            frame.push_back(i < 2 ? uint8_t(raw >> (8 * i)) : uint8_t(i));
+        }
+    }
+    return frame;
+}
+
+inline bool near(float value, float expected) {
+    return std::fabs(value - expected) <= 1e-3f * std::max(1.0f, std::fabs(expected));
+}
+
+// every flag combination, both unit systems: field values, frame length, truncation
+inline uint32_t checkAllFlagCombinations() {
+    BodyCompositionDecoder decoder(SCALE_MASS_RESOLUTION);
+    uint32_t failures = 0;
+    for (uint32_t flags = 0; flags < 0x1000; flags++) {
+        std::vector<uint8_t> frame = encodeBcm(flags, 250);
+        bool ok = frame.size() == bcmFrameLength(flags) && decoder.decode(frame.data(), frame.size()) == BcmResult::COMPLETE;
+        const BodyComposition &result = decoder.result();
+        bool imperial = flags & BCM_FLAG_IMPERIAL;
+        float mass = imperial ? BCM_MASS_RESOLUTION_LB[SCALE_MASS_RESOLUTION] * KG_PER_LB : BCM_MASS_RESOLUTION_KG[SCALE_MASS_RESOLUTION];
+        float height = imperial ? BCM_HEIGHT_RESOLUTION_INCH[0] * M_PER_INCH : BCM_HEIGHT_RESOLUTION_M[0];
+        auto expect = [&](uint16_t flag, float value, float scale) {
+            ok = ok && near(value, (flags & flag) ? rawFieldValue(flag) * scale : 0.0f);
+        };
+        ok = ok && near(result.fatPercentage, 25.0f);
+        ok = ok && result.year == ((flags & 0x0002) ? rawFieldValue(0x0002) : 0) && result.second == ((flags & 0x0002) ? 6 : 0);
+        ok = ok && result.userID == ((flags & 0x0004) ? uint8_t(rawFieldValue(0x0004)) : BCM_USER_UNKNOWN);
+        ok = ok && result.basalMetabolismKj == ((flags & 0x0008) ? rawFieldValue(0x0008) : 0);
+        expect(0x0010, result.musclePercentage, 0.1f);
+        expect(0x0020, result.muscleMassKg, mass);
+        expect(0x0040, result.fatFreeMassKg, mass);
+        expect(0x0080, result.softLeanMassKg, mass);
+        expect(0x0100, result.bodyWaterMassKg, mass);
+        expect(0x0200, result.impedanceOhm, 0.1f);
+        expect(0x0400, result.weightKg, mass);
+        expect(0x0800, result.heightM, height);
+        ok = ok && decoder.decode(frame.data(), frame.size() - 1) == BcmResult::TRUNCATED;
+        failures += ok ? 0 : 1;
+    }
+    return failures;
+}
+
+template <typename Decode>
+inline double runDecode(const char *label, const std::vector<std::vector<uint8_t>> &frames, Decode decode) {
+    volatile float sink = 0.0f;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < DECODE_RUN; i++) {
+        const auto &frame = frames[i % frames.size()];
+        sink = sink + decode(frame.data(), frame.size());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    printf("%-24s %7.2f Mframes/s %6.1f ns/frame\n", label, DECODE_RUN / seconds / 1e6, seconds * 1e9 / DECODE_RUN);
+    return seconds;
+}
+
+inline int runBcmDecoderBench(const Options &options) {
+    int result = 0;
+    printf("== body composition decoder (%u frames) ==\n", DECODE_RUN);
+
+    BodyCompositionDecoder decoder(SCALE_MASS_RESOLUTION);
+    std::vector<std::vector<uint8_t>> replay;
+    for (const auto &captured : CAPTURED_FRAMES) {
+        std::vector<uint8_t> frame = fromHex(captured.hex);
+        BcmResult decoded = decoder.decode(frame.data(), frame.size());
+        bool ok = decoded == captured.expected &&
+                  (decoded != BcmResult::COMPLETE || near(decoder.result().weightKg, captured.weightKg));
+        printf("%-24s %-4s %s\n", captured.name, ok ? "ok" : "FAIL", captured.hex);
+        result |= ok ? 0 : 1;
+        replay.push_back(frame);
+    }
+    // the two packets of a multiple packet measurement merge into one
+    decoder.decode(replay[2].data(), replay[2].size());
+    decoder.decode(replay[3].data(), replay[3].size());
+    const BodyComposition &merged = decoder.result();
+    bool mergedOk = merged.userID == 1 && merged.basalMetabolismKj == 7012 && near(merged.musclePercentage, 39.1f) &&
+                    near(merged.bodyWaterMassKg, 42.0f) && near(merged.impedanceOhm, 512.7f) && merged.month == 11;
+    printf("%-24s %-4s %s\n", "multi merged", mergedOk ? "ok" : "FAIL", "user, BMR, muscle + water, impedance, weight");
+    result |= mergedOk ? 0 : 1;
+
+    uint32_t failures = checkAllFlagCombinations();
+    printf("flag combinations        4096 checked, %u failed\n", failures);
+    result |= failures ? 1 : 0;
+
+    // throughput on the Shape100 layout, the only one the old cast could read
+    std::vector<std::vector<uint8_t>> shape100 = {replay[0]};
+    runDecode("flag-driven (shape100)", shape100, [&decoder](const uint8_t *data, size_t length) {
+        decoder.decode(data, length);
+        return decoder.result().weightKg;
+    });
+    BodyComposition legacy;
+    runDecode("packed struct (old)", shape100, [&legacy](const uint8_t *data, size_t length) {
+        legacyDecode(data, length, legacy);
+        return legacy.weightKg;
+    });
+    runDecode("flag-driven (captures)", replay, [&decoder](const uint8_t *data, size_t length) {
+        decoder.decode(data, length);
+        return decoder.result().weightKg;
+    });
+    return result;
+}
+
+} // namespace bench
@@ -0,0 +1,78 @@
+#pragma once
+
+// Shared helpers for the host-side benchmarks.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace bench {
+
+struct Options {
+    uint32_t sessions = 1000;
+    uint32_t seed = 1;
+    bool persistentConnection = false;
+    bool historySync = false;
+    uint32_t outagePercent = 0; // sessions with WiFi down
+    uint32_t backToBackPercent = 0; // sessions that start seconds after the scale powered down
+    uint32_t lossPercent = 0; // publishes lost on the way to the broker
+    uint32_t soakSessions = 100000;
+    const char *tracePath = nullptr; // serial capture with "TRACE" lines for the replay suite
+    uint32_t replaySpeed = 1;         // the replay runs this much faster than recorded
+};
+
+// nearest-rank percentile, `values` gets sorted in place
+inline double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(p / 100.0 * values.size() + 0.999999);
+    rank = std::min(std::max<size_t>(rank, 1), values.size());
+    return values[rank - 1];
+}
+
+inline double mean(const std::vector<double> &values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    for (double v : values) {
+        sum += v;
+    }
+    return sum / values.size();
+}
+
+inline uint32_t uniform(std::mt19937 &rng, uint32_t lo, uint32_t hi) {
+    return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+}
+
+// a Body Composition Measurement frame in the layout the Shape100 sends,
+// e.g. "1e050000e9070c1a12261e020000000000004b03"
+inline std::vector<uint8_t> bodyCompositionFrame(uint8_t userID, float weightKg, float fatPercentage, float musclePercentage,
+                                                 float waterKg, uint16_t year = 2025, uint8_t month = 1, uint8_t day = 6,
+                                                 uint8_t hour = 7, uint8_t minute = 30, uint8_t second = 0) {
+    auto u16 = [](std::vector<uint8_t> &out, uint16_t v) {
+        out.push_back(v & 0xFF);
+        out.push_back(v >> 8);
+    };
+    std::vector<uint8_t> frame;
+    u16(frame, 0x051e);
+    u16(frame, static_cast<uint16_t>(fatPercentage * 10.0f + 0.5f));
+    u16(frame, year);
+    frame.push_back(month);
+    frame.push_back(day);
+    frame.push_back(hour);
+    frame.push_back(minute);
+    frame.push_back(second);
+    frame.push_back(userID);
+    u16(frame, 0);
+    u16(frame, static_cast<uint16_t>(musclePercentage * 10.0f + 0.5f));
+    u16(frame, static_cast<uint16_t>(waterKg * 10.0f + 0.5f));
+    u16(frame, static_cast<uint16_t>(weightKg * 10.0f + 0.5f));
+    return frame;
+}
+
+} // namespace bench
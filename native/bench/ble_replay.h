@@ -0,0 +1,525 @@
+#pragma once
+
+// Replay of recorded BLE sessions: the "TRACE" lines of a serial capture with bleTrace set
+// (include/ble_trace.h) are cut into sessions per scale and played back through the fake
+// radio, at recorded or accelerated speed (--speed N). The adverts the recording heard reach
+// BLEScanCallbacks at their recorded times, the link comes up after the recorded connect time
+// for connectToScaleDevice() (a pending direct connect is answered by the step-on advert) and
+// the frames are indicated to indicateBodyComposition() at their recorded offsets from the
+// CCCD write. The GATT, WiFi, MQTT connect and PUBACK round trips are the ones the capture timed
+// (OPERATION records), the model's where it has none, and at 1x each session plays at its
+// recorded time of day, shifted by whole days, so the scan plan sees the same hours. Reports
+// step-on to subscribe and to publish, the measurements delivered and the heap drift, taken
+// after a reboot. At 1x the replayed timings must match the capture's within
+// REPLAY_TOLERANCE_MS; a capture to compare with starts from a fresh boot.
+//
+// With --trace FILE the capture is read from FILE, otherwise the bench records a few sessions
+// of the scale model first and replays them at 1x, accelerated and at 1x again: the two 1x
+// replays must give the same timings and the third must not grow the heap. The first replays
+// grow it by about 7 KB as the measurement log fills its NVS slots and the containers reach
+// their high-water marks, a steady state the device reaches in its first days.
+
+#include <cmath>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "bench_common.h"
+#include "heap_counter.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t REPLAY_RECORDED_SESSIONS = 30;
+constexpr uint32_t REPLAY_SPEEDUP = 10; // of the accelerated replay without --trace
+
+constexpr double REPLAY_TOLERANCE_MS = 5.0; // of a replayed step-on to subscribe or to publish: the driver's 1 ms tick and millis() roundings
+constexpr uint64_t REPLAY_DAY_US = 86400ULL * 1000000;
+
+struct ReplaySession {
+    uint8_t scale = 0;
+    uint64_t stepOnUs = 0; // recorded, the first advert or, after a direct connect, a connect time before the link
+    fake::ScaleScript script;
+    double recordedReadyMs = 0.0;   // step-on until SUBSCRIBED, 0 without one
+    double recordedPublishMs = 0.0; // step-on until the first QoS 1 publish went out, 0 without one
+    // round trips as the capture measured them, coexistence slowdown included; 0: none in it, the model's
+    uint32_t discoveryMs = 0;
+    uint32_t gattOpMs = 0;
+    uint32_t wifiAssociateMs = 0;
+    uint32_t mqttConnectMs = 0;
+    uint32_t brokerRttMs = 0;
+};
+
+struct ReplayResult {
+    std::vector<double> readyMs;
+    std::vector<double> publishMs;
+    size_t delivered = 0; // distinct measurements published
+    size_t compared = 0;  // replayed timings held against the recorded ones, at 1x only
+    size_t outside = 0;   // of those, the ones off by more than REPLAY_TOLERANCE_MS
+    double worstMs = 0.0; // the largest difference
+    int64_t heapDrift = 0;
+};
+
+inline bool hexByte(const char *hex, uint8_t &value) {
+    auto nibble = [](char c) { return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1; };
+    int high = nibble(hex[0]);
+    int low = high < 0 ? -1 : nibble(hex[1]);
+    if (low < 0) {
+        return false;
+    }
+    value = uint8_t(unsigned(high) << 4 | unsigned(low));
+    return true;
+}
+
+// the TRACE records of a serial capture in order, the log lines around them skipped
+inline std::vector<TraceRecord> parseTrace(std::istream &in) {
+    std::vector<TraceRecord> records;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t at = line.find("TRACE ");
+        if (at == std::string::npos) {
+            continue;
+        }
+        uint8_t bytes[TRACE_RECORD_SIZE];
+        size_t length = 0;
+        for (const char *hex = line.c_str() + at + 6; length < sizeof(bytes) && hexByte(hex, bytes[length]); hex += 2) {
+            length++;
+        }
+        TraceRecord record;
+        if (decodeTrace(bytes, length, record)) {
+            records.push_back(record);
+        }
+    }
+    return records;
+}
+
+// the measurement keys of the frames in `sessions`, what a replay has to publish
+inline std::set<std::pair<uint8_t, uint32_t>> recordedMeasurements(const std::vector<ReplaySession> &sessions) {
+    std::set<std::pair<uint8_t, uint32_t>> keys;
+    for (const ReplaySession &session : sessions) {
+        for (const auto &frame : session.script.frames) {
+            uint8_t userID;
+            uint32_t scaleTime;
+            if (frameKey(frame.second.data(), frame.second.size(), userID, scaleTime)) {
+                keys.insert({userID, scaleTime});
+            }
+        }
+    }
+    return keys;
+}
+
+// an OPERATION record into the timings of `session`, the first of each kind counts
+inline void recordOperation(const TraceRecord &record, ReplaySession &session) {
+    if (record.length < 5) {
+        return;
+    }
+    uint32_t ms = record.data[1] | record.data[2] << 8 | record.data[3] << 16 | uint32_t(record.data[4]) << 24;
+    uint32_t recorded = std::max<uint32_t>(ms, 1);
+    switch (Operation(record.data[0])) {
+        case Operation::DISCOVERY:
+            session.discoveryMs = session.discoveryMs ? session.discoveryMs : recorded;
+            break;
+        case Operation::TIME_WRITE:
+            session.gattOpMs = recorded; // one write, the battery read before it is not timed
+            break;
+        case Operation::SUBSCRIBE:
+            if (!session.gattOpMs && !session.discoveryMs) {
+                session.gattOpMs = recorded; // a single CCCD write by cached handle, no local time to write
+            }
+            break;
+        case Operation::WIFI_ASSOCIATE:
+            session.wifiAssociateMs = session.wifiAssociateMs ? session.wifiAssociateMs : recorded;
+            break;
+        case Operation::MQTT_CONNECT:
+            session.mqttConnectMs = session.mqttConnectMs ? session.mqttConnectMs : recorded;
+            break;
+        case Operation::PUBLISH:
+            session.brokerRttMs = session.brokerRttMs ? session.brokerRttMs : recorded;
+            break;
+        default:
+            break;
+    }
+}
+
+// Cuts the records into sessions per scale: an advert after a pause of the scale, or a link
+// without one before it (a direct connect, the controller answered the advert), starts one.
+// recordLatency() does not know the scale: a GATT operation goes to the session being set up,
+// a network one to the session that began last
+inline std::vector<ReplaySession> traceSessions(const std::vector<TraceRecord> &records) {
+    struct Scale {
+        bool open = false;
+        bool connected = false;
+        uint64_t lastUs = 0;
+        uint64_t connectStartUs = 0;
+        uint64_t subscribedUs = 0;
+        uint64_t linkUs = 0;
+        uint64_t cccdUs = 0; // the indications were enabled, SUBSCRIBED follows the rest of the setup
+        bool heardBeforeLink = false;
+        bool directConnect = false; // the session began with the link
+        ReplaySession session;
+    };
+    std::vector<ReplaySession> sessions;
+    std::map<uint8_t, Scale> scales;
+    Scale *settingUp = nullptr; // CONNECTED until SUBSCRIBED
+    Scale *latest = nullptr;
+    auto close = [&](Scale &s) {
+        if (!s.open) {
+            return;
+        }
+        s.session.script.awakeUs = s.lastUs - s.session.stepOnUs + uint64_t(fake::ScaleProfile().advertIntervalMs) * 1000;
+        s.session.script.modelAdverts = !s.heardBeforeLink;
+        s.session.script.directConnect = s.directConnect && !s.heardBeforeLink;
+        sessions.push_back(s.session);
+        s.open = false;
+    };
+
+    for (const TraceRecord &record : records) {
+        if (record.type == TraceType::OPERATION) {
+            Operation operation = Operation(record.length ? record.data[0] : 0);
+            bool gatt = operation == Operation::DISCOVERY || operation == Operation::TIME_WRITE ||
+                        operation == Operation::SUBSCRIBE;
+            Scale *owner = gatt ? settingUp : latest;
+            if (owner && owner->open) {
+                recordOperation(record, owner->session);
+                if (operation == Operation::SUBSCRIBE) {
+                    owner->cccdUs = record.atUs;
+                }
+            }
+            continue;
+        }
+        Scale &s = scales[record.scale];
+        bool resumes = record.type == TraceType::ADVERT || record.type == TraceType::CONNECTED;
+        if (resumes && !s.connected && (!s.open || record.atUs - s.lastUs > SCALE_WAKE_UP_GAP_MS * 1000ULL)) {
+            close(s);
+            uint64_t connectStartUs = s.connectStartUs; // a direct connect is started before the step-on
+            s = Scale();
+            s.connectStartUs = connectStartUs;
+            s.open = true;
+            s.session.scale = record.scale;
+            s.session.stepOnUs = record.atUs;
+            latest = &s;
+            if (record.type == TraceType::CONNECTED) {
+                // the model's connect time before it, the replay brings the link up at the recorded time
+                s.session.stepOnUs -= std::min<uint64_t>(record.atUs, uint64_t(fake::ScaleProfile().connectMs) * 1000);
+                s.directConnect = true;
+            }
+        }
+        if (!s.open) {
+            continue; // the end of a session that began before the capture
+        }
+        ReplaySession &session = s.session;
+        switch (record.type) {
+            case TraceType::ADVERT:
+                if (record.length >= 7 && session.script.address.empty()) {
+                    char mac[18];
+                    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", record.data[5], record.data[4], record.data[3],
+                             record.data[2], record.data[1], record.data[0]);
+                    session.script.address = mac;
+                    session.script.advert.assign(record.data + 7, record.data + record.length);
+                }
+                session.script.advertsUs.push_back(record.atUs - session.stepOnUs);
+                s.heardBeforeLink |= !s.connected && session.script.frames.empty() && s.subscribedUs == 0;
+                break;
+            case TraceType::CONNECT_START:
+                s.connectStartUs = record.atUs;
+                break;
+            case TraceType::CONNECTED:
+                s.connected = true;
+                s.linkUs = record.atUs;
+                settingUp = &s;
+                if (s.connectStartUs >= session.stepOnUs && s.connectStartUs <= record.atUs) {
+                    session.script.connectMs = std::max<uint32_t>((record.atUs - s.connectStartUs) / 1000, 1);
+                }
+                break;
+            case TraceType::SUBSCRIBED:
+                settingUp = settingUp == &s ? nullptr : settingUp;
+                s.subscribedUs = record.atUs;
+                session.recordedReadyMs = (record.atUs - session.stepOnUs) / 1000.0;
+                break;
+            case TraceType::INDICATION: {
+                uint64_t fromUs = s.cccdUs > s.linkUs ? s.cccdUs : s.subscribedUs;
+                session.script.frames.push_back({fromUs && record.atUs > fromUs ? record.atUs - fromUs : 0,
+                                                 std::vector<uint8_t>(record.data, record.data + record.length)});
+                break;
+            }
+            case TraceType::CONNECT_FAILED:
+            case TraceType::DISCONNECTED:
+                settingUp = settingUp == &s ? nullptr : settingUp;
+                s.connected = false;
+                break;
+            case TraceType::PUBLISHED:
+                if (session.recordedPublishMs == 0.0) {
+                    session.recordedPublishMs = (record.atUs - session.stepOnUs) / 1000.0;
+                }
+                break;
+            case TraceType::OPERATION:
+                break;
+        }
+        if (record.type != TraceType::CONNECT_START && record.type != TraceType::CONNECT_FAILED) {
+            s.lastUs = record.atUs; // the scale was heard, a pending direct connect is the firmware alone
+        }
+    }
+    for (auto &entry : scales) {
+        close(entry.second);
+    }
+    std::sort(sessions.begin(), sessions.end(),
+              [](const ReplaySession &a, const ReplaySession &b) { return a.stepOnUs < b.stepOnUs; });
+    return sessions;
+}
+
+inline bool replayQuiet() {
+    for (size_t i = 0; i < scaleCount; i++) {
+        if (scales[i].state != AppState::SCANNING || fake::scales[i].awake) {
+            return false;
+        }
+    }
+    return frameQueue.empty() && measurementLog.pendingCount() == 0 && currentPublishState == PublishState::IDLE;
+}
+
+// the same start for the recording and every replay: a reboot with model timings, no cached
+// scale, no frame seen before and no scan plan learned, then the clock set over WiFi
+inline void startReplayWorld(LoopStats &stats) {
+    fake::reset();
+    // the log task drains while the BLE task waits for a round trip, a trace record is not dropped
+    fake::whileBlocked = [] {
+        while (eventLog.drainOne()) {
+        }
+    };
+    ensureFirmwareStarted();
+    fake::scaleProfile = fake::ScaleProfile();
+    fake::network = fake::NetworkProfile();
+    fake::advertDelayState = 1;
+    persistentConnection = false;
+    historySync = false;
+    for (size_t i = 0; i < scaleCount; i++) {
+        scales[i].gattCache.invalidate();
+        scales[i].historyCursor.clear();
+        scales[i].lastSeenAt = 0;
+    }
+    scanSchedule.clear();
+    restart(stats);
+    idle(stats, 1000);
+    while (!replayQuiet()) {
+        runLoopOnce(stats, false);
+    }
+}
+
+// the round trips of `session` as recorded, the model's where the capture has none
+inline void applyRecordedTimings(const ReplaySession &session) {
+    const fake::ScaleProfile scaleModel;
+    const fake::NetworkProfile networkModel;
+    fake::scaleProfile.discoveryMs = session.discoveryMs ? session.discoveryMs : scaleModel.discoveryMs;
+    fake::scaleProfile.gattOpMs = session.gattOpMs ? session.gattOpMs : scaleModel.gattOpMs;
+    fake::network.wifiAssociateMs = session.wifiAssociateMs ? session.wifiAssociateMs : networkModel.wifiAssociateMs;
+    fake::network.mqttConnectMs = session.mqttConnectMs ? session.mqttConnectMs : networkModel.mqttConnectMs;
+    fake::network.brokerRttMs = session.brokerRttMs ? session.brokerRttMs : networkModel.brokerRttMs;
+}
+
+inline ReplayResult replaySessions(const std::vector<ReplaySession> &sessions, uint32_t speed) {
+    LoopStats stats;
+    ReplayResult result;
+    startReplayWorld(stats);
+    fake::network.coexBleSlowdown = 1.0f; // a recorded round trip was measured with it
+    result.readyMs.reserve(sessions.size());
+    result.publishMs.reserve(sessions.size());
+    int64_t liveBefore = heap.live.load(); // after a reboot, as the drift is taken
+
+    uint64_t stepOnUs[MAX_SCALES] = {};
+    const ReplaySession *playing[MAX_SCALES] = {};
+    bool ready[MAX_SCALES] = {};
+    bool published[MAX_SCALES] = {};
+    std::set<std::string> delivered;
+    auto compare = [&](double recordedMs, double replayedMs) {
+        if (recordedMs <= 0.0 || speed != 1) {
+            return;
+        }
+        double difference = std::fabs(replayedMs - recordedMs);
+        result.compared++;
+        result.outside += difference > REPLAY_TOLERANCE_MS;
+        result.worstMs = std::max(result.worstMs, difference);
+    };
+    fake::onPublish = [&](const fake::Publish &publish) {
+        for (size_t i = 0; i < scaleCount; i++) {
+            if (publish.topic != scales[i].topics[Topic::MEASUREMENT]) {
+                continue;
+            }
+            delivered.insert(publish.payload);
+            if (stepOnUs[i] && !published[i]) {
+                published[i] = true;
+                result.publishMs.push_back((publish.atUs - stepOnUs[i]) / 1000.0);
+                compare(playing[i]->recordedPublishMs, result.publishMs.back());
+            }
+        }
+    };
+    auto tick = [&] {
+        runLoopOnce(stats, false);
+        for (size_t i = 0; i < scaleCount; i++) {
+            AppState state = scales[i].state;
+            if (stepOnUs[i] && !ready[i] && (state == AppState::SYNC_HISTORY || state == AppState::WAIT_FOR_MEASUREMENT)) {
+                ready[i] = true;
+                result.readyMs.push_back((fake::nowUs - stepOnUs[i]) / 1000.0);
+                compare(playing[i]->recordedReadyMs, result.readyMs.back());
+            }
+        }
+    };
+
+    // at 1x every session starts at its recorded time, whole days later: the clock does not go
+    // back, and the scan plan sees the hours of the capture. --speed shortens the pauses between
+    // sessions only: within one the firmware's timeouts run at their own pace, so the scale keeps
+    // its recorded timing
+    uint64_t recordedMarkUs = sessions.empty() ? 0 : sessions.front().stepOnUs; // the end of the sessions so far
+    uint64_t playedMarkUs = recordedMarkUs;
+    if (playedMarkUs < fake::nowUs) {
+        playedMarkUs += (fake::nowUs - playedMarkUs + REPLAY_DAY_US - 1) / REPLAY_DAY_US * REPLAY_DAY_US;
+    }
+    for (const ReplaySession &session : sessions) {
+        if (session.scale >= scaleCount) {
+            continue; // more scales in the capture than SCALES lists
+        }
+        uint64_t atUs = session.stepOnUs >= recordedMarkUs
+                            ? playedMarkUs + (session.stepOnUs - recordedMarkUs) / speed
+                            : playedMarkUs - std::min(playedMarkUs, recordedMarkUs - session.stepOnUs);
+        if (session.stepOnUs + session.script.awakeUs > recordedMarkUs) {
+            recordedMarkUs = session.stepOnUs + session.script.awakeUs;
+            playedMarkUs = atUs + session.script.awakeUs;
+        }
+        while (fake::nowUs < atUs && !replayQuiet()) {
+            tick();
+        }
+        if (fake::nowUs < atUs) {
+            idle(stats, (atUs - fake::nowUs) / 1000);
+        }
+        stepOnUs[session.scale] = fake::nowUs;
+        ready[session.scale] = false;
+        published[session.scale] = false;
+        playing[session.scale] = &session;
+        applyRecordedTimings(session);
+        fake::playSession(session.script, session.scale);
+    }
+    uint64_t endUs = fake::nowUs + uint64_t(SESSION_TIMEOUT_MS) * 1000;
+    while (fake::nowUs < endUs && !replayQuiet()) {
+        tick();
+    }
+    fake::onPublish = nullptr;
+    fake::published.clear();
+    result.delivered = delivered.size();
+    delivered.clear();
+    startReplayWorld(stats);
+    fake::whileBlocked = nullptr;
+    result.heapDrift = heap.live.load() - liveBefore;
+    return result;
+}
+
+// REPLAY_RECORDED_SESSIONS sessions of the scale model with bleTrace set, the capture in `capture`
+inline void recordSessions(const Options &options, std::string &capture) {
+    std::mt19937 rng(options.seed);
+    LoopStats stats;
+
+    startReplayWorld(stats);
+    bleTrace = true;
+    fake::onSerial = [&capture](const char *text) { capture += text; };
+    for (uint32_t i = 0; i < REPLAY_RECORDED_SESSIONS; i++) {
+        randomizeProfiles(rng);
+        float weight = 55.0f + uniform(rng, 0, 400) / 10.0f;
+        fake::stepOn(bodyCompositionFrame(1, weight, 18.0f + uniform(rng, 0, 150) / 10.0f,
+                                          35.0f + uniform(rng, 0, 100) / 10.0f, weight * 0.55f));
+        uint64_t startedUs = fake::nowUs;
+        bool connected = false;
+        while (fake::nowUs - startedUs < uint64_t(SESSION_TIMEOUT_MS) * 1000) {
+            runLoopOnce(stats, false);
+            AppState state = scales[0].state;
+            if (state != AppState::SCANNING && state != AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) {
+                connected = true;
+            } else if (connected && state == AppState::SCANNING) {
+                break;
+            }
+        }
+        idle(stats, uniform(rng, 60000, 600000));
+    }
+    bleTrace = false;
+    fake::onSerial = nullptr;
+    fake::whileBlocked = nullptr;
+    fake::published.clear();
+}
+
+inline void printReplay(const char *name, size_t sessions, ReplayResult &result, size_t expected) {
+    printf("%-18s %8zu %10.0f ms %7.0f ms %7.0f ms %7.0f ms %6zu of %-4zu %+8lld\n", name, sessions,
+           percentile(result.readyMs, 50), percentile(result.readyMs, 99), percentile(result.publishMs, 50),
+           percentile(result.publishMs, 99), result.delivered, expected, (long long)result.heapDrift);
+}
+
+// replayed step-on to subscribe and to publish against the capture's, at 1x
+inline bool checkReplayTimings(const ReplayResult &result) {
+    bool within = result.compared > 0 && result.outside == 0;
+    printf("replayed timings     %s (%zu of %zu within %.0f ms of the capture, worst %.0f ms)\n", within ? "ok" : "FAIL",
+           result.compared - result.outside, result.compared, REPLAY_TOLERANCE_MS, result.worstMs);
+    return within;
+}
+
+inline int runBleReplay(const Options &options) {
+    std::string capture;
+    if (options.tracePath) {
+        std::ifstream file(options.tracePath);
+        if (!file) {
+            fprintf(stderr, "cannot read %s\n", options.tracePath);
+            return 1;
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        capture = text.str();
+    } else {
+        recordSessions(options, capture);
+    }
+    std::istringstream in(capture);
+    std::vector<TraceRecord> records = parseTrace(in);
+    std::vector<ReplaySession> sessions = traceSessions(records);
+    size_t expected = recordedMeasurements(sessions).size();
+
+    printf("== ble replay (%s, %zu records, %zu sessions) ==\n",
+           options.tracePath ? options.tracePath : "sessions of the scale model recorded first", records.size(), sessions.size());
+    printf("%-18s %8s %13s %10s %10s %10s %12s %8s\n", "", "sessions", "ready p50", "ready p99", "publish p50", "p99",
+           "delivered", "heap");
+    ReplayResult recorded;
+    for (const ReplaySession &session : sessions) {
+        if (session.recordedReadyMs > 0.0) {
+            recorded.readyMs.push_back(session.recordedReadyMs);
+        }
+        if (session.recordedPublishMs > 0.0) {
+            recorded.publishMs.push_back(session.recordedPublishMs);
+        }
+    }
+    recorded.delivered = expected;
+    printReplay("recorded", sessions.size(), recorded, expected);
+
+    bool passed = !sessions.empty();
+    if (options.tracePath) {
+        char name[32];
+        snprintf(name, sizeof(name), "replay %ux", options.replaySpeed);
+        ReplayResult result = replaySessions(sessions, std::max<uint32_t>(options.replaySpeed, 1));
+        printReplay(name, sessions.size(), result, expected);
+        passed &= result.delivered == expected && (options.replaySpeed > 1 || checkReplayTimings(result));
+    } else {
+        ReplayResult first = replaySessions(sessions, 1);
+        printReplay("replay 1x", sessions.size(), first, expected);
+        char name[32];
+        snprintf(name, sizeof(name), "replay %ux", REPLAY_SPEEDUP);
+        ReplayResult accelerated = replaySessions(sessions, REPLAY_SPEEDUP);
+        printReplay(name, sessions.size(), accelerated, expected);
+        ReplayResult second = replaySessions(sessions, 1);
+        printReplay("replay 1x again", sessions.size(), second, expected);
+        bool repeatable = first.readyMs == second.readyMs && first.publishMs == second.publishMs;
+        printf("repeatable replay    %s\n", repeatable ? "ok" : "FAIL (two replays of one capture differ)");
+        bool timings = checkReplayTimings(first); // the second is the same when repeatable
+        // the first replays fill the measurement log's NVS slots and take the containers to their
+        // high-water marks; once there, a replay must leave the heap as the reboot before it did
+        bool steady = second.heapDrift == 0;
+        printf("replay heap          %s (%+lld bytes over the third replay, the first two fill the log's NVS slots)\n",
+               steady ? "ok" : "FAIL", (long long)second.heapDrift);
+        passed &= repeatable && timings && steady && first.delivered == expected && accelerated.delivered == expected &&
+                  sessions.size() == REPLAY_RECORDED_SESSIONS;
+    }
+    printf("replay               %s (every recorded measurement published again)\n", passed ? "ok" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+} // namespace bench
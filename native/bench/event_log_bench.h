@@ -0,0 +1,170 @@
+#pragma once
+
+// Deferred logging against Serial.printf() in the caller: the same sessions with the UART
+// modeled at 115200 baud and a 256 byte transmit FIFO, once with every line written by the
+// task that logs it (eventLog.synchronous, what the firmware did before) and once through the
+// log task. Reports how long the firmware's callbacks held the NimBLE host task (host time, the
+// virtual clock does not see them), the time the BLE and publish tasks spent in their passes,
+// step-on to subscribe and how long the callers, the log task aside, waited for the UART, in
+// total and for the BLE and the publish task, then the cost of a single log call on the host.
+//
+// The gain is that wait. At the default level the BLE task's lines never fill the FIFO, it is
+// the publish task's around the measurement round, about 1.5 ms per session. The busy times of
+// the two runs differ by more than it, the second run starts from the scan plan and the caches
+// the first one left, so they are not compared.
+
+#include <chrono>
+
+#include "bench_common.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t LOGGING_SESSIONS = 200;
+constexpr uint32_t LOGGING_BAUD = 115200;
+constexpr uint32_t LOGGING_WRITES = 200000;
+
+struct LoggingResult {
+    std::vector<double> readyMs; // step-on until the session is subscribed to the measurement
+    uint32_t delivered = 0;
+    uint32_t hostCallbacks = 0;
+    double hostCallbackMeanNs = 0.0;
+    double hostCallbackLongestUs = 0.0;
+    double bleBusyMs = 0.0; // per session
+    double publishBusyMs = 0.0;
+    double blockedMs = 0.0; // waiting for the UART, per session, every task but the log task
+    double bleBlockedMs = 0.0; // the shares of the BLE and the publish task
+    double publishBlockedMs = 0.0;
+    uint32_t dropped = 0;
+};
+
+inline LoggingResult runLogging(bool synchronous, const Options &options) {
+    std::mt19937 rng(options.seed);
+    LoopStats stats;
+    LoggingResult result;
+
+    fake::reset();
+    ensureFirmwareStarted();
+    forgetMeasurements();
+    persistentConnection = false;
+    historySync = false;
+    fake::serialBaud = LOGGING_BAUD;
+    eventLog.synchronous = synchronous;
+    idle(stats, 1000);
+
+    bool published = false;
+    fake::onPublish = [&](const fake::Publish &publish) {
+        published |= publish.topic == scales[0].topics[Topic::MEASUREMENT];
+    };
+    fake::hostCallbacks = 0;
+    fake::hostCallbackTotalNs = 0;
+    fake::hostCallbackLongestNs = 0;
+    fake::serialBlockedUs = 0;
+    uint64_t logBlockedBefore = taskHandles[size_t(TaskId::LOG)]->serialBlockedUs;
+    uint64_t bleBlockedBefore = taskHandles[size_t(TaskId::BLE)]->serialBlockedUs;
+    uint64_t publishBlockedBefore = taskHandles[size_t(TaskId::PUBLISH)]->serialBlockedUs;
+    uint32_t droppedBefore = eventLog.dropped();
+    uint64_t bleBusyBefore = taskBusyUs[size_t(TaskId::BLE)];
+    uint64_t publishBusyBefore = taskBusyUs[size_t(TaskId::PUBLISH)];
+
+    for (uint32_t i = 0; i < LOGGING_SESSIONS; i++) {
+        randomizeProfiles(rng);
+        float weight = 55.0f + uniform(rng, 0, 400) / 10.0f;
+        fake::stepOn(bodyCompositionFrame(1, weight, 18.0f + uniform(rng, 0, 150) / 10.0f,
+                                          35.0f + uniform(rng, 0, 100) / 10.0f, weight * 0.55f));
+        uint64_t stepOnUs = fake::nowUs;
+        published = false;
+        bool ready = false;
+        bool connected = false;
+        while (fake::nowUs - stepOnUs < uint64_t(SESSION_TIMEOUT_MS) * 1000) {
+            runLoopOnce(stats, false);
+            AppState state = scales[0].state;
+            if (!ready && (state == AppState::SYNC_HISTORY || state == AppState::WAIT_FOR_MEASUREMENT)) {
+                ready = true;
+                result.readyMs.push_back((fake::nowUs - stepOnUs) / 1000.0);
+            }
+            if (state != AppState::SCANNING && state != AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) {
+                connected = true;
+            } else if (connected && state == AppState::SCANNING) {
+                break;
+            }
+        }
+        result.delivered += published ? 1 : 0;
+        fake::published.clear();
+        idle(stats, uniform(rng, 60000, 600000));
+    }
+
+    result.hostCallbacks = fake::hostCallbacks;
+    result.hostCallbackMeanNs = fake::hostCallbacks ? double(fake::hostCallbackTotalNs) / fake::hostCallbacks : 0.0;
+    result.hostCallbackLongestUs = fake::hostCallbackLongestNs / 1000.0;
+    result.bleBusyMs = (taskBusyUs[size_t(TaskId::BLE)] - bleBusyBefore) / 1000.0 / LOGGING_SESSIONS;
+    result.publishBusyMs = (taskBusyUs[size_t(TaskId::PUBLISH)] - publishBusyBefore) / 1000.0 / LOGGING_SESSIONS;
+    uint64_t logBlockedUs = taskHandles[size_t(TaskId::LOG)]->serialBlockedUs - logBlockedBefore;
+    result.blockedMs = (fake::serialBlockedUs - logBlockedUs) / 1000.0 / LOGGING_SESSIONS;
+    result.bleBlockedMs = (taskHandles[size_t(TaskId::BLE)]->serialBlockedUs - bleBlockedBefore) / 1000.0 / LOGGING_SESSIONS;
+    result.publishBlockedMs =
+        (taskHandles[size_t(TaskId::PUBLISH)]->serialBlockedUs - publishBlockedBefore) / 1000.0 / LOGGING_SESSIONS;
+    result.dropped = eventLog.dropped() - droppedBefore;
+
+    fake::onPublish = nullptr;
+    fake::serialBaud = 0;
+    eventLog.synchronous = false;
+    while (eventLog.drainOne()) {
+    }
+    return result;
+}
+
+// host ns per log call of the longest line the firmware logs, deferred or formatted in place
+inline double logCallNs(bool synchronous) {
+    eventLog.synchronous = synchronous;
+    double seconds = 0.0;
+    for (uint32_t i = 0; i < LOGGING_WRITES; i += LOG_RING_CAPACITY) {
+        auto started = std::chrono::steady_clock::now();
+        for (uint32_t j = 0; j < LOG_RING_CAPACITY; j++) {
+            LOG_INFO("personID %d - %s: weight:%4.1fkg, fat:%4.1f%%, water:%4.1f%%, muscle:%4.1f%%", 1,
+                     "2025-01-06T07:00:09Z", 64.4 + j, 23.9, 55.0, 35.9);
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        while (eventLog.drainOne()) {
+        }
+    }
+    eventLog.synchronous = false;
+    return seconds * 1e9 / LOGGING_WRITES;
+}
+
+inline void printLogging(const char *name, LoggingResult &result) {
+    printf("%-22s %6.0f ns %7.1f us %8.1f ms %8.1f ms %7.0f ms %7.0f ms %9.2f ms %6.2f ms %6.2f ms %4u\n", name,
+           result.hostCallbackMeanNs, result.hostCallbackLongestUs, result.bleBusyMs, result.publishBusyMs, percentile(result.readyMs, 50),
+           percentile(result.readyMs, 99), result.blockedMs, result.bleBlockedMs, result.publishBlockedMs, result.dropped);
+}
+
+inline int runEventLogBench(const Options &options) {
+    printf("== deferred logging (%u sessions, Serial at %u baud with a %zu byte FIFO, seed %u) ==\n", LOGGING_SESSIONS,
+           LOGGING_BAUD, fake::serialBufferBytes, options.seed);
+    printf("%zu bytes per event, %zu events per task, %zu bytes of rings\n", sizeof(LogEvent), LOG_RING_CAPACITY,
+           sizeof(LogRing) * LOG_PRODUCERS);
+    printf("%-22s %9s %10s %11s %11s %10s %10s %12s %9s %9s %4s\n", "", "host cb", "host max", "ble/sess", "pub/sess",
+           "ready p50", "ready p99", "uart wait", "ble", "publish", "lost");
+
+    LoggingResult before = runLogging(true, options);
+    printLogging("in the caller (before)", before);
+    LoggingResult after = runLogging(false, options);
+    printLogging("log task", after);
+
+    double synchronousNs = logCallNs(true);
+    double deferredNs = logCallNs(false);
+    printf("log call             %.0f ns deferred, %.0f ns formatted in place (UART not counted)\n", deferredNs,
+           synchronousNs);
+
+    // host times are too noisy to gate on; the virtual clock shows the callers' wait for the UART,
+    // which the caller mode must have for the log task to take it away
+    bool passed = after.delivered == LOGGING_SESSIONS && before.delivered == LOGGING_SESSIONS && after.dropped == 0 &&
+                  before.blockedMs > 0.0 && after.blockedMs == 0.0;
+    printf("deferred logging     %s (%u host callbacks, no event lost, the callers %.2f ms per session less waiting for the "
+           "UART, %.2f ms of it in the BLE task)\n",
+           passed ? "ok" : "FAIL", after.hostCallbacks, before.blockedMs - after.blockedMs,
+           before.bleBlockedMs - after.bleBlockedMs);
+    return passed ? 0 : 1;
+}
+
+} // namespace bench
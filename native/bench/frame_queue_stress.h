@@ -0,0 +1,159 @@
+#pragma once
+
+// Stress test of the indication FrameQueue: a real producer thread against a
+// consumer thread, then bursts through indicateBodyComposition() and the tasks, and the
+// history cursor across a reset of the scale's clock.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "bench_common.h"
+#include "session_latency.h"
+
+namespace bench {
+
+// payload derived from the sequence number so the consumer can check every byte
+inline uint8_t framePattern(uint32_t seq, size_t i) {
+    return static_cast<uint8_t>(seq * 31 + i * 7);
+}
+
+inline int runThreadedFrameQueue(uint32_t frames) {
+    static FrameQueue<FRAME_QUEUE_CAPACITY> queue;
+    std::atomic<bool> done{false};
+    uint32_t fullRetries = 0;
+
+    auto started = std::chrono::steady_clock::now();
+    std::thread producer([&] {
+        uint8_t data[FRAME_MAX_LENGTH];
+        for (uint32_t seq = 0; seq < frames; seq++) {
+            size_t length = 4 + seq % (FRAME_MAX_LENGTH - 3);
+            memcpy(data, &seq, sizeof(seq));
+            for (size_t i = sizeof(seq); i < length; i++) {
+                data[i] = framePattern(seq, i);
+            }
+            while (!queue.push(data, length, seq)) {
+                fullRetries++;
+                std::this_thread::yield();
+            }
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    uint32_t expected = 0;
+    uint32_t corrupt = 0;
+    RawFrame frame;
+    while (expected < frames) {
+        if (!queue.pop(frame)) {
+            if (done.load(std::memory_order_acquire) && queue.empty()) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        uint32_t seq;
+        memcpy(&seq, frame.data, sizeof(seq));
+        bool ok = seq == expected && frame.receivedAt == seq && frame.length == 4 + seq % (FRAME_MAX_LENGTH - 3);
+        for (size_t i = sizeof(seq); ok && i < frame.length; i++) {
+            ok = frame.data[i] == framePattern(seq, i);
+        }
+        corrupt += ok ? 0 : 1;
+        expected = seq + 1;
+    }
+    producer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    printf("threaded SPSC        %u frames, %.1f Mframes/s, %u corrupt, %u missing, %u full retries\n", frames,
+           frames / seconds / 1e6, corrupt, frames - expected, fullRetries);
+    return corrupt || expected != frames ? 1 : 0;
+}
+
+// bursts of indications delivered faster than the publish task runs; every accepted frame must be logged and published
+inline int runFrameBursts(uint32_t frames, uint32_t burst) {
+    LoopStats stats;
+    uint32_t publishedFrames = 0;
+
+    fake::reset();
+    ensureFirmwareStarted();
+    ScaleSession &session = scales[0];
+    fake::onPublish = [&publishedFrames, &session](const fake::Publish &publish) {
+        if (publish.topic == session.topics[Topic::MEASUREMENT]) {
+            publishedFrames++;
+        }
+    };
+    uint32_t droppedBefore = frameQueue.droppedCount();
+    uint32_t pushedBefore = frameQueue.pushedCount();
+
+    // unknown user (255), so the history cursor lets every copy through
+    std::vector<uint8_t> frame = bodyCompositionFrame(255, 80.0f, 20.0f, 40.0f, 44.0f);
+    for (uint32_t sent = 0; sent < frames; sent += burst) {
+        for (uint32_t i = 0; i < burst && sent + i < frames; i++) {
+            queueFrame(session, frame.data(), frame.size());
+        }
+        while (!frameQueue.empty() || measurementLog.pendingCount() > 0) {
+            runLoopOnce(stats, false);
+        }
+        fake::published.clear();
+    }
+    fake::onPublish = nullptr;
+
+    uint32_t accepted = frameQueue.pushedCount() - pushedBefore;
+    uint32_t dropped = frameQueue.droppedCount() - droppedBefore;
+    printf("bursts of %-3u        %u frames, %u accepted, %u dropped, %u published\n", burst, frames, accepted, dropped,
+           publishedFrames);
+    return publishedFrames == accepted && accepted + dropped == frames ? 0 : 1;
+}
+
+// the scale's clock reset after a battery swap: its frames date from 2000 and far below the
+// mark of the user, they are new until they repeat, and so is the next weigh-in after them
+inline int runClockStepBack() {
+    LoopStats stats;
+    uint32_t publishedFrames = 0;
+
+    fake::reset();
+    ensureFirmwareStarted();
+    forgetMeasurements();
+    ScaleSession &session = scales[0];
+    fake::onPublish = [&publishedFrames, &session](const fake::Publish &publish) {
+        if (publish.topic == session.topics[Topic::MEASUREMENT]) {
+            publishedFrames++;
+        }
+    };
+    uint32_t dedupBefore = dedupHits.load();
+    uint32_t skippedBefore = historySkippedCount;
+
+    const std::vector<uint8_t> frames[] = {
+        bodyCompositionFrame(1, 80.0f, 20.0f, 40.0f, 44.0f, 2025, 6, 1, 7, 30),
+        bodyCompositionFrame(1, 80.0f, 20.0f, 40.0f, 44.0f, 2025, 6, 1, 7, 30), // repeat
+        bodyCompositionFrame(1, 80.2f, 20.0f, 40.0f, 44.0f, 2000, 1, 1, 0, 5),  // clock reset
+        bodyCompositionFrame(1, 80.2f, 20.0f, 40.0f, 44.0f, 2000, 1, 1, 0, 5),  // repeat
+        bodyCompositionFrame(1, 80.4f, 20.0f, 40.0f, 44.0f, 2000, 1, 2, 7, 30),
+    };
+    for (const auto &frame : frames) {
+        queueFrame(session, frame.data(), frame.size());
+        while (!frameQueue.empty() || measurementLog.pendingCount() > 0) {
+            runLoopOnce(stats, false);
+        }
+    }
+    fake::onPublish = nullptr;
+    fake::published.clear();
+
+    uint32_t repeats = dedupHits.load() - dedupBefore + historySkippedCount - skippedBefore;
+    bool passed = publishedFrames == 3 && repeats == 2;
+    printf("clock step back      %-4s %u of 3 weigh-ins published, %u of 2 repeats dropped\n", passed ? "ok" : "FAIL",
+           publishedFrames, repeats);
+    forgetMeasurements();
+    return passed ? 0 : 1;
+}
+
+inline int runFrameQueueStress(const Options &options) {
+    printf("== frame queue stress (capacity %u) ==\n", unsigned(FRAME_QUEUE_CAPACITY));
+    int result = runThreadedFrameQueue(200000);
+    result |= runFrameBursts(5000, FRAME_QUEUE_CAPACITY / 2);
+    result |= runFrameBursts(5000, FRAME_QUEUE_CAPACITY);
+    result |= runFrameBursts(5000, FRAME_QUEUE_CAPACITY * 2);
+    result |= runClockStepBack();
+    return result;
+}
+
+} // namespace bench
@@ -0,0 +1,64 @@
+#pragma once
+
+// Counts the heap traffic of the bench program by replacing the global
+// operator new/delete. Only included by bench_main.cpp, the single translation unit.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace bench {
+
+struct HeapCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0}; // usable bytes currently allocated
+};
+
+inline HeapCounters heap;
+
+inline void *countedAlloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    heap.allocations.fetch_add(1, std::memory_order_relaxed);
+    heap.bytes.fetch_add(size, std::memory_order_relaxed);
+    heap.live.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+    return p;
+}
+
+inline void countedFree(void *p) {
+    if (p) {
+        heap.live.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+        free(p);
+    }
+}
+
+} // namespace bench
+
+void *operator new(size_t size) {
+    return bench::countedAlloc(size);
+}
+
+void *operator new[](size_t size) {
+    return bench::countedAlloc(size);
+}
+
+void operator delete(void *p) noexcept {
+    bench::countedFree(p);
+}
+
+void operator delete[](void *p) noexcept {
+    bench::countedFree(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    bench::countedFree(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    bench::countedFree(p);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+// Offline measurement log: what a record costs in NVS, how fast a full backlog
+// drains through the publish pipeline once the broker is back, that records
+// survive a reboot and what the ring drops when it overflows. Ends with a flash
+// wear estimate from the measured NVS entries.
+
+#include <chrono>
+
+#include "bench_common.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t NVS_PAGES = 5;                 // default 0x5000 byte nvs partition
+constexpr uint32_t FLASH_ERASE_CYCLES = 100000;   // rated endurance of the SPI flash
+constexpr uint32_t MEASUREMENTS_PER_DAY = 10;     // a busy household
+
+inline void clearMeasurementLog() {
+    fake::nvs.erase("mlog");
+    measurementLog = MeasurementLog();
+    measurementLog.begin();
+    qos1.clear();
+    publishedThrough = 0;
+}
+
+// publishes the whole log on an open connection and waits for the PUBACKs
+inline void publishWholeLog() {
+    while (publishLogBatch() || qos1.inFlight() > 0) {
+        if (!pollPublishAcks()) {
+            break;
+        }
+        if (qos1.inFlight() > 0 && fake::recordPublishes) {
+            fake::advanceMs(1);
+        }
+    }
+    pollPublishAcks();
+}
+
+// what logNextFrame() does with a decoded frame
+inline void logMeasurement(uint32_t i) {
+    measurement.pID = 1;
+    measurement.weightKg = 70.0f + (i % 100) / 10.0f;
+    measurement.fatPercentage = 20.0f;
+    measurement.waterPercentage = 55.0f;
+    measurement.musclePercentage = 40.0f;
+    measurement.scaleTime = packScaleTime(2024, 12, 1 + i / 1440 % 28, i / 60 % 24, i % 60, 0);
+    recordMeasurement(scales[0]);
+}
+
+inline int runMeasurementLogBench(const Options &options) {
+    LoopStats stats;
+    int result = 0;
+    fake::reset();
+    fake::network.brokerAvailable = false;
+    clearMeasurementLog();
+    printf("== measurement log (capacity %u, batches of %u) ==\n", MEASUREMENT_LOG_CAPACITY, LOG_REPLAY_BATCH);
+
+    // write cost, broker down so nothing gets acknowledged
+    uint64_t entriesBefore = fake::nvsEntries;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < MEASUREMENT_LOG_CAPACITY; i++) {
+        logMeasurement(i);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double entriesPerRecord = double(fake::nvsEntries - entriesBefore) / MEASUREMENT_LOG_CAPACITY;
+    printf("record write         %zu bytes, %.1f NVS entries with the history cursor and user trend, %.0f ns host time\n",
+           sizeof(LogRecord), entriesPerRecord, seconds * 1e9 / MEASUREMENT_LOG_CAPACITY);
+
+    // a full backlog drains once the broker is back
+    uint32_t publishedMeasurements = 0;
+    fake::onPublish = [&publishedMeasurements](const fake::Publish &publish) {
+        if (publish.topic == TOPICS[Topic::MEASUREMENT]) {
+            publishedMeasurements++;
+        }
+    };
+    fake::network.brokerAvailable = true;
+    logRetryAt = millis();
+    wakeTask(TaskId::PUBLISH); // the retry time changed behind the task's back
+    entriesBefore = fake::nvsEntries;
+    uint64_t replayStartUs = fake::nowUs;
+    uint64_t publishingAtUs = 0;
+    while (measurementLog.pendingCount() > 0 && fake::nowUs - replayStartUs < 600000000ULL) {
+        runLoopOnce(stats, false);
+        if (!publishingAtUs && currentPublishState == PublishState::PUBLISHING) {
+            publishingAtUs = fake::nowUs;
+        }
+    }
+    double ackEntriesPerRecord = double(fake::nvsEntries - entriesBefore) / MEASUREMENT_LOG_CAPACITY;
+    double drainMs = publishingAtUs ? (fake::nowUs - publishingAtUs) / 1000.0 : 0.0;
+    printf("replay               %u of %u published, %.1f ms after connecting (%.0f records/s), %.1f ack entries/record\n",
+           publishedMeasurements, MEASUREMENT_LOG_CAPACITY, drainMs, drainMs > 0 ? MEASUREMENT_LOG_CAPACITY / drainMs * 1000.0 : 0.0,
+           ackEntriesPerRecord);
+    printf("longest task pass    %.1f ms\n", stats.longestPassUs / 1000.0);
+    result |= publishedMeasurements == MEASUREMENT_LOG_CAPACITY && measurementLog.pendingCount() == 0 ? 0 : 1;
+    while (currentPublishState != PublishState::IDLE) {
+        runLoopOnce(stats, false);
+    }
+    fake::onPublish = nullptr;
+
+    // a reboot keeps what was not acknowledged
+    fake::network.brokerAvailable = false;
+    for (uint32_t i = 0; i < 10; i++) {
+        logMeasurement(MEASUREMENT_LOG_CAPACITY + i);
+    }
+    measurementLog = MeasurementLog();
+    measurementLog.begin();
+    bool survived = measurementLog.pendingCount() == 10;
+    printf("reboot               %u of 10 pending records kept\n", measurementLog.pendingCount());
+    result |= survived ? 0 : 1;
+
+    // an outage longer than the ring drops the oldest records
+    clearMeasurementLog();
+    for (uint32_t i = 0; i < MEASUREMENT_LOG_CAPACITY + 10; i++) {
+        logMeasurement(i);
+    }
+    LogRecord oldest;
+    bool kept = measurementLog.read(measurementLog.firstPendingSeq(), oldest) && oldest.seq == 11;
+    printf("overflow             %u appended, %u pending, %u dropped, oldest kept is #%u\n", MEASUREMENT_LOG_CAPACITY + 10,
+           measurementLog.pendingCount(), measurementLog.droppedCount(), oldest.seq);
+    result |= kept && measurementLog.droppedCount() == 10 ? 0 : 1;
+    clearMeasurementLog();
+    fake::network.brokerAvailable = true;
+
+    // NVS writes every update to the next free entry and erases a page once it is
+    // garbage collected, so the erases spread over all pages of the partition
+    double entriesPerMeasurement = entriesPerRecord + ackEntriesPerRecord;
+    double erasesPerYear = entriesPerMeasurement * MEASUREMENTS_PER_DAY * 365 / (fake::NVS_ENTRIES_PER_PAGE * NVS_PAGES);
+    printf("flash wear           %.1f entries/measurement, %u measurements/day: %.1f erases/page/year, %.0f years to %u cycles\n",
+           entriesPerMeasurement, MEASUREMENTS_PER_DAY, erasesPerYear, FLASH_ERASE_CYCLES / erasesPerYear, FLASH_ERASE_CYCLES);
+    return result;
+}
+
+} // namespace bench
@@ -0,0 +1,190 @@
+#pragma once
+
+// Several scales at once: 1..MAX_SCALES identical scales, each stepped on within a few
+// seconds of the others so their sessions overlap, served by one radio and one BLE task.
+// Reports step-on-to-publish latency per scale count, the links held at once, the longest
+// task pass and whether every weigh-in reached the topic of one and the same session. A
+// second sweep staggers the step-ons and slows the connects, so sessions connect while
+// others watch their scale power down; the scan is off during a connect, and no watch may
+// take that for the scale being gone.
+
+#include <cstring>
+
+#include "bench_common.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t MULTI_SCALE_ROUNDS = 50;
+constexpr uint32_t MULTI_SCALE_SPREAD_MS = 5000; // step-ons of one round fall within this
+constexpr uint32_t MULTI_SCALE_STAGGER_MS = 40000; // of the staggered sweep, the later step-ons meet presence watches
+constexpr uint32_t MULTI_SCALE_SLOW_CONNECT_MS = 3500; // of the staggered sweep, longer than SCALE_ABSENT_MS
+
+struct MultiScaleResult {
+    std::vector<double> latenciesMs;
+    uint32_t delivered = 0;
+    uint32_t weighIns = 0;
+    uint32_t misrouted = 0; // a scale whose weigh-ins showed up on the topic of another session
+    uint32_t falseDepartures = 0; // a presence watch that ended with the scale still awake, before its timeout
+    size_t peakConnections = 0;
+    uint64_t longestPassUs = 0;
+};
+
+inline ScaleConfig multiScaleConfigs[MAX_SCALES];
+inline char multiScaleTopics[MAX_SCALES][16];
+
+// the weight of a measurement JSON, 0 without one
+inline float publishedWeight(const std::string &payload) {
+    const char *weight = strstr(payload.c_str(), "\"weight\":");
+    return weight ? strtof(weight + 9, nullptr) : 0.0f;
+}
+
+inline bool allScalesDone() {
+    for (size_t i = 0; i < scaleCount; i++) {
+        if (scales[i].state != AppState::SCANNING || fake::scales[i].awake) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline MultiScaleResult runMultiScale(size_t count, std::mt19937 &rng, uint32_t spreadMs, uint32_t connectMs) {
+    MultiScaleResult result;
+    LoopStats stats;
+
+    for (size_t i = 0; i < count; i++) {
+        snprintf(multiScaleTopics[i], sizeof(multiScaleTopics[i]), "scale%u/", unsigned(i + 1));
+        multiScaleConfigs[i] = {SCALES[0].name, "", multiScaleTopics[i]};
+    }
+    beginScales(multiScaleConfigs, count);
+    forgetMeasurements(); // each step of the sweep starts from cursors no earlier suite moved
+    createScaleClients();
+    wakeTask(TaskId::BLE);
+    idle(stats, 1000);
+    fake::peakConnections = 0;
+
+    float weights[MAX_SCALES] = {};
+    uint64_t stepOnUs[MAX_SCALES] = {};
+    bool delivered[MAX_SCALES] = {};
+    int sessionOf[MAX_SCALES]; // the session whose topic carried the weigh-ins of a scale
+    std::fill(std::begin(sessionOf), std::end(sessionOf), -1);
+    fake::onPublish = [&](const fake::Publish &publish) {
+        for (size_t k = 0; k < count; k++) {
+            if (publish.topic != scales[k].topics[Topic::MEASUREMENT]) {
+                continue;
+            }
+            float weight = publishedWeight(publish.payload);
+            for (size_t j = 0; j < count; j++) {
+                if (delivered[j] || std::abs(weight - weights[j]) > 0.05f) {
+                    continue;
+                }
+                delivered[j] = true;
+                result.latenciesMs.push_back((publish.atUs - stepOnUs[j]) / 1000.0);
+                if (sessionOf[j] >= 0 && sessionOf[j] != int(k)) {
+                    result.misrouted++;
+                }
+                sessionOf[j] = k;
+            }
+        }
+    };
+
+    for (uint32_t round = 0; round < MULTI_SCALE_ROUNDS; round++) {
+        randomizeProfiles(rng);
+        if (connectMs) {
+            fake::scaleProfile.connectMs = connectMs;
+        }
+        for (size_t i = 0; i < count; i++) {
+            weights[i] = 50.0f + 10.0f * i + uniform(rng, 0, 90) / 10.0f; // tells the scales apart in the payload
+            stepOnUs[i] = fake::nowUs + uint64_t(uniform(rng, 0, spreadMs)) * 1000;
+            delivered[i] = false;
+        }
+        bool steppedOn[MAX_SCALES] = {};
+        uint64_t watchedFromUs[MAX_SCALES] = {};
+        uint64_t startedUs = fake::nowUs;
+        while (fake::nowUs - startedUs < uint64_t(SESSION_TIMEOUT_MS) * 1000) {
+            bool pending = false;
+            for (size_t i = 0; i < count; i++) {
+                if (!steppedOn[i] && fake::nowUs >= stepOnUs[i]) {
+                    steppedOn[i] = true;
+                    stepOnUs[i] = fake::nowUs;
+                    fake::stepOn(bodyCompositionFrame(1, weights[i], 18.0f + uniform(rng, 0, 150) / 10.0f,
+                                                      35.0f + uniform(rng, 0, 100) / 10.0f, weights[i] * 0.55f),
+                                 i);
+                }
+                pending |= !steppedOn[i];
+            }
+            AppState before[MAX_SCALES];
+            for (size_t i = 0; i < count; i++) {
+                before[i] = scales[i].state;
+            }
+            runLoopOnce(stats, false);
+            for (size_t i = 0; i < count; i++) {
+                AppState state = scales[i].state;
+                if (state == AppState::WAIT_FOR_SCALE_TO_DISAPPEAR && before[i] != state) {
+                    watchedFromUs[i] = fake::nowUs;
+                } else if (before[i] == AppState::WAIT_FOR_SCALE_TO_DISAPPEAR && state == AppState::SCANNING &&
+                           fake::scales[i].awake && fake::nowUs - watchedFromUs[i] < uint64_t(BT_DISCONNECT_DELAY_MS) * 1000) {
+                    result.falseDepartures++; // each scale is stepped on once a round, it cannot have woken up again
+                }
+            }
+            if (!pending && allScalesDone() && std::all_of(delivered, delivered + count, [](bool d) { return d; })) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            result.weighIns++;
+            result.delivered += delivered[i] ? 1 : 0;
+        }
+        fake::published.clear();
+        idle(stats, uniform(rng, 60000, 600000));
+    }
+    fake::onPublish = nullptr;
+    result.peakConnections = fake::peakConnections;
+    result.longestPassUs = stats.longestPassUs;
+    return result;
+}
+
+inline int runMultiScaleBench(const Options &options) {
+    std::mt19937 rng(options.seed);
+    printf("== multiple scales (%u rounds of overlapping weigh-ins within %u ms, seed %u) ==\n", MULTI_SCALE_ROUNDS,
+           MULTI_SCALE_SPREAD_MS, options.seed);
+    printf("CONFIG_BT_NIMBLE_MAX_CONNECTIONS %u, %zu bytes of session state per scale\n", unsigned(MAX_SCALES),
+           sizeof(ScaleSession));
+    printf("%-7s %10s %10s %12s %8s %10s %10s %12s\n", "scales", "p50", "p99", "delivered", "links", "misrouted", "false gone",
+           "longest pass");
+
+    fake::reset();
+    ensureFirmwareStarted();
+    persistentConnection = false;
+    historySync = false;
+    bool passed = true;
+    auto sweep = [&](size_t from, uint32_t spreadMs, uint32_t connectMs) {
+        for (size_t count = from; count <= MAX_SCALES; count++) {
+            MultiScaleResult result = runMultiScale(count, rng, spreadMs, connectMs);
+            printf("%-7zu %7.0f ms %7.0f ms %6u of %-3u %8zu %10u %10u %9.1f ms\n", count, percentile(result.latenciesMs, 50),
+                   percentile(result.latenciesMs, 99), result.delivered, result.weighIns, result.peakConnections,
+                   result.misrouted, result.falseDepartures, result.longestPassUs / 1000.0);
+            passed &= result.delivered == result.weighIns && result.misrouted == 0 && result.falseDepartures == 0 &&
+                      result.peakConnections == count;
+        }
+    };
+    sweep(1, MULTI_SCALE_SPREAD_MS, 0);
+    printf("staggered within %u ms, %u ms connects\n", MULTI_SCALE_STAGGER_MS, MULTI_SCALE_SLOW_CONNECT_MS);
+    sweep(2, MULTI_SCALE_STAGGER_MS, MULTI_SCALE_SLOW_CONNECT_MS);
+
+    // back to the configured scales for the suites that follow
+    for (size_t i = SCALE_COUNT; i < scaleCount; i++) {
+        ScaleSession &session = scales[i];
+        session.state = AppState::SCANNING;
+        cleanupBleSession(session);
+        NimBLEDevice::deleteClient(session.client);
+        session.client = nullptr;
+    }
+    beginScales(SCALES, SCALE_COUNT);
+    wakeTask(TaskId::BLE);
+    printf("overlapping sessions %s (every weigh-in delivered on its own scale's topic, no scale taken for gone while awake)\n",
+           passed ? "ok" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+} // namespace bench
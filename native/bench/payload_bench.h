@@ -0,0 +1,264 @@
+#pragma once
+
+// Measurement payloads: bytes and encode time per record of the JSON on
+// smartscale/measurement against the CBOR record of smartscale/measurementBatch,
+// then a full log backlog drained with and without binaryBatches, counted in
+// MQTT messages and bytes on the wire, and once more in batches with the
+// connection lost before the PUBACKs and with a packet written only in part; both
+// must publish every record again after the reconnect. Last, a publish on a
+// persistent connection with the keep-alive ping still out, which must not cost a
+// reconnect.
+
+#include <chrono>
+
+#include "bench_common.h"
+#include "measurement_log_bench.h"
+
+namespace bench {
+
+constexpr uint32_t PAYLOAD_ENCODES = 200000;
+
+// 2025-12-26T18:38:30Z, user 2, 84.3 kg, 18.3 % fat, 55.0 % water, 41.0 % muscle
+const uint8_t EXPECTED_CBOR[] = {0x86, 0x02, 0xc1, 0x1a, 0x69, 0x4e, 0xd6, 0x26, 0x19, 0x03,
+                                 0x4b, 0x18, 0xb7, 0x19, 0x02, 0x26, 0x19, 0x01, 0x9a};
+
+// MQTT PUBLISH on the wire: fixed header, topic length, topic and payload
+inline size_t wireBytes(const fake::Publish &publish) {
+    size_t remaining = 2 + publish.topic.size() + publish.payload.size();
+    return 1 + (remaining < 128 ? 1 : 2) + remaining;
+}
+
+struct DrainTotals {
+    uint32_t messages = 0;
+    size_t bytes = 0;
+};
+
+// a full log, stored while the broker was away
+inline void fillBacklog() {
+    fake::reset();
+    fake::network.brokerAvailable = false;
+    clearMeasurementLog();
+    for (uint32_t i = 0; i < MEASUREMENT_LOG_CAPACITY; i++) {
+        logMeasurement(i);
+    }
+}
+
+inline DrainTotals drainBacklog(bool batches) {
+    LoopStats stats;
+    fillBacklog();
+    binaryBatches = batches;
+    fake::network.brokerAvailable = true;
+    logRetryAt = millis();
+    wakeTask(TaskId::PUBLISH); // the retry time changed behind the task's back
+    fake::published.clear();
+    while (measurementLog.pendingCount() > 0 || currentPublishState != PublishState::IDLE) {
+        runLoopOnce(stats, false);
+    }
+    binaryBatches = false;
+
+    DrainTotals totals;
+    for (const auto &publish : fake::published) {
+        totals.messages++;
+        totals.bytes += wireBytes(publish);
+    }
+    return totals;
+}
+
+// records in a batch message, from the header of its CBOR array
+inline uint32_t batchRecords(const fake::Publish &publish) {
+    uint8_t header = publish.payload[0];
+    return header < 0x98 ? header & 0x1F : uint8_t(publish.payload[1]);
+}
+
+// a full backlog in batches, with the connection lost while the first batches wait for their
+// PUBACKs: nothing was acknowledged, so every record has to go out again after the reconnect
+inline uint32_t drainBacklogWithDrop() {
+    LoopStats stats;
+    fillBacklog();
+    binaryBatches = true;
+    fake::network.brokerAvailable = true;
+    fake::network.brokerRttMs = 200;
+    bool dropScheduled = false;
+    bool dropped = false;
+    uint32_t republished = 0;
+    fake::onPublish = [&](const fake::Publish &publish) {
+        if (publish.topic != scales[0].topics[Topic::MEASUREMENT_BATCH]) {
+            return;
+        }
+        if (dropped) {
+            republished += batchRecords(publish);
+        } else if (!dropScheduled) {
+            dropScheduled = true;
+            fake::afterMs(fake::network.brokerRttMs / 2, [&dropped] {
+                dropped = true;
+                WiFi.disconnect();
+            });
+        }
+    };
+    logRetryAt = millis();
+    wakeTask(TaskId::PUBLISH);
+    while (measurementLog.pendingCount() > 0 || currentPublishState != PublishState::IDLE) {
+        runLoopOnce(stats, false);
+    }
+    fake::onPublish = nullptr;
+    fake::network.brokerRttMs = fake::NetworkProfile().brokerRttMs;
+    fake::published.clear();
+    binaryBatches = false;
+    return republished;
+}
+
+// a full backlog in batches, the payload of the first one not taken after its header: the
+// half packet must not be followed by another on the same connection. Counts the records the
+// broker got, 0 if it read a packet with a foreign topic
+inline uint32_t drainBacklogWithShortWrite() {
+    LoopStats stats;
+    fillBacklog();
+    binaryBatches = true;
+    fake::network.brokerAvailable = true;
+    fake::failWrite = 2; // the first batch's header goes out, its payload does not
+    logRetryAt = millis();
+    wakeTask(TaskId::PUBLISH);
+    fake::published.clear();
+    while (measurementLog.pendingCount() > 0 || currentPublishState != PublishState::IDLE) {
+        runLoopOnce(stats, false);
+    }
+    binaryBatches = false;
+    fake::failWrite = 0;
+
+    uint32_t records = 0;
+    for (const auto &publish : fake::published) {
+        if (publish.topic.rfind(MAIN_TOPIC, 0) != 0) {
+            return 0;
+        }
+        records += publish.topic == scales[0].topics[Topic::MEASUREMENT_BATCH] ? batchRecords(publish) : 0;
+    }
+    fake::published.clear();
+    return records;
+}
+
+// persistent connection: a measurement published while the keep-alive ping is out, so the
+// PINGRESP arrives among the PUBACKs. PubSubClient has to read it all the same, or its next
+// loop() times the connection out. Returns the reconnects over two keep-alive periods
+inline uint32_t publishWithPingOutstanding() {
+    LoopStats stats;
+    fake::reset();
+    clearMeasurementLog();
+    persistentConnection = true;
+    fake::network.brokerAvailable = true;
+    fake::network.brokerRttMs = 200;
+    wakeTask(TaskId::PUBLISH); // the idle task connects now
+    uint64_t until = fake::nowUs + uint64_t(MQTT_KEEPALIVE_S * 2) * 1000000;
+    while (fake::nowUs < until && !mqttClient.connected()) {
+        runLoopOnce(stats, false);
+    }
+    uint32_t pings = fake::pingRequests;
+    while (fake::nowUs < until && fake::pingRequests == pings) {
+        runLoopOnce(stats, false);
+    }
+    uint32_t connects = fake::mqttConnects;
+    logMeasurement(0);
+    wakeTask(TaskId::PUBLISH);
+    until = fake::nowUs + uint64_t(MQTT_KEEPALIVE_S * 2) * 1000000;
+    while (fake::nowUs < until) {
+        runLoopOnce(stats, false);
+    }
+    uint32_t reconnects = fake::pingRequests == pings || measurementLog.pendingCount() > 0 ? UINT32_MAX
+                                                                                            : fake::mqttConnects - connects;
+    persistentConnection = false;
+    disconnectFromMqtt();
+    disconnectFromWifi();
+    fake::network.brokerRttMs = fake::NetworkProfile().brokerRttMs;
+    fake::published.clear();
+    return reconnects;
+}
+
+inline int runPayloadBench(const Options &options) {
+    int result = 0;
+    printf("== measurement payloads ==\n");
+
+    LogRecord record;
+    record.userID = 2;
+    record.scaleTime = packScaleTime(2025, 12, 26, 18, 38, 30);
+    record.weight = 843;
+    record.fat = 183;
+    record.water = 550;
+    record.muscle = 410;
+    uint8_t cborRecord[MEASUREMENT_CBOR_MAX];
+    CborWriter check(cborRecord, sizeof(cborRecord));
+    writeMeasurementCbor(check, record);
+    bool encoded = check.length() == sizeof(EXPECTED_CBOR) && memcmp(cborRecord, EXPECTED_CBOR, sizeof(EXPECTED_CBOR)) == 0;
+    printf("cbor record          %-4s %zu bytes\n", encoded ? "ok" : "FAIL", check.length());
+    result |= encoded ? 0 : 1;
+
+    // the largest record fits MEASUREMENT_CBOR_MAX
+    LogRecord largest;
+    largest.userID = 0xFF;
+    largest.scaleTime = packScaleTime(2063, 12, 31, 23, 59, 59);
+    largest.weight = largest.fat = largest.water = largest.muscle = 0xFFFF;
+    CborWriter bound(cborRecord, sizeof(cborRecord));
+    writeMeasurementCbor(bound, largest);
+    printf("largest record       %-4s %zu of %zu bytes\n", bound.overflowed() ? "FAIL" : "ok", bound.length(), MEASUREMENT_CBOR_MAX);
+    result |= bound.overflowed() ? 1 : 0;
+
+    // encode cost per record over a spread of values; the JSON needs loadMeasurement() first
+    LogRecord records[MEASUREMENT_LOG_CAPACITY];
+    for (uint32_t i = 0; i < MEASUREMENT_LOG_CAPACITY; i++) {
+        records[i] = record;
+        records[i].userID = 1 + i % 8;
+        records[i].scaleTime = packScaleTime(2025, 1 + i % 12, 1 + i % 28, i % 24, i % 60, i % 60);
+        records[i].weight = 450 + i * 13;
+        records[i].fat = 100 + i * 3;
+    }
+    char json[MEASUREMENT_JSON_SIZE];
+    size_t jsonBytes = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < PAYLOAD_ENCODES; i++) {
+        loadMeasurement(records[i % MEASUREMENT_LOG_CAPACITY]);
+        writeMeasurementJson(json, sizeof(json));
+        jsonBytes += strlen(json);
+    }
+    double jsonNs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() * 1e9 / PAYLOAD_ENCODES;
+
+    size_t cborBytes = 0;
+    started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < PAYLOAD_ENCODES; i++) {
+        CborWriter cbor(cborRecord, sizeof(cborRecord));
+        writeMeasurementCbor(cbor, records[i % MEASUREMENT_LOG_CAPACITY]);
+        cborBytes += cbor.length();
+    }
+    double cborNs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() * 1e9 / PAYLOAD_ENCODES;
+    printf("json                 %5.1f bytes/record  %6.1f ns/record\n", double(jsonBytes) / PAYLOAD_ENCODES, jsonNs);
+    printf("cbor                 %5.1f bytes/record  %6.1f ns/record\n", double(cborBytes) / PAYLOAD_ENCODES, cborNs);
+
+    // a full backlog once the broker is back
+    DrainTotals single = drainBacklog(false);
+    DrainTotals batched = drainBacklog(true);
+    printf("backlog of %u, json  %4u messages %6zu bytes on the wire\n", MEASUREMENT_LOG_CAPACITY, single.messages, single.bytes);
+    printf("backlog of %u, cbor  %4u messages %6zu bytes on the wire (batches of %u)\n", MEASUREMENT_LOG_CAPACITY, batched.messages,
+           batched.bytes, LOG_REPLAY_BATCH);
+    result |= batched.messages > 0 && batched.messages < single.messages ? 0 : 1;
+
+    uint32_t republished = drainBacklogWithDrop();
+    bool redelivered = republished == MEASUREMENT_LOG_CAPACITY;
+    printf("connection lost      %-4s %u of %u records published again\n", redelivered ? "ok" : "FAIL", republished,
+           MEASUREMENT_LOG_CAPACITY);
+    result |= redelivered ? 0 : 1;
+
+    uint32_t afterShortWrite = drainBacklogWithShortWrite();
+    bool resent = afterShortWrite == MEASUREMENT_LOG_CAPACITY;
+    printf("short write          %-4s %u of %u records, published after a reconnect\n", resent ? "ok" : "FAIL", afterShortWrite,
+           MEASUREMENT_LOG_CAPACITY);
+    result |= resent ? 0 : 1;
+
+    uint32_t reconnects = publishWithPingOutstanding();
+    bool keptAlive = reconnects == 0;
+    printf("ping outstanding     %-4s %s\n", keptAlive ? "ok" : "FAIL",
+           keptAlive ? "the PINGRESP read among the PUBACKs, no reconnect"
+                     : "the connection timed out after a publish with the keep-alive ping out");
+    result |= keptAlive ? 0 : 1;
+
+    clearMeasurementLog();
+    return result;
+}
+
+} // namespace bench
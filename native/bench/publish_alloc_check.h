@@ -0,0 +1,98 @@
+#pragma once
+
+// Publish path without heap allocations: logged measurements go through
+// publishLogBatch() and the PUBACK handling under the heap counter, any
+// allocation fails the suite. The JSON is checked against what the ArduinoJson
+// version printed, and every topic against the main topic.
+
+#include <chrono>
+
+#include "bench_common.h"
+#include "heap_counter.h"
+#include "measurement_log_bench.h"
+
+namespace bench {
+
+constexpr uint32_t PUBLISH_RUN = 6400;
+
+struct JsonCase {
+    float weightKg, fatPercentage, waterPercentage, musclePercentage;
+    const char *expected;
+};
+
+const JsonCase JSON_CASES[] = {
+    {84.3f, 0.0f, 0.0f, 0.0f, R"({"p_id":2,"time":"2025-12-26T18:38:30Z","weight":84.3,"fat":0,"water":0,"muscle":0})"},
+    {70.0f, 18.25f, 55.04f, 40.96f, R"({"p_id":2,"time":"2025-12-26T18:38:30Z","weight":70,"fat":18.3,"water":55,"muscle":41})"},
+};
+
+inline int runPublishAllocationCheck(const Options &options) {
+    int result = 0;
+    printf("== publish path allocations (%u measurements) ==\n", PUBLISH_RUN);
+
+    for (const auto &c : JSON_CASES) {
+        measurement.pID = 2;
+        snprintf(measurement.time, sizeof(measurement.time), "%s", "2025-12-26T18:38:30Z");
+        measurement.weightKg = c.weightKg;
+        measurement.fatPercentage = c.fatPercentage;
+        measurement.waterPercentage = c.waterPercentage;
+        measurement.musclePercentage = c.musclePercentage;
+        char json[MEASUREMENT_JSON_SIZE];
+        bool ok = writeMeasurementJson(json, sizeof(json)) && strcmp(json, c.expected) == 0;
+        printf("json                 %-4s %s\n", ok ? "ok" : "FAIL", json);
+        result |= ok ? 0 : 1;
+    }
+
+    fake::reset();
+    ensureFirmwareStarted(); // the sessions whose values go out with a measurement
+    clearMeasurementLog();
+    while (!(pollWifi() && pollMqtt())) {
+        fake::advanceMs(10);
+    }
+    // the C library loads the time zone and the fake NVS creates the "acked" entry once
+    fake::recordPublishes = false;
+    logMeasurement(0);
+    publishWholeLog();
+
+    uint32_t publishesBefore = fake::publishCount;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+    for (uint32_t logged = 0; logged < PUBLISH_RUN; logged += MEASUREMENT_LOG_CAPACITY) {
+        for (uint32_t i = 0; i < MEASUREMENT_LOG_CAPACITY; i++) {
+            logMeasurement(1 + logged + i);
+        }
+        uint64_t allocationsBefore = heap.allocations;
+        uint64_t bytesBefore = heap.bytes;
+        auto started = std::chrono::steady_clock::now();
+        publishWholeLog();
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        allocations += heap.allocations - allocationsBefore;
+        bytes += heap.bytes - bytesBefore;
+    }
+    fake::recordPublishes = true;
+    printf("publish + PUBACKs     %llu allocations, %llu bytes, %.1f publishes and %.0f ns per measurement\n",
+           (unsigned long long)allocations, (unsigned long long)bytes, double(fake::publishCount - publishesBefore) / PUBLISH_RUN,
+           seconds * 1e9 / PUBLISH_RUN);
+    result |= allocations == 0 && measurementLog.pendingCount() == 0 ? 0 : 1;
+
+    // every topic carries the main topic, the counters go out once per measurement
+    logMeasurement(1 + PUBLISH_RUN);
+    fake::published.clear();
+    publishWholeLog();
+    uint32_t unprefixed = 0;
+    uint32_t counters = 0;
+    for (const auto &publish : fake::published) {
+        unprefixed += publish.topic.rfind(MAIN_TOPIC, 0) == 0 ? 0 : 1;
+        counters += publish.topic == TOPICS[Topic::MEASUREMENT_COUNT] || publish.topic == TOPICS[Topic::LOOP_COUNT] ? 1 : 0;
+    }
+    printf("topics               %zu published, %u without \"%s\", %u counters\n", fake::published.size(), unprefixed, MAIN_TOPIC,
+           counters);
+    result |= unprefixed == 0 && counters == 2 ? 0 : 1;
+
+    disconnectFromMqtt();
+    disconnectFromWifi();
+    clearMeasurementLog();
+    return result;
+}
+
+} // namespace bench
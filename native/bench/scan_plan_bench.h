@@ -0,0 +1,151 @@
+#pragma once
+
+// Scan duty cycle against detection: six weeks of weigh-ins at household times (two in the
+// morning, now and then one in the evening or during the day) with the scan plan fixed at
+// continuous, busy or quiet, and learned from the sessions as the firmware does. Reports the
+// time the radio listened for the scale per day (the firmware's own count), how long after
+// the step-on the scale was found and the wake-ups the scan missed altogether. The first
+// week, while the plan is still learning, is not counted.
+
+#include <ctime>
+
+#include "bench_common.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t SCAN_PLAN_DAYS = 42;
+constexpr uint32_t SCAN_PLAN_WARMUP_DAYS = 7;
+
+struct ScanPlanRun {
+    const char *name;
+    ScanParams quiet;
+    ScanParams busy;
+};
+
+struct ScanPlanResult {
+    std::vector<double> foundMs; // step-on until the BLE task left SCANNING
+    uint32_t missed = 0; // the scale powered down again before it was found
+    uint32_t sessions = 0;
+    double radioSecondsPerDay = 0.0;
+};
+
+// wall clock seconds of `hour`:`minute` local time, `day` days after the local midnight before `now`
+inline time_t localTimeOfDay(time_t now, uint32_t day, uint32_t hour, uint32_t minute) {
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    timeinfo.tm_mday += day;
+    timeinfo.tm_hour = hour;
+    timeinfo.tm_min = minute;
+    timeinfo.tm_sec = 0;
+    timeinfo.tm_isdst = -1;
+    return mktime(&timeinfo);
+}
+
+// the weigh-ins of one day, in local minutes after midnight
+inline std::vector<uint32_t> householdDay(std::mt19937 &rng) {
+    std::vector<uint32_t> minutes = {uniform(rng, 6 * 60 + 30, 7 * 60 + 30), uniform(rng, 7 * 60, 8 * 60)};
+    if (uniform(rng, 0, 99) < 30) {
+        minutes.push_back(uniform(rng, 21 * 60, 22 * 60));
+    }
+    if (uniform(rng, 0, 99) < 10) {
+        minutes.push_back(uniform(rng, 10 * 60, 18 * 60));
+    }
+    std::sort(minutes.begin(), minutes.end());
+    return minutes;
+}
+
+inline ScanPlanResult runScanPlan(const ScanPlanRun &run, const Options &options) {
+    std::mt19937 rng(options.seed);
+    LoopStats stats;
+    ScanPlanResult result;
+
+    fake::reset();
+    fake::recordPublishes = false;
+    persistentConnection = false;
+    historySync = false;
+    scanSchedule.begin(run.quiet, run.busy);
+    scanSchedule.clear();
+    cleanupBleSession(scales[0]);
+    NimBLEDevice::getScan()->stop();
+    wakeTask(TaskId::BLE); // the wait for the scale starts over with this plan
+    idle(stats, 1000);
+
+    time_t firstDay = fake::wallTime(nullptr);
+    uint64_t radioMsBefore = 0;
+    uint64_t countedFromUs = 0;
+    for (uint32_t day = 1; day <= SCAN_PLAN_DAYS; day++) {
+        if (day == SCAN_PLAN_WARMUP_DAYS + 1) {
+            radioMsBefore = scanRadioTotalMs();
+            countedFromUs = fake::nowUs;
+        }
+        for (uint32_t minute : householdDay(rng)) {
+            time_t stepOnAt = localTimeOfDay(firstDay, day, minute / 60, minute % 60);
+            time_t now = fake::wallTime(nullptr);
+            if (stepOnAt > now) {
+                idle(stats, uint32_t(stepOnAt - now) * 1000);
+            }
+            randomizeProfiles(rng);
+            float weight = 55.0f + uniform(rng, 0, 400) / 10.0f;
+            fake::stepOn(bodyCompositionFrame(1, weight, 18.0f + uniform(rng, 0, 150) / 10.0f,
+                                              35.0f + uniform(rng, 0, 100) / 10.0f, weight * 0.55f));
+            uint64_t stepOnUs = fake::nowUs;
+            bool found = false;
+            while (fake::nowUs - stepOnUs < uint64_t(SESSION_TIMEOUT_MS) * 1000) {
+                runLoopOnce(stats, false);
+                if (!found && scales[0].state != AppState::SCANNING) {
+                    found = true;
+                    if (day > SCAN_PLAN_WARMUP_DAYS) {
+                        result.foundMs.push_back((fake::nowUs - stepOnUs) / 1000.0);
+                    }
+                }
+                if (found ? scales[0].state == AppState::SCANNING : !fake::scale.awake) {
+                    break;
+                }
+            }
+            if (day > SCAN_PLAN_WARMUP_DAYS) {
+                result.sessions++;
+                result.missed += found ? 0 : 1;
+            }
+        }
+    }
+    double countedDays = (fake::nowUs - countedFromUs) / 86400e6;
+    result.radioSecondsPerDay = (scanRadioTotalMs() - radioMsBefore) / 1000.0 / countedDays;
+    fake::recordPublishes = true;
+    return result;
+}
+
+inline int runScanPlanBench(const Options &options) {
+    const ScanPlanRun runs[] = {
+        {"continuous", CONTINUOUS_SCAN, CONTINUOUS_SCAN},
+        {"busy only", BUSY_SCAN, BUSY_SCAN},
+        {"quiet only", QUIET_SCAN, QUIET_SCAN},
+        {"learned (firmware)", QUIET_SCAN, BUSY_SCAN},
+    };
+    printf("== scan plan (%u days of household weigh-ins, first %u not counted, seed %u) ==\n", SCAN_PLAN_DAYS,
+           SCAN_PLAN_WARMUP_DAYS, options.seed);
+    printf("%-20s %14s %12s %10s %10s %10s\n", "plan", "advert miss", "listen/day", "found p50", "found p99", "missed");
+
+    ensureFirmwareStarted();
+    ScanPlanResult results[sizeof(runs) / sizeof(runs[0])];
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        const ScanPlanRun &run = runs[i];
+        results[i] = runScanPlan(run, options);
+        ScanPlanResult &result = results[i];
+        char miss[16];
+        snprintf(miss, sizeof(miss), run.quiet == run.busy ? "%u%%" : "%u%%/%u%%", run.busy.missPercent(), run.quiet.missPercent());
+        printf("%-20s %14s %10.0f s %7.0f ms %7.0f ms %5u of %u\n", run.name, miss, result.radioSecondsPerDay,
+               percentile(result.foundMs, 50), percentile(result.foundMs, 99), result.missed, result.sessions);
+    }
+    scanSchedule.begin(QUIET_SCAN, BUSY_SCAN);
+    scanSchedule.clear();
+
+    const ScanPlanResult &busy = results[1];
+    const ScanPlanResult &learned = results[3];
+    bool passed = learned.missed == 0 && learned.radioSecondsPerDay < busy.radioSecondsPerDay;
+    printf("learned plan         %s (%.0f%% of the listening of the busy plan)\n", passed ? "ok" : "FAIL",
+           100.0 * learned.radioSecondsPerDay / busy.radioSecondsPerDay);
+    return passed ? 0 : 1;
+}
+
+} // namespace bench
@@ -0,0 +1,387 @@
+#pragma once
+
+// End-to-end benchmark: simulated "user steps on scale" sessions driven through
+// the real task passes against the fake radio and network.
+// Reports step-on-to-publish latency and how long the BLE session dwells in each AppState
+// between the step-on and the return to SCANNING.
+//
+// Also step-on to subscribe and publish-to-PUBACK, GATT cache hits and misses (the scale's
+// attributes move halfway through the run), how long after the scale powered down the BLE
+// task noticed, the back-to-back sessions caught live against the firmware's own count, the
+// first scan and the boot time after a power-on, a restart that keeps its counters and clock
+// without WiFi, the CPU idle share, the wakeups per minute of each task and the log lines
+// dropped. The driver runs the task passes the way the scheduler would, on a 1 ms tick.
+// --outages, --back-to-back and --loss take WiFi down, step on again a few seconds after the
+// scale powered down and lose publishes in that share of the sessions.
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+
+#include "bench_common.h"
+
+namespace bench {
+
+inline uint32_t loopTickUs = 1000;                 // virtual time between two scheduler ticks, CONFIG_FREERTOS_HZ=1000
+constexpr uint32_t SESSION_TIMEOUT_MS = 5 * 60000;
+
+inline const char *appStateName(AppState state) {
+    switch (state) {
+        case AppState::SCANNING: return "SCANNING";
+        case AppState::CONNECTING: return "CONNECTING";
+        case AppState::CONNECTED_WAIT: return "CONNECTED_WAIT";
+        case AppState::SYNC_HISTORY: return "SYNC_HISTORY";
+        case AppState::WAIT_FOR_MEASUREMENT: return "WAIT_FOR_MEASUREMENT";
+        case AppState::WAIT_FOR_SCALE_TO_DISAPPEAR: return "WAIT_FOR_SCALE_TO_DISAPPEAR";
+    }
+    return "?";
+}
+
+inline const char *publishStateName(PublishState state) {
+    switch (state) {
+        case PublishState::IDLE: return "IDLE";
+        case PublishState::WIFI_CONNECTING: return "WIFI_CONNECTING";
+        case PublishState::MQTT_CONNECTING: return "MQTT_CONNECTING";
+        case PublishState::PUBLISHING: return "PUBLISHING";
+        case PublishState::WAIT_FOR_PUBLISH: return "WAIT_FOR_PUBLISH";
+    }
+    return "?";
+}
+
+struct LoopStats {
+    std::map<std::string, uint64_t> dwellUs;
+    std::map<std::string, uint64_t> publishDwellUs;
+    uint64_t longestPassUs = 0;
+    uint32_t reboots = 0;
+};
+
+inline uint64_t taskWakeAtUs[size_t(TaskId::COUNT)] = {};
+
+// the tasks, the scale sessions and their clients setup() creates; suites that skip setup() get them here
+inline void ensureFirmwareStarted() {
+    if (scaleCount == 0) {
+        beginScales(SCALES, SCALE_COUNT);
+    }
+    createScaleClients();
+    if (taskHandles[size_t(TaskId::BLE)] == nullptr) {
+        startTasks();
+    }
+}
+
+// the history cursors and user trends an earlier suite left in NVS: its measurements would
+// make this suite's frames look published already
+inline void forgetMeasurements() {
+    for (size_t i = 0; i < scaleCount; i++) {
+        scales[i].historyCursor.clear();
+        scales[i].trends.clear();
+    }
+}
+
+inline void boot(LoopStats &stats) {
+    std::fill(std::begin(taskWakeAtUs), std::end(taskWakeAtUs), 0);
+    try {
+        setup();
+    } catch (const fake::Restart &) {
+        stats.reboots++;
+    }
+}
+
+// ESP.restart(): the tasks and the BLE client go, RAM starts over apart from the RTC retained
+// state, NVS and the world outside stay
+inline void restart(LoopStats &stats) {
+    stats.reboots++;
+    statsBusyUs = tasksBusyUs(); // a reboot zeroes both, the CPU idle share starts over with setup()
+    currentPublishState = PublishState::IDLE;
+    RawFrame frame;
+    while (frameQueue.pop(frame)) {
+    }
+    for (size_t i = 0; i < scaleCount; i++) {
+        ScaleSession &session = scales[i];
+        session.state = AppState::SCANNING;
+        cleanupBleSession(session);
+        NimBLEDevice::deleteClient(session.client); // setup() creates it again
+        session.client = nullptr;
+    }
+    NimBLEDevice::getScan()->stop();
+    scanMode = ScanMode::OFF;
+    scanParams = {};
+    ledShow = LedShow::NONE;
+    timeSynced = false;
+    bootTimePending = true;
+    firstScanStarted = false;
+    boot(stats);
+}
+
+// what the FreeRTOS scheduler does with the tasks: a task runs its next pass once it
+// was woken or the wait its last pass returned ran out
+inline void runTasksOnce(LoopStats &stats) {
+    for (AppTask &task : appTasks) {
+        size_t i = size_t(task.id);
+        fake::currentTask = taskHandles[i];
+        bool woken = ulTaskNotifyTake(pdTRUE, 0) > 0;
+        fake::currentTask = nullptr;
+        if (!woken && fake::nowUs < taskWakeAtUs[i]) {
+            continue;
+        }
+        uint64_t start = fake::nowUs;
+        fake::currentTask = taskHandles[i];
+        uint32_t waitMs = runTaskPass(task);
+        fake::currentTask = nullptr;
+        stats.longestPassUs = std::max(stats.longestPassUs, fake::nowUs - start);
+        taskWakeAtUs[i] = waitMs == WAIT_FOREVER ? UINT64_MAX : fake::nowUs + uint64_t(waitMs) * 1000;
+    }
+}
+
+// one scheduler tick; time spent in the task passes (blocking calls) plus the tick is
+// charged to the state the tick started in when `charge` is set
+inline void runLoopOnce(LoopStats &stats, bool charge = true) {
+    AppState state = scales[0].state;
+    PublishState publishState = currentPublishState;
+    uint64_t start = fake::nowUs;
+    ensureFirmwareStarted();
+    try {
+        runTasksOnce(stats);
+    } catch (const fake::Restart &) {
+        restart(stats);
+    }
+    fake::advanceUs(loopTickUs);
+    if (charge) {
+        stats.dwellUs[appStateName(state)] += fake::nowUs - start;
+        stats.publishDwellUs[publishStateName(publishState)] += fake::nowUs - start;
+    }
+}
+
+// every session waits for its scale, by the scan or a pending direct connect
+inline bool allWaitingForScale() {
+    for (size_t i = 0; i < scaleCount; i++) {
+        const ScaleSession &session = scales[i];
+        bool directConnect = session.directConnectStarted && !session.directConnectFailed;
+        if (session.state != AppState::SCANNING || !(directConnect || NimBLEDevice::getScan()->isScanning())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// idle between sessions, still running the tasks now and then so timers see the clock
+inline void idle(LoopStats &stats, uint32_t ms) {
+    uint64_t until = fake::nowUs + uint64_t(ms) * 1000;
+    while (fake::nowUs < until) {
+        runLoopOnce(stats, false);
+        bool networkSettled = !persistentConnection || mqttClient.connected();
+        if (allWaitingForScale() && networkSettled) {
+            uint64_t skipUs = std::min<uint64_t>(until - fake::nowUs, 30000000);
+            if (persistentConnection) { // not past the keep-alive poll, a skipped one times the connection out
+                uint64_t pollAtUs = taskWakeAtUs[size_t(TaskId::PUBLISH)];
+                skipUs = std::min(skipUs, pollAtUs > fake::nowUs ? pollAtUs - fake::nowUs : 0);
+            }
+            fake::advanceUs(skipUs);
+        }
+    }
+}
+
+inline void randomizeProfiles(std::mt19937 &rng) {
+    fake::scaleProfile.connectMs = uniform(rng, 200, 900);
+    fake::scaleProfile.discoveryMs = uniform(rng, 20, 120);
+    fake::scaleProfile.gattOpMs = uniform(rng, 15, 60);
+    fake::scaleProfile.measurementDelayMs = uniform(rng, 2500, 7000);
+    fake::scaleProfile.awakeMs = uniform(rng, 40000, 60000);
+    fake::network.wifiAssociateMs = uniform(rng, 1200, 4500);
+    fake::network.mqttConnectMs = uniform(rng, 50, 400);
+    fake::network.brokerRttMs = uniform(rng, 5, 60);
+}
+
+inline int runSessionLatency(const Options &options) {
+    std::mt19937 rng(options.seed);
+    LoopStats stats;
+    std::vector<double> latenciesMs;
+    std::vector<double> readyMs; // step-on until the session is subscribed to the measurement
+    std::vector<double> departureMs; // scale powered down until the BLE task is back in SCANNING
+    std::vector<double> ackMs; // first delivered publish of the measurement until the log has its PUBACK
+    uint32_t backToBack = 0;
+    uint32_t backToBackCaught = 0;
+    uint32_t missed = 0;
+
+    fake::reset();
+    fake::network.publishLossPercent = options.lossPercent;
+    uint32_t publishesBefore = fake::publishCount;
+    persistentConnection = options.persistentConnection;
+    historySync = options.historySync;
+    fake::scale.consentCodes[1] = 0;
+    fake::scale.history.clear();
+
+    uint64_t publishedAtUs = 0;
+    std::set<std::string> delivered; // distinct measurements that reached the broker
+    std::string lastStats;
+    uint64_t bootTimeAtUs = 0;
+    std::string bootTime;
+    fake::onPublish = [&](const fake::Publish &publish) {
+        if (publish.topic == TOPICS[Topic::STATS]) {
+            lastStats = publish.payload;
+        }
+        if (publish.topic == TOPICS[Topic::BOOT_TIME] && !bootTimeAtUs) {
+            bootTimeAtUs = publish.atUs;
+            bootTime = publish.payload;
+        }
+        if (publish.topic == scales[0].topics[Topic::MEASUREMENT]) {
+            delivered.insert(publish.payload);
+            if (!publishedAtUs) {
+                publishedAtUs = publish.atUs;
+            }
+        }
+    };
+    uint32_t outages = 0;
+
+    // a power-on: no clock until SNTP answers and noise in RTC memory
+    fake::clockSet = false;
+    retained.magic = 0;
+    uint64_t poweredOnUs = fake::nowUs;
+    boot(stats);
+    uint64_t startedUs = fake::nowUs;
+    uint64_t busyBefore = tasksBusyUs();
+    uint32_t logDroppedBefore = eventLog.dropped();
+    uint32_t backToBackCounted = scales[0].backToBackCount;
+    uint32_t passesBefore[size_t(TaskId::COUNT)];
+    std::copy(std::begin(taskPasses), std::end(taskPasses), passesBefore);
+    idle(stats, 1000);
+    unsigned long coldBootScanMs = bootToScanMs;
+
+    bool isBackToBack = false;
+    for (uint32_t i = 0; i < options.sessions; i++) {
+        if (i == options.sessions / 2) {
+            // a firmware update of the scale moves its attributes, the cached handles must be rediscovered
+            fake::scaleProfile.handleShift = 2;
+        }
+        randomizeProfiles(rng);
+        fake::network.wifiAvailable = uniform(rng, 0, 99) >= options.outagePercent;
+        outages += fake::network.wifiAvailable ? 0 : 1;
+        float weight = 55.0f + uniform(rng, 0, 400) / 10.0f;
+        fake::stepOn(bodyCompositionFrame(1, weight, 18.0f + uniform(rng, 0, 150) / 10.0f,
+                                          35.0f + uniform(rng, 0, 100) / 10.0f, weight * 0.55f));
+        uint64_t stepOnUs = fake::nowUs;
+        publishedAtUs = 0;
+        bool connected = false; // a back-to-back step-on can find the BLE task still waiting for the scale to disappear
+        bool ready = false;
+        bool acked = false;
+        // the next household member steps on a few seconds after the scale powered down
+        bool nextIsBackToBack = i + 1 < options.sessions && uniform(rng, 0, 99) < options.backToBackPercent;
+        uint64_t nextStepOnUs = nextIsBackToBack ? fake::scale.sleepAtUs + uint64_t(uniform(rng, 1000, 10000)) * 1000 : 0;
+
+        while (fake::nowUs - stepOnUs < uint64_t(SESSION_TIMEOUT_MS) * 1000) {
+            AppState before = scales[0].state;
+            runLoopOnce(stats);
+            if (!ready && (scales[0].state == AppState::SYNC_HISTORY || scales[0].state == AppState::WAIT_FOR_MEASUREMENT)) {
+                ready = true;
+                readyMs.push_back((fake::nowUs - stepOnUs) / 1000.0);
+            }
+            if (publishedAtUs && !acked && measurementLog.pendingCount() == 0) {
+                acked = true;
+                ackMs.push_back((fake::nowUs - publishedAtUs) / 1000.0);
+            }
+            if (before == AppState::WAIT_FOR_SCALE_TO_DISAPPEAR && scales[0].state == AppState::SCANNING && !fake::scale.awake) {
+                departureMs.push_back((fake::nowUs - fake::scale.sleepAtUs) / 1000.0);
+            }
+            if (nextStepOnUs) {
+                if (fake::nowUs >= nextStepOnUs) {
+                    break;
+                }
+            } else if (scales[0].state != AppState::SCANNING && scales[0].state != AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) {
+                connected = true;
+            } else if (connected && scales[0].state == AppState::SCANNING) {
+                break;
+            }
+        }
+
+        if (publishedAtUs) {
+            latenciesMs.push_back((publishedAtUs - stepOnUs) / 1000.0);
+        } else {
+            missed++;
+        }
+        backToBack += isBackToBack ? 1 : 0;
+        backToBackCaught += isBackToBack && ready ? 1 : 0; // the session got the scale
+        isBackToBack = nextIsBackToBack;
+        fake::published.clear();
+        if (!nextIsBackToBack) {
+            idle(stats, uniform(rng, 60000, 600000));
+        }
+    }
+
+    // a restart that also lost the clock: RTC memory brings back the counters and a time a
+    // few seconds behind, the scan starts without waiting for WiFi
+    LoopStats restartStats;
+    uint16_t countBefore = measurementCount;
+    uint32_t syncsBefore = fake::sntpSyncs;
+    fake::clockSet = false;
+    restart(restartStats);
+    bool clockRestored = timeSynced;
+    int64_t clockBehind = fake::bootEpoch + int64_t(fake::nowUs / 1000000) - time(nullptr);
+    idle(restartStats, 1000);
+    bool restarted = clockRestored && measurementCount == countBefore && fake::sntpSyncs == syncsBefore && firstScanStarted;
+
+    uint64_t totalUs = 0;
+    for (const auto &entry : stats.dwellUs) {
+        totalUs += entry.second;
+    }
+    fake::onPublish = nullptr;
+    fake::network.wifiAvailable = true;
+    fake::network.publishLossPercent = 0;
+    fake::scaleProfile.handleShift = 0;
+
+    printf("== session latency (%u sessions, seed %u%s) ==\n", options.sessions, options.seed,
+           options.persistentConnection ? ", persistent connection" : "");
+    printf("step-on to publish   p50 %8.1f ms   p99 %8.1f ms   mean %8.1f ms\n", percentile(latenciesMs, 50),
+           percentile(latenciesMs, 99), mean(latenciesMs));
+    printf("step-on to subscribe p50 %8.1f ms   p99 %8.1f ms   mean %8.1f ms\n", percentile(readyMs, 50),
+           percentile(readyMs, 99), mean(readyMs));
+    printf("publish to PUBACK    p50 %8.1f ms   p99 %8.1f ms   (disconnect no longer waits a fixed 1000 ms)\n",
+           percentile(ackMs, 50), percentile(ackMs, 99));
+    printf("gatt handle cache    %u hits, %u misses (attributes moved at session %u)\n", gattCacheHits, gattCacheMisses,
+           options.sessions / 2);
+    printf("departure noticed    p50 %8.1f ms   p99 %8.1f ms after the scale powered down\n", percentile(departureMs, 50),
+           percentile(departureMs, 99));
+    // the firmware counts a step-on within BACK_TO_BACK_MS of the scale powering down, the bench
+    // steps on a few seconds after it did
+    backToBackCounted = scales[0].backToBackCount - backToBackCounted;
+    bool backToBackAgrees = backToBackCounted == backToBackCaught;
+    printf("back-to-back         %u of %u caught live, firmware counted %u %s\n", backToBackCaught, backToBack,
+           backToBackCounted, backToBackAgrees ? "ok" : "FAIL");
+    printf("missed sessions      %u (%u with WiFi down)\n", missed, outages);
+    printf("delivered weigh-ins  %zu of %u, repeated frames %u dropped at the indication and %u after the decode\n",
+           delivered.size(), options.sessions, dedupHits.load(), historySkippedCount);
+    printf("lost publishes       %u of %u (%u%% loss), measurements published again until acknowledged\n", fake::lostPublishes,
+           fake::publishCount - publishesBefore, options.lossPercent);
+    printf("reboots              %u\n", stats.reboots);
+    printf("power-on             first scan %lu ms after setup(), boot time %s published %.1f s after power-on\n",
+           coldBootScanMs, bootTime.c_str(), (bootTimeAtUs - poweredOnUs) / 1e6);
+    printf("warm restart         %s, first scan %lu ms after setup(), %u measurements counted, clock %lld s behind\n",
+           restarted ? "ok" : "FAIL", bootToScanMs, measurementCount, (long long)clockBehind);
+    printf("longest task pass    %.1f ms\n", stats.longestPassUs / 1000.0);
+    double runMinutes = (fake::nowUs - startedUs) / 60e6;
+    printf("cpu idle             %.2f%% (blocking calls counted as busy; loop() never blocked before the tasks: 0%%)\n",
+           100.0 - (tasksBusyUs() - busyBefore) / 10.0 / ((fake::nowUs - startedUs) / 1000.0));
+    printf("task wakeups         ble %.1f/min, publish %.1f/min, led %.1f/min, log %.1f/min\n",
+           (taskPasses[size_t(TaskId::BLE)] - passesBefore[size_t(TaskId::BLE)]) / runMinutes,
+           (taskPasses[size_t(TaskId::PUBLISH)] - passesBefore[size_t(TaskId::PUBLISH)]) / runMinutes,
+           (taskPasses[size_t(TaskId::LED)] - passesBefore[size_t(TaskId::LED)]) / runMinutes,
+           (taskPasses[size_t(TaskId::LOG)] - passesBefore[size_t(TaskId::LOG)]) / runMinutes);
+    printf("wifi on time         %.1f s/session (latency saved %.1f ms/session)\n", wifiOnTimeMs / 1000.0 / options.sessions,
+           double(latencySavedMs) / options.sessions);
+    printf("stats message        %zu bytes: %s\n", lastStats.size(), lastStats.c_str());
+    uint32_t logDropped = eventLog.dropped() - logDroppedBefore;
+    printf("log lines dropped    %u (%zu events per task) %s\n", logDropped, LOG_RING_CAPACITY, logDropped == 0 ? "ok" : "FAIL");
+    printf("%-30s %14s %8s\n", "state", "dwell/session", "share");
+    for (const auto &entry : stats.dwellUs) {
+        printf("%-30s %11.1f ms %7.2f%%\n", entry.first.c_str(), entry.second / 1000.0 / options.sessions,
+               100.0 * entry.second / totalUs);
+    }
+    printf("%-30s %14s %8s\n", "publish state", "dwell/session", "share");
+    for (const auto &entry : stats.publishDwellUs) {
+        printf("%-30s %11.1f ms %7.2f%%\n", entry.first.c_str(), entry.second / 1000.0 / options.sessions,
+               100.0 * entry.second / totalUs);
+    }
+    bool failed = missed == options.sessions || lastStats.empty() || bootTime.empty() || !restarted || !backToBackAgrees;
+    return failed || logDropped != 0 ? 1 : 0;
+}
+
+} // namespace bench
@@ -0,0 +1,101 @@
+#pragma once
+
+// Uptime soak: many sessions through the tasks with no reboot in between, checking that
+// the BLE session lifecycle reuses its one client, that the live heap stays flat (every 10%
+// of the run), that every weigh-in is delivered and that no log line is dropped.
+// Publishes are not recorded and the scheduler ticks coarser than in the session bench, so
+// 100k sessions (about three years of weigh-ins) finish in minutes.
+
+#include "bench_common.h"
+#include "heap_counter.h"
+#include "session_latency.h"
+
+namespace bench {
+
+constexpr uint32_t SOAK_TICK_US = 20000;
+constexpr uint32_t SOAK_CHECKPOINTS = 10;
+constexpr int64_t SOAK_HEAP_DRIFT_MAX = 1024; // bytes, room for a container of the fakes that grew once more
+
+inline int runSoak(const Options &options) {
+    std::mt19937 rng(options.seed);
+    LoopStats stats;
+    uint32_t sessions = options.soakSessions;
+    uint32_t checkpoint = std::max<uint32_t>(sessions / SOAK_CHECKPOINTS, 1);
+    uint32_t delivered = 0;
+
+    fake::reset();
+    forgetMeasurements();
+    fake::recordPublishes = false; // `published` would grow with every session
+    fake::network.publishLossPercent = options.lossPercent;
+    persistentConnection = options.persistentConnection;
+    historySync = options.historySync;
+    loopTickUs = SOAK_TICK_US;
+    uint32_t clientsBefore = fake::clientsCreated;
+    for (ScaleSession &session : scales) {
+        session.gattCache.invalidate(); // an earlier suite's scale, the soak's is found by a scan
+        if (session.client != nullptr) {
+            NimBLEDevice::deleteClient(session.client); // an earlier suite's, setup() creates the one the soak counts
+            session.client = nullptr;
+        }
+    }
+
+    boot(stats);
+    idle(stats, 1000);
+
+    uint64_t startedUs = fake::nowUs;
+    uint32_t logDroppedBefore = eventLog.dropped();
+    int64_t baseline = 0;
+    int64_t drift = 0;
+    printf("== soak (%u sessions without a reboot, seed %u) ==\n", sessions, options.seed);
+    for (uint32_t i = 0; i < sessions; i++) {
+        randomizeProfiles(rng);
+        fake::network.wifiAvailable = uniform(rng, 0, 99) >= options.outagePercent;
+        float weight = 55.0f + uniform(rng, 0, 400) / 10.0f;
+        fake::stepOn(bodyCompositionFrame(1, weight, 18.0f + uniform(rng, 0, 150) / 10.0f,
+                                          35.0f + uniform(rng, 0, 100) / 10.0f, weight * 0.55f));
+        uint32_t newestBefore = measurementLog.newestSeq();
+        uint64_t stepOnUs = fake::nowUs;
+        bool connected = false;
+        while (fake::nowUs - stepOnUs < uint64_t(SESSION_TIMEOUT_MS) * 1000) {
+            runLoopOnce(stats, false);
+            AppState state = scales[0].state;
+            if (state != AppState::SCANNING && state != AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) {
+                connected = true;
+            } else if (connected && state == AppState::SCANNING) {
+                break;
+            }
+        }
+        idle(stats, uniform(rng, 60000, 900000));
+        delivered += measurementLog.newestSeq() > newestBefore && measurementLog.pendingCount() == 0 ? 1 : 0;
+
+        // the first checkpoint is the baseline, by then caches, NVS keys and the fake world have settled
+        if ((i + 1) % checkpoint == 0) {
+            int64_t live = heap.live;
+            if (i + 1 == checkpoint) {
+                baseline = live;
+            }
+            drift = std::max(drift, std::abs(live - baseline));
+            printf("session %7u    live heap %8lld bytes  %+6lld since session %u\n", i + 1, (long long)live,
+                   (long long)(live - baseline), checkpoint);
+        }
+    }
+    uint32_t clients = fake::clientsCreated - clientsBefore;
+    uint32_t logDropped = eventLog.dropped() - logDroppedBefore;
+    loopTickUs = 1000;
+    fake::recordPublishes = true;
+    fake::network.wifiAvailable = true;
+    fake::network.publishLossPercent = 0;
+
+    printf("uptime               %.0f days\n", (fake::nowUs - startedUs) / 86400e6);
+    printf("ble clients created  %u\n", clients);
+    printf("heap drift           %lld bytes (limit %lld)\n", (long long)drift, (long long)SOAK_HEAP_DRIFT_MAX);
+    printf("delivered weigh-ins  %u of %u\n", delivered, sessions);
+    printf("reboots              %u\n", stats.reboots);
+    printf("log lines dropped    %u (%zu events per task)\n", logDropped, LOG_RING_CAPACITY);
+    bool passed = clients == 1 && drift <= SOAK_HEAP_DRIFT_MAX && stats.reboots == 0 && logDropped == 0 &&
+                  (options.outagePercent > 0 ? delivered > 0 : delivered == sessions);
+    printf("soak                 %s\n", passed ? "ok" : "FAIL");
+    return passed ? 0 : 1;
+}
+
+} // namespace bench
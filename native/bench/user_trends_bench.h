@@ -0,0 +1,114 @@
+#pragma once
+
+// Per-user running statistics: a year of weigh-ins of one user who loses half a kilo a week
+// for half a year and then holds the weight, folded in one at a time as the firmware does.
+// Checks the weight range against the measurements of the last TREND_DAYS days after every
+// fold, the slope against the true rate at the end of both halves and the trend kept over a
+// reboot, and reports the fold time, its NVS cost and the JSON on smartscale/trend.
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <deque>
+
+#include "bench_common.h"
+
+namespace bench {
+
+constexpr uint32_t TREND_BENCH_DAYS = 364;
+constexpr float TREND_BENCH_LOSS = 0.5f; // kg per week in the first half
+constexpr float TREND_BENCH_SLOPE_ERROR = 0.2f; // kg per week, the slope of two weeks of 0.4 kg day to day swing
+
+struct TrendSample {
+    uint16_t day;
+    uint16_t tenths;
+};
+
+inline uint32_t scaleTimeOf(time_t at) {
+    struct tm t;
+    gmtime_r(&at, &t);
+    return packScaleTime(t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+}
+
+inline int runUserTrendsBench(const Options &options) {
+    std::mt19937 rng(options.seed);
+    std::normal_distribution<float> noise(0.0f, 0.4f); // day to day swing of the body weight
+    printf("== user trends (%u days of weigh-ins, -%.1f kg/week then steady, seed %u) ==\n", TREND_BENCH_DAYS, TREND_BENCH_LOSS,
+           options.seed);
+
+    fake::reset();
+    UserTrends trends;
+    trends.begin("benchtrends");
+    trends.clear();
+
+    const time_t start = 1735689600; // 2025-01-01T00:00:00Z on the scale clock
+    std::deque<TrendSample> window;
+    uint32_t folds = 0;
+    uint32_t rangeMismatches = 0;
+    float slopeAfterLoss = 0.0f;
+    float levelError = 0.0f;
+    uint64_t entriesBefore = fake::nvsEntries;
+    double foldSeconds = 0.0;
+    for (uint32_t day = 0; day < TREND_BENCH_DAYS; day++) {
+        std::vector<uint32_t> minutes = {uniform(rng, 6 * 60 + 30, 8 * 60)};
+        if (uniform(rng, 0, 99) < 30) {
+            minutes.push_back(uniform(rng, 21 * 60, 22 * 60));
+        }
+        if (uniform(rng, 0, 99) < 10) {
+            minutes.clear(); // away for the day
+        }
+        float level = 85.0f - TREND_BENCH_LOSS / 7.0f * std::min(day, TREND_BENCH_DAYS / 2);
+        for (uint32_t minute : minutes) {
+            float weight = std::round((level + noise(rng)) * 10.0f) / 10.0f;
+            uint32_t scaleTime = scaleTimeOf(start + day * 86400 + minute * 60);
+            auto started = std::chrono::steady_clock::now();
+            trends.fold(1, scaleTime, weight, 20.0f + noise(rng), 55.0f + noise(rng), 40.0f + noise(rng));
+            foldSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            folds++;
+
+            // the range the firmware keeps against the measurements of the last TREND_DAYS days
+            uint16_t today = scaleTimeToUnix(scaleTime) / 86400;
+            window.push_back({today, toTenths(weight)});
+            while (window.front().day + TREND_DAYS <= today) {
+                window.pop_front();
+            }
+            uint16_t lightest = UINT16_MAX, heaviest = 0;
+            for (const TrendSample &sample : window) {
+                lightest = std::min(lightest, sample.tenths);
+                heaviest = std::max(heaviest, sample.tenths);
+            }
+            const UserTrend &trend = *trends.of(1);
+            rangeMismatches += trend.windowMin() == lightest && trend.windowMax() == heaviest ? 0 : 1;
+        }
+        if (day + 1 == TREND_BENCH_DAYS / 2) {
+            slopeAfterLoss = trends.of(1)->slope * 7.0f;
+        }
+        levelError = std::fabs(trends.of(1)->weight - level);
+    }
+    const UserTrend &trend = *trends.of(1);
+    float slopeSteady = trend.slope * 7.0f;
+
+    UserTrends rebooted;
+    rebooted.begin("benchtrends");
+    bool kept = rebooted.of(1) && memcmp(rebooted.of(1), &trend, sizeof(UserTrend)) == 0;
+
+    char json[TREND_JSON_SIZE];
+    bool written = writeTrendJson(json, sizeof(json), 1, trend);
+
+    bool slopesOk = std::fabs(slopeAfterLoss + TREND_BENCH_LOSS) < TREND_BENCH_SLOPE_ERROR &&
+                    std::fabs(slopeSteady) < TREND_BENCH_SLOPE_ERROR;
+    printf("fold                 %.0f ns host time, %.1f NVS entries, %zu bytes per user\n", foldSeconds * 1e9 / folds,
+           double(fake::nvsEntries - entriesBefore) / folds, sizeof(UserTrend));
+    printf("weight range         %-4s %u of %u folds differ from the last %u days of measurements\n", rangeMismatches ? "FAIL" : "ok",
+           rangeMismatches, folds, TREND_DAYS);
+    printf("slope                %-4s %.2f kg/week while losing %.1f, %.2f kg/week once steady\n", slopesOk ? "ok" : "FAIL",
+           slopeAfterLoss, TREND_BENCH_LOSS, slopeSteady);
+    printf("weight average       %.2f kg from the true weight at the end\n", levelError);
+    printf("reboot               %s\n", kept ? "ok, trend read back from NVS" : "FAIL");
+    printf("trend json           %-4s %s\n", written ? "ok" : "FAIL", json);
+
+    trends.clear();
+    return rangeMismatches == 0 && slopesOk && kept && written ? 0 : 1;
+}
+
+} // namespace bench
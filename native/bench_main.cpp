@@ -0,0 +1,87 @@
+// Host-native benchmark driver, built by `pio run -e native`.
+// The firmware is compiled into this translation unit so the benches can
+// drive the task passes and inspect its state directly.
+
+#include "../src/main.cpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "bench/advert_filter_bench.h"
+#include "bench/bcm_decoder_bench.h"
+#include "bench/ble_replay.h"
+#include "bench/event_log_bench.h"
+#include "bench/frame_queue_stress.h"
+#include "bench/measurement_log_bench.h"
+#include "bench/multi_scale_bench.h"
+#include "bench/payload_bench.h"
+#include "bench/publish_alloc_check.h"
+#include "bench/scan_plan_bench.h"
+#include "bench/session_latency.h"
+#include "bench/soak.h"
+#include "bench/user_trends_bench.h"
+
+struct BenchSuite {
+    const char *name;
+    int (*run)(const bench::Options &);
+};
+
+static const BenchSuite SUITES[] = {
+    {"session", bench::runSessionLatency},
+    {"frames", bench::runFrameQueueStress},
+    {"adverts", bench::runAdvertFilterBench},
+    {"decode", bench::runBcmDecoderBench},
+    {"log", bench::runMeasurementLogBench},
+    {"publish", bench::runPublishAllocationCheck},
+    {"payload", bench::runPayloadBench},
+    {"scan", bench::runScanPlanBench},
+    {"multi", bench::runMultiScaleBench},
+    {"trends", bench::runUserTrendsBench},
+    {"logging", bench::runEventLogBench},
+    {"replay", bench::runBleReplay},
+    {"soak", bench::runSoak},
+};
+
+int main(int argc, char **argv) {
+    bench::Options options;
+    const char *only = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            options.sessions = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--persistent") == 0) {
+            options.persistentConnection = true;
+        } else if (strcmp(argv[i], "--history") == 0) {
+            options.historySync = true;
+        } else if (strcmp(argv[i], "--outages") == 0 && i + 1 < argc) {
+            options.outagePercent = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--back-to-back") == 0 && i + 1 < argc) {
+            options.backToBackPercent = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            options.lossPercent = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+            options.soakSessions = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            options.replaySpeed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            Serial.echo = true;
+        } else if (argv[i][0] != '-') {
+            only = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [suite] [--sessions N] [--seed S] [--persistent] [--history] [--outages PERCENT] [--back-to-back PERCENT] [--loss PERCENT] [--soak N] [--trace FILE] [--speed N] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int result = 0;
+    for (const auto &suite : SUITES) {
+        if (only == nullptr || strcmp(only, suite.name) == 0) {
+            result |= suite.run(options);
+        }
+    }
+    return result;
+}
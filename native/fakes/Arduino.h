@@ -0,0 +1,253 @@
+#pragma once
+
+// Minimal host-side Arduino core for the [env:native] build.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+#include "esp_sntp.h"
+#include "fake_world.h"
+#include "freertos/task.h"
+
+typedef unsigned int uint;
+
+using std::max;
+using std::min;
+
+constexpr double PI = 3.1415926535897932384626433832795;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+inline unsigned long millis() {
+    return static_cast<unsigned long>(fake::nowUs / 1000);
+}
+
+inline unsigned long micros() {
+    return static_cast<unsigned long>(fake::nowUs);
+}
+
+inline void delay(uint32_t ms) {
+    fake::advanceMs(ms);
+}
+
+inline void yield() {}
+
+namespace fake {
+
+// false models a power-on: the clock counts from 1970 until SNTP or settimeofday() sets it
+inline bool clockSet = true;
+inline int64_t clockOffset = 0; // seconds settimeofday() put the clock off the true time
+
+inline time_t wallTime(time_t *out) {
+    time_t t = static_cast<time_t>((clockSet ? bootEpoch + clockOffset : 0) + int64_t(nowUs / 1000000));
+    if (out) {
+        *out = t;
+    }
+    return t;
+}
+
+inline int setWallTime(const struct timeval *tv) {
+    clockOffset = tv->tv_sec - (bootEpoch + int64_t(nowUs / 1000000));
+    clockSet = true;
+    return 0;
+}
+
+} // namespace fake
+
+// the firmware reads and sets the wall clock through time() and settimeofday(); route them to the virtual clock
+#define time(out) fake::wallTime(out)
+#define settimeofday(tv, tz) fake::setWallTime(tv)
+
+// RTC memory is ordinary memory here, it keeps its contents across a fake::Restart anyway
+#define RTC_NOINIT_ATTR
+
+inline void configTime(long, int, const char *) {
+    fake::sntpConfigured = true;
+}
+
+inline bool getLocalTime(struct tm *info, uint32_t = 5000) {
+    time_t now = fake::wallTime(nullptr);
+    return localtime_r(&now, info) != nullptr;
+}
+
+class String {
+  public:
+    String() = default;
+    String(const char *s) : s_(s ? s : "") {}
+    String(const std::string &s) : s_(s) {}
+    template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    String(T v) : s_(std::to_string(v)) {}
+    String(double v, unsigned decimals = 2) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, v);
+        s_ = buffer;
+    }
+
+    const char *c_str() const { return s_.c_str(); }
+    unsigned int length() const { return s_.length(); }
+    int indexOf(const char *needle) const {
+        size_t pos = s_.find(needle);
+        return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    }
+
+    String &operator+=(const String &rhs) {
+        s_ += rhs.s_;
+        return *this;
+    }
+    friend String operator+(String lhs, const String &rhs) { return lhs += rhs; }
+    friend String operator+(String lhs, const char *rhs) { return lhs += String(rhs); }
+    bool operator==(const String &rhs) const { return s_ == rhs.s_; }
+
+  private:
+    std::string s_;
+};
+
+class StringSumHelper : public String {
+  public:
+    using String::String;
+};
+
+class IPAddress {
+  public:
+    String toString() const { return String("192.168.1.50"); }
+};
+
+namespace fake {
+
+// the UART behind Serial; at 0 baud output leaves instantly, otherwise a write blocks the
+// caller while the transmit FIFO is full, as HardwareSerial does
+inline uint32_t serialBaud = 0;
+inline size_t serialBufferBytes = 256;
+inline uint64_t serialIdleAtUs = 0; // when the FIFO has sent everything written so far
+inline uint64_t serialBlockedUs = 0; // callers waited for the UART this long in total
+inline std::function<void(const char *)> onSerial; // sees everything written to Serial, e.g. a trace capture
+
+} // namespace fake
+
+class FakeSerial {
+  public:
+    // off by default so benchmarks measure the firmware, not the terminal
+    bool echo = false;
+
+    void begin(unsigned long) {}
+
+    // like Print::printf(): formats into a 64 byte stack buffer and allocates for longer output
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[64];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (n < 0) {
+            return 0;
+        }
+        char *out = buffer;
+        if (size_t(n) >= sizeof(buffer)) {
+            out = new char[n + 1];
+            va_start(args, format);
+            vsnprintf(out, n + 1, format, args);
+            va_end(args);
+        }
+        write(out);
+        if (out != buffer) {
+            delete[] out;
+        }
+        return n;
+    }
+
+    void print(const char *s) { write(s); }
+    void print(const String &s) { write(s.c_str()); }
+    void print(const std::string &s) { write(s.c_str()); }
+    void print(const IPAddress &ip) { write(ip.toString().c_str()); }
+    template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    void print(T v) { write(String(v).c_str()); }
+
+    void println() { write("\n"); }
+    template <typename T>
+    void println(const T &v) {
+        print(v);
+        println();
+    }
+    void println(const char *s) {
+        print(s);
+        println();
+    }
+    void println(const struct tm *info, const char *format) {
+        char buffer[64];
+        strftime(buffer, sizeof(buffer), format, info);
+        println(buffer);
+    }
+
+  private:
+    void write(const char *s) {
+        if (echo) {
+            fputs(s, stdout);
+        }
+        if (fake::onSerial) {
+            fake::onSerial(s);
+        }
+        if (fake::serialBaud == 0) {
+            return;
+        }
+        // 10 bits per byte on the wire; moves the clock without firing events, the caller is stuck
+        uint64_t byteUs = 10000000ULL / fake::serialBaud;
+        fake::serialIdleAtUs = std::max(fake::serialIdleAtUs, fake::nowUs) + strlen(s) * byteUs;
+        uint64_t fifoUs = fake::serialBufferBytes * byteUs;
+        if (fake::serialIdleAtUs > fake::nowUs + fifoUs) {
+            uint64_t blockedUs = fake::serialIdleAtUs - fifoUs - fake::nowUs;
+            fake::nowUs += blockedUs;
+            fake::serialBlockedUs += blockedUs;
+            if (fake::currentTask != nullptr) {
+                fake::currentTask->serialBlockedUs += blockedUs;
+            }
+        }
+    }
+};
+
+inline FakeSerial Serial;
+
+namespace fake {
+
+// what an ESP32-C3 reports with WiFi and NimBLE up
+inline uint32_t freeHeap = 148000;
+inline uint32_t largestFreeBlock = 110580;
+inline uint32_t minFreeHeap = 131000;
+
+} // namespace fake
+
+class FakeEsp {
+  public:
+    [[noreturn]] void restart() { throw fake::Restart{}; }
+    uint32_t getFreeHeap() const { return fake::freeHeap; }
+    uint32_t getMaxAllocHeap() const { return fake::largestFreeBlock; }
+    uint32_t getMinFreeHeap() const { return fake::minFreeHeap; }
+};
+
+inline FakeEsp ESP;
+
+namespace fake {
+
+inline uint32_t ledcWrites = 0;
+inline uint32_t ledcDuty = 0;
+
+} // namespace fake
+
+inline void ledcSetup(uint8_t, uint32_t, uint8_t) {}
+inline void ledcAttachPin(uint8_t, uint8_t) {}
+inline void ledcWrite(uint8_t, uint32_t duty) {
+    fake::ledcWrites++;
+    fake::ledcDuty = duty;
+}
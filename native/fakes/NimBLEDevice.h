@@ -0,0 +1,996 @@
+#pragma once
+
+// Host-side NimBLE-Arduino subset backed by a scriptable scale model.
+
+#include <Arduino.h>
+#include <freertos/task.h>
+
+#include <cctype>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define ESP_PWR_LVL_P21 15
+
+// links the host keeps at once, nimconfig.h has the same default
+#ifndef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#endif
+
+#define BLE_ADDR_PUBLIC 0
+#define BLE_ADDR_RANDOM 1
+
+// initial connection parameters of the NimBLE host, in 1.25 ms and 10 ms units
+#define BLE_GAP_INITIAL_CONN_ITVL_MIN 24
+#define BLE_GAP_INITIAL_CONN_ITVL_MAX 40
+#define BLE_GAP_INITIAL_CONN_LATENCY 0
+#define BLE_GAP_INITIAL_SUPERVISION_TIMEOUT 256
+
+namespace fake {
+
+// a duty-cycled scan started at `startUs` hears what arrives during the first `window`
+// of every `interval`; equal values scan continuously
+inline bool inScanWindow(uint64_t startUs, uint64_t windowUs, uint64_t intervalUs) {
+    return windowUs >= intervalUs || (nowUs - startUs) % intervalUs < windowUs;
+}
+
+// how long the firmware's callbacks held the NimBLE host task, which sits on every other BLE
+// event meanwhile, in host time: the virtual clock only moves on a blocking call
+inline uint32_t hostCallbacks = 0;
+inline uint64_t hostCallbackTotalNs = 0;
+inline uint64_t hostCallbackLongestNs = 0;
+
+// runs `fn` as the NimBLE host task, which no bench task pass is
+template <typename F>
+void onHostTask(F fn) {
+    TaskHandle_t interrupted = currentTask;
+    currentTask = nullptr;
+    auto started = std::chrono::steady_clock::now();
+    fn();
+    uint64_t tookNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    hostCallbacks++;
+    hostCallbackTotalNs += tookNs;
+    hostCallbackLongestNs = std::max(hostCallbackLongestNs, tookNs);
+    currentTask = interrupted;
+}
+
+} // namespace fake
+
+class NimBLEUUID {
+  public:
+    NimBLEUUID() = default;
+    NimBLEUUID(const char *uuid) {
+        std::string s(uuid);
+        for (auto &c : s) {
+            c = static_cast<char>(tolower(c));
+        }
+        if (s.size() == 4) {
+            s = "0000" + s + "-0000-1000-8000-00805f9b34fb";
+        }
+        uuid_ = s;
+    }
+    bool operator==(const NimBLEUUID &rhs) const { return uuid_ == rhs.uuid_; }
+    std::string toString() const { return uuid_; }
+
+  private:
+    std::string uuid_;
+};
+
+// six bytes, least significant first, like the ble_addr_t the real one wraps
+class NimBLEAddress {
+  public:
+    NimBLEAddress() = default;
+    explicit NimBLEAddress(const std::string &mac, uint8_t type = 0) : type_(type) {
+        unsigned int bytes[6] = {};
+        sscanf(mac.c_str(), "%x:%x:%x:%x:%x:%x", &bytes[5], &bytes[4], &bytes[3], &bytes[2], &bytes[1], &bytes[0]);
+        for (size_t i = 0; i < 6; i++) {
+            val_[i] = bytes[i];
+        }
+    }
+    std::string toString() const {
+        char mac[18];
+        snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", val_[5], val_[4], val_[3], val_[2], val_[1], val_[0]);
+        return mac;
+    }
+    const uint8_t *getVal() const { return val_; }
+    uint8_t getType() const { return type_; }
+    bool operator==(const NimBLEAddress &rhs) const { return memcmp(val_, rhs.val_, sizeof(val_)) == 0; }
+
+  private:
+    uint8_t val_[6] = {};
+    uint8_t type_ = 0;
+};
+
+class NimBLEAdvertisedDevice {
+  public:
+    NimBLEAdvertisedDevice() = default;
+    NimBLEAdvertisedDevice(const std::string &mac, std::vector<uint8_t> payload)
+        : address_(mac), payload_(std::move(payload)) {}
+    // flags and complete local name, the advert of the Shape100
+    NimBLEAdvertisedDevice(const std::string &name, const std::string &mac) : address_(mac) {
+        payload_ = {0x02, 0x01, 0x06, uint8_t(name.size() + 1), 0x09};
+        payload_.insert(payload_.end(), name.begin(), name.end());
+    }
+
+    bool haveName() const { return !getName().empty(); }
+    std::string getName() const {
+        for (size_t pos = 0; pos + 1 < payload_.size() && payload_[pos] != 0; pos += 1 + payload_[pos]) {
+            if (payload_[pos + 1] == 0x08 || payload_[pos + 1] == 0x09) {
+                return std::string(payload_.begin() + pos + 2, payload_.begin() + pos + 1 + payload_[pos]);
+            }
+        }
+        return "";
+    }
+    const NimBLEAddress &getAddress() const { return address_; }
+    const std::vector<uint8_t> &getPayload() const { return payload_; }
+
+  private:
+    NimBLEAddress address_;
+    std::vector<uint8_t> payload_;
+};
+
+class NimBLERemoteCharacteristic;
+class NimBLEClient;
+
+using notify_callback = std::function<void(NimBLERemoteCharacteristic *, uint8_t *, size_t, bool)>;
+
+class NimBLERemoteDescriptor {
+  public:
+    explicit NimBLERemoteDescriptor(uint16_t handle) : handle_(handle) {}
+    uint16_t getHandle() const { return handle_; }
+
+  private:
+    uint16_t handle_;
+};
+
+class NimBLERemoteCharacteristic {
+  public:
+    NimBLERemoteCharacteristic(const char *uuid, uint16_t handle, bool read, bool write, bool indicate)
+        : uuid_(uuid), handle_(handle), cccd_(handle + 1), read_(read), write_(write), indicate_(indicate) {}
+
+    NimBLEUUID getUUID() const { return uuid_; }
+    uint16_t getHandle() const { return handle_; }
+    NimBLEClient *getClient() const { return client_; }
+    NimBLERemoteDescriptor *getDescriptor(const NimBLEUUID &uuid);
+    bool canRead() const { return read_; }
+    bool canWrite() const { return write_; }
+    bool canIndicate() const { return indicate_; }
+
+    std::string getValue() const { return value_; }
+    std::string readValue();
+    bool writeValue(const uint8_t *data, size_t length, bool response = false);
+    bool subscribe(bool notifications = true, notify_callback callback = nullptr, bool response = true);
+
+    std::string value_;
+    notify_callback callback_;
+    NimBLEClient *client_ = nullptr; // set by the discovery
+
+  private:
+    NimBLEUUID uuid_;
+    uint16_t handle_;
+    NimBLERemoteDescriptor cccd_;
+    bool read_;
+    bool write_;
+    bool indicate_;
+};
+
+class NimBLERemoteService {
+  public:
+    std::vector<NimBLERemoteCharacteristic> &characteristics() { return characteristics_; }
+    NimBLERemoteService(const char *uuid, std::vector<NimBLERemoteCharacteristic> characteristics)
+        : uuid_(uuid), characteristics_(std::move(characteristics)) {}
+
+    NimBLEUUID getUUID() const { return uuid_; }
+    NimBLERemoteCharacteristic *getCharacteristic(const NimBLEUUID &uuid);
+
+  private:
+    NimBLEUUID uuid_;
+    std::vector<NimBLERemoteCharacteristic> characteristics_;
+};
+
+class NimBLEClientCallbacks {
+  public:
+    virtual ~NimBLEClientCallbacks() = default;
+    virtual void onConnect(NimBLEClient *client) {}
+    virtual void onConnectFail(NimBLEClient *client, int reason) {}
+    virtual void onDisconnect(NimBLEClient *client, int reason) {}
+};
+
+class NimBLEClient {
+  public:
+    bool connect(NimBLEAdvertisedDevice *device, bool deleteAttributes = true);
+    bool connect(const NimBLEAddress &address, bool deleteAttributes = true, bool asyncConnect = false,
+                 bool exchangeMTU = true);
+    bool cancelConnect();
+    bool disconnect();
+    bool isConnected() const { return connected_; }
+    uint16_t getConnHandle() const { return connected_ ? connHandle_ : 0xFFFF; }
+    NimBLEAddress getPeerAddress() const { return peer_; }
+    void setConnectTimeout(uint32_t timeoutMs) { connectTimeoutMs_ = timeoutMs; }
+    // the scan interval and window of a connect, in 0.625 ms units
+    void setConnectionParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout,
+                             uint16_t scanInterval = 16, uint16_t scanWindow = 16) {
+        scanInterval_ = scanInterval;
+        scanWindow_ = scanWindow;
+    }
+    void setClientCallbacks(NimBLEClientCallbacks *callbacks, bool deleteCallbacks = true) { callbacks_ = callbacks; }
+    NimBLERemoteService *getService(const NimBLEUUID &uuid);
+    void deleteServices() { services_.clear(); }
+
+    bool connected_ = false;
+    uint16_t connHandle_ = 0xFFFF;
+    NimBLEAddress peer_;
+    uint32_t connectTimeoutMs_ = 30000;
+    NimBLEClientCallbacks *callbacks_ = nullptr;
+    bool deleteAttributes_ = true; // of the pending direct connect
+    uint16_t scanInterval_ = 16;
+    uint16_t scanWindow_ = 16;
+    uint64_t connectStartedUs_ = 0;
+
+    std::vector<NimBLERemoteService> services_;
+};
+
+// NimBLE host C API subset used for GATT access by attribute handle
+
+#define BLE_HS_EALREADY 2
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_ETIMEOUT 13
+#define BLE_HS_ERR_ATT_BASE 0x100
+#define BLE_ATT_ERR_INVALID_HANDLE 0x01
+#define BLE_GAP_EVENT_NOTIFY_RX 12
+
+struct os_mbuf {
+    std::vector<uint8_t> data;
+};
+
+#define OS_MBUF_PKTLEN(om) ((om)->data.size())
+
+inline int os_mbuf_copydata(const os_mbuf *om, int off, int len, void *dst) {
+    if (off + len > int(om->data.size())) {
+        return -1;
+    }
+    if (len > 0) {
+        memcpy(dst, om->data.data() + off, len); // an empty mbuf has no data()
+    }
+    return 0;
+}
+
+struct ble_gatt_error {
+    uint16_t status;
+    uint16_t att_handle;
+};
+
+struct ble_gatt_attr {
+    uint16_t handle;
+    uint16_t offset;
+    os_mbuf *om;
+};
+
+typedef int ble_gatt_attr_fn(uint16_t conn_handle, const ble_gatt_error *error, ble_gatt_attr *attr, void *arg);
+
+struct ble_gap_event {
+    uint8_t type;
+    union {
+        struct {
+            os_mbuf *om;
+            uint16_t conn_handle;
+            uint16_t attr_handle;
+            uint8_t indication : 1;
+        } notify_rx;
+    };
+};
+
+typedef int ble_gap_event_fn(ble_gap_event *event, void *arg);
+
+struct ble_gap_event_listener {
+    ble_gap_event_fn *fn;
+    void *arg;
+    ble_gap_event_listener *next;
+};
+
+inline int ble_gap_event_listener_register(ble_gap_event_listener *listener, ble_gap_event_fn *fn, void *arg);
+inline int ble_gattc_read(uint16_t conn_handle, uint16_t attr_handle, ble_gatt_attr_fn *cb, void *cb_arg);
+inline int ble_gattc_write_flat(uint16_t conn_handle, uint16_t attr_handle, const void *data, uint16_t data_len,
+                                ble_gatt_attr_fn *cb, void *cb_arg);
+
+class NimBLEScanCallbacks {
+  public:
+    virtual ~NimBLEScanCallbacks() = default;
+    virtual void onResult(const NimBLEAdvertisedDevice *advertisedDevice) {}
+};
+
+class NimBLEScan {
+  public:
+    void setScanCallbacks(NimBLEScanCallbacks *callbacks, bool wantDuplicates = false) {
+        callbacks_ = callbacks;
+        wantDuplicates_ = wantDuplicates;
+    }
+    void setDuplicateFilter(uint8_t enabled) { duplicateFilter_ = enabled; }
+    void setInterval(uint16_t intervalMs) { intervalMs_ = intervalMs; }
+    void setWindow(uint16_t windowMs) { windowMs_ = windowMs; }
+    bool start(uint32_t duration, bool isContinue = false, bool restart = true) {
+        scanning_ = true;
+        startedUs_ = fake::nowUs;
+        seen_.clear();
+        return true;
+    }
+    bool stop() {
+        scanning_ = false;
+        return true;
+    }
+    bool isScanning() const { return scanning_; }
+
+    // a device is reported once per scan unless duplicates were asked for and the controller filter is off
+    void report(const NimBLEAdvertisedDevice &device) {
+        if (!scanning_ || !callbacks_ || !fake::inScanWindow(startedUs_, windowMs_ * 1000ULL, intervalMs_ * 1000ULL)) {
+            return;
+        }
+        if ((!wantDuplicates_ || duplicateFilter_) && !seen_.insert(device.getAddress().toString()).second) {
+            return;
+        }
+        fake::onHostTask([&] { callbacks_->onResult(&device); });
+    }
+
+    // an advert a recording heard, its scan window already decided
+    void deliver(const NimBLEAdvertisedDevice &device) {
+        if (!scanning_ || !callbacks_) {
+            return;
+        }
+        if ((!wantDuplicates_ || duplicateFilter_) && !seen_.insert(device.getAddress().toString()).second) {
+            return;
+        }
+        fake::onHostTask([&] { callbacks_->onResult(&device); });
+    }
+
+    NimBLEScanCallbacks *callbacks_ = nullptr;
+
+  private:
+    bool scanning_ = false;
+    bool wantDuplicates_ = false;
+    bool duplicateFilter_ = false;
+    uint16_t intervalMs_ = 30;
+    uint16_t windowMs_ = 30;
+    uint64_t startedUs_ = 0;
+    std::set<std::string> seen_;
+};
+
+
+namespace fake {
+
+// timing of the scale model, shared by every scale of the fake world
+struct ScaleProfile {
+    std::string name = "Shape100";
+    uint32_t advertIntervalMs = 100;
+    uint32_t awakeMs = 50000;           // scale powers its radio down this long after the step-on
+    uint32_t connectMs = 400;
+    uint32_t discoveryMs = 60;          // per getService()/getCharacteristic()/getDescriptor() round trip
+    uint32_t gattOpMs = 30;             // read, write or subscribe round trip
+    uint32_t disconnectMs = 150;        // link termination until the host reports the disconnect
+    uint32_t measurementDelayMs = 4000; // from subscribe until the indication arrives
+    uint32_t historyFrameMs = 40;       // spacing of stored measurements sent after a user consent
+    size_t historyCapacity = 30;        // stored measurements kept, the oldest is overwritten
+    uint16_t handleShift = 0;           // moves every attribute, as a firmware update of the scale could
+    bool connectFails = false;
+};
+
+inline ScaleProfile scaleProfile;
+
+// value handles of the Shape100; ble_scan_result.txt lists the declarations one below,
+// the CCCD of an indicating characteristic follows its value
+constexpr uint16_t USER_CONTROL_POINT_HANDLE = 44;
+constexpr uint16_t BODY_COMPOSITION_HANDLE = 50;
+constexpr uint16_t BATTERY_LEVEL_HANDLE = 54;
+constexpr uint16_t CURRENT_TIME_HANDLE = 59;
+
+inline uint16_t attributeHandle(uint16_t handle) {
+    return handle + scaleProfile.handleShift;
+}
+
+// a recorded session played back instead of the scale model (native/bench/ble_replay.h): the
+// adverts the host heard and the frames the scale indicated, at their recorded offsets. The
+// model still serves the GATT round trips
+struct ScaleScript {
+    std::string address;              // empty: the model's
+    std::vector<uint8_t> advert;      // payload of the recorded adverts
+    std::vector<uint64_t> advertsUs;  // after the step-on
+    bool modelAdverts = false;        // none was heard before the link (a direct connect), the model's reach the host
+    bool directConnect = false;       // the step-on advert answers a pending direct connect, in its scan window or not
+    uint32_t connectMs = 0;           // 0: the model's
+    uint64_t awakeUs = 0;             // after the step-on
+    std::vector<std::pair<uint64_t, std::vector<uint8_t>>> frames; // us after the subscription
+};
+
+struct Scale {
+    bool awake = false;
+    uint64_t sleepAtUs = 0;
+    uint64_t stepOnUs = 0;
+    uint32_t session = 0; // invalidates events of earlier sessions
+    NimBLEClient *client = nullptr;
+    NimBLEClient *initiator = nullptr;  // pending direct connect, answered by the next advert
+    NimBLEClient *connecting = nullptr; // direct connect that is being established
+    uint32_t connectAttempt = 0;        // invalidates events of earlier direct connects
+    std::set<uint16_t> indicating;      // value handles whose CCCD enables indications
+    bool measuring = false;             // the live measurement of this session is taken or pending
+    std::vector<uint8_t> frame;
+    uint8_t battery = 87;
+    std::vector<std::vector<uint8_t>> history; // stored measurements, the live one is appended
+    std::map<uint8_t, uint16_t> consentCodes;  // registered users
+    bool scripted = false;                     // this session plays `script`
+    ScaleScript script;
+};
+
+// identical scales in different rooms, told apart by their address only
+constexpr size_t SCALE_SLOTS = 8;
+inline Scale scales[SCALE_SLOTS];
+inline Scale &scale = scales[0]; // the scale of the single-scale suites
+inline uint32_t clientsCreated = 0; // NimBLEDevice::createClient() calls
+inline uint32_t advertDelayState = 1;
+inline size_t maxConnections = CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+inline size_t peakConnections = 0; // most links held at once
+inline NimBLEScan scan;
+inline ble_gap_event_listener *gapListeners = nullptr;
+
+inline size_t indexOf(const Scale &s) {
+    return &s - scales;
+}
+
+// 00:a0:50:5e:b9:64 for the first scale, the next ones count up
+inline std::string macOf(const Scale &s) {
+    if (s.scripted && !s.script.address.empty()) {
+        return s.script.address;
+    }
+    char mac[18];
+    snprintf(mac, sizeof(mac), "00:a0:50:5e:b9:%02x", unsigned(0x64 + indexOf(s)));
+    return mac;
+}
+
+inline Scale *scaleAt(const NimBLEAddress &address) {
+    for (Scale &s : scales) {
+        if (address == NimBLEAddress(macOf(s))) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+inline Scale *scaleOn(const NimBLEClient *client) {
+    for (Scale &s : scales) {
+        if (client && s.client == client) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+inline size_t connectionCount() {
+    size_t count = 0;
+    for (const Scale &s : scales) {
+        count += s.client ? 1 : 0;
+    }
+    return count;
+}
+
+// the controller runs one connection procedure at a time
+inline bool connectPending() {
+    for (const Scale &s : scales) {
+        if (s.initiator || s.connecting) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the attribute database, discovered on the first getService() of a connection
+inline void discoverServices(Scale &s, NimBLEClient *client) {
+    NimBLERemoteCharacteristic battery("2a19", attributeHandle(BATTERY_LEVEL_HANDLE), true, false, false);
+    battery.value_ = std::string(1, char(s.battery));
+    client->services_.emplace_back("180f", std::vector<NimBLERemoteCharacteristic>{battery});
+    client->services_.emplace_back("1805", std::vector<NimBLERemoteCharacteristic>{
+                                               {"2a2b", attributeHandle(CURRENT_TIME_HANDLE), true, true, false}});
+    client->services_.emplace_back("181b", std::vector<NimBLERemoteCharacteristic>{
+                                               {"2a9c", attributeHandle(BODY_COMPOSITION_HANDLE), false, false, true}});
+    client->services_.emplace_back("181c", std::vector<NimBLERemoteCharacteristic>{
+                                               {"2a9f", attributeHandle(USER_CONTROL_POINT_HANDLE), false, true, true}});
+    for (auto &service : client->services_) {
+        for (auto &characteristic : service.characteristics()) {
+            characteristic.client_ = client;
+        }
+    }
+}
+
+inline void buildConnection(Scale &s, NimBLEClient *client, bool deleteAttributes = true) {
+    if (deleteAttributes) {
+        client->services_.clear();
+    }
+    client->connected_ = true;
+    client->connHandle_ = uint16_t(indexOf(s) + 1);
+    client->peer_ = NimBLEAddress(macOf(s));
+    s.client = client;
+    s.indicating.clear();
+    peakConnections = std::max(peakConnections, connectionCount());
+}
+
+inline void scheduleAdvert(Scale &s, uint32_t session);
+
+inline uint32_t connectMsOf(const Scale &s) {
+    return s.scripted && s.script.connectMs ? s.script.connectMs : scaleProfile.connectMs;
+}
+
+inline void establishDirectConnect(Scale &s, NimBLEClient *client, uint32_t session, uint32_t attempt) {
+    if (s.connecting != client || s.connectAttempt != attempt) {
+        scheduleAdvert(s, session); // cancelled, the scale keeps advertising
+        return;
+    }
+    s.connecting = nullptr;
+    if (session != s.session || !s.awake || scaleProfile.connectFails || connectionCount() >= maxConnections) {
+        scheduleAdvert(s, session);
+        if (client->callbacks_) {
+            onHostTask([&] { client->callbacks_->onConnectFail(client, BLE_HS_ETIMEOUT); });
+        }
+        return;
+    }
+    buildConnection(s, client, client->deleteAttributes_);
+    if (client->callbacks_) {
+        onHostTask([&] { client->callbacks_->onConnect(client); });
+    }
+}
+
+inline void advertise(Scale &s, uint32_t session) {
+    if (session != s.session || !s.awake || s.client || s.connecting) {
+        return;
+    }
+    if (s.initiator) {
+        // the controller answers the advert with a connect request, no scan result reaches the host
+        NimBLEClient *client = s.initiator;
+        bool recorded = s.scripted && s.script.directConnect && nowUs == s.stepOnUs; // the capture has the link
+        if (!recorded && !inScanWindow(client->connectStartedUs_, client->scanWindow_ * 625ULL, client->scanInterval_ * 625ULL)) {
+            scheduleAdvert(s, session);
+            return;
+        }
+        uint32_t attempt = s.connectAttempt;
+        s.initiator = nullptr;
+        s.connecting = client;
+        Scale *target = &s;
+        afterMs(connectMsOf(s), [target, client, session, attempt] { establishDirectConnect(*target, client, session, attempt); });
+        return;
+    }
+    if (!s.scripted || s.script.modelAdverts) {
+        scan.report(NimBLEAdvertisedDevice(scaleProfile.name, macOf(s)));
+    }
+    scheduleAdvert(s, session);
+}
+
+// the advertising interval plus the 0-10 ms random advDelay of the BLE spec, which keeps the
+// adverts from locking onto the windows of a duty-cycled scan
+inline void scheduleAdvert(Scale &s, uint32_t session) {
+    advertDelayState = advertDelayState * 1103515245u + 12345u;
+    uint64_t delayUs = uint64_t(scaleProfile.advertIntervalMs) * 1000 + (advertDelayState >> 16) % 10001;
+    Scale *target = &s;
+    at(nowUs + delayUs, [target, session] { advertise(*target, session); });
+}
+
+inline void dropLink(Scale &s, int reason) {
+    NimBLEClient *client = s.client;
+    client->connected_ = false;
+    s.client = nullptr;
+    if (client->callbacks_) {
+        onHostTask([&] { client->callbacks_->onDisconnect(client, reason); });
+    }
+}
+
+inline void sleepScale(Scale &s, uint32_t session) {
+    if (session != s.session) {
+        return;
+    }
+    s.awake = false;
+    if (s.client) {
+        dropLink(s, BLE_HS_ETIMEOUT); // supervision timeout
+    }
+}
+
+// the user steps on scale `index`: it wakes up, starts advertising and will indicate `frame`
+inline void stepOn(const std::vector<uint8_t> &frame, size_t index = 0) {
+    Scale &s = scales[index];
+    s.session++;
+    s.awake = true;
+    s.measuring = false;
+    s.scripted = false;
+    s.stepOnUs = nowUs;
+    s.sleepAtUs = nowUs + uint64_t(scaleProfile.awakeMs) * 1000;
+    s.frame = frame;
+    uint32_t session = s.session;
+    Scale *target = &s;
+    at(s.sleepAtUs, [target, session] { sleepScale(*target, session); });
+    advertise(s, session);
+}
+
+// scale `index` plays a recorded session from now on, see ScaleScript
+inline void playSession(const ScaleScript &script, size_t index = 0) {
+    Scale &s = scales[index];
+    s.session++;
+    s.awake = true;
+    s.measuring = false;
+    s.scripted = true;
+    s.script = script;
+    s.stepOnUs = nowUs;
+    s.sleepAtUs = nowUs + script.awakeUs;
+    s.frame.clear();
+    uint32_t session = s.session;
+    Scale *target = &s;
+    at(s.sleepAtUs, [target, session] { sleepScale(*target, session); });
+    for (uint64_t offsetUs : script.advertsUs) {
+        at(nowUs + offsetUs, [target, session] {
+            Scale &s = *target;
+            if (session == s.session && s.awake && !s.client) {
+                scan.deliver(NimBLEAdvertisedDevice(macOf(s), s.script.advert));
+            }
+        });
+    }
+    advertise(s, session);
+}
+
+constexpr size_t FRAME_TIME_OFFSET = 4;     // after flags and fat percentage
+constexpr size_t FRAME_USER_ID_OFFSET = 11; // flags, fat and timestamp precede the user ID
+
+// the scale stamps a measurement with its own clock, which the firmware set at connect
+inline void stampFrame(std::vector<uint8_t> &frame) {
+    if (frame.size() <= FRAME_USER_ID_OFFSET) {
+        return;
+    }
+    time_t now = wallTime(nullptr);
+    struct tm t;
+    gmtime_r(&now, &t);
+    uint16_t year = t.tm_year + 1900;
+    uint8_t *p = frame.data() + FRAME_TIME_OFFSET;
+    p[0] = year & 0xFF;
+    p[1] = year >> 8;
+    p[2] = t.tm_mon + 1;
+    p[3] = t.tm_mday;
+    p[4] = t.tm_hour;
+    p[5] = t.tm_min;
+    p[6] = t.tm_sec;
+}
+
+inline NimBLERemoteCharacteristic *findCharacteristic(Scale &s, uint16_t handle) {
+    if (!s.client) {
+        return nullptr;
+    }
+    for (auto &service : s.client->services_) {
+        for (auto &characteristic : service.characteristics()) {
+            if (characteristic.getHandle() == handle) {
+                return &characteristic;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// like the NimBLE host: every GAP listener sees the indication, then the client
+// hands it to the characteristic it discovered for the handle, if any
+inline void indicate(Scale &s, uint16_t handle, uint32_t session, std::vector<uint8_t> data) {
+    if (session != s.session || !s.client || !s.indicating.count(handle)) {
+        return;
+    }
+    for (ble_gap_event_listener *listener = gapListeners; listener; listener = listener->next) {
+        os_mbuf om{data};
+        ble_gap_event event{};
+        event.type = BLE_GAP_EVENT_NOTIFY_RX;
+        event.notify_rx.om = &om;
+        event.notify_rx.conn_handle = s.client->getConnHandle();
+        event.notify_rx.attr_handle = handle;
+        event.notify_rx.indication = 1;
+        onHostTask([&] { listener->fn(&event, listener->arg); });
+    }
+    NimBLERemoteCharacteristic *characteristic = findCharacteristic(s, handle);
+    if (characteristic && characteristic->callback_) {
+        onHostTask([&] { characteristic->callback_(characteristic, data.data(), data.size(), false); });
+    }
+}
+
+// the frames of a recorded session, at their offsets after the subscription
+inline void playFrames(Scale &s, uint16_t handle) {
+    uint32_t session = s.session;
+    Scale *target = &s;
+    for (size_t i = 0; i < s.script.frames.size(); i++) {
+        at(nowUs + s.script.frames[i].first, [target, handle, session, i] {
+            Scale &s = *target;
+            if (session != s.session) {
+                return;
+            }
+            s.history.push_back(s.script.frames[i].second);
+            if (s.history.size() > scaleProfile.historyCapacity) {
+                s.history.erase(s.history.begin());
+            }
+            indicate(s, handle, session, s.script.frames[i].second);
+        });
+    }
+}
+
+inline void enableIndications(Scale &s, uint16_t handle) {
+    if (!s.indicating.insert(handle).second || handle != attributeHandle(BODY_COMPOSITION_HANDLE) || s.measuring) {
+        return;
+    }
+    s.measuring = true; // one measurement per step-on, a reconnect only gets the stored ones
+    if (s.scripted) {
+        playFrames(s, handle);
+        return;
+    }
+    // the live measurement, stored by the scale once it is taken
+    uint32_t session = s.session;
+    Scale *target = &s;
+    afterMs(scaleProfile.measurementDelayMs, [target, handle, session] {
+        Scale &s = *target;
+        if (session == s.session) {
+            stampFrame(s.frame);
+            s.history.push_back(s.frame);
+            if (s.history.size() > scaleProfile.historyCapacity) {
+                s.history.erase(s.history.begin());
+            }
+        }
+        indicate(s, handle, session, s.frame);
+    });
+}
+
+// User Data Service consent: answer on the control point, then send the user's stored measurements
+inline void userControlPoint(Scale &s, const uint8_t *data, size_t length) {
+    if (length < 4 || data[0] != 0x02) {
+        return;
+    }
+    uint8_t user = data[1];
+    uint16_t code = data[2] | (data[3] << 8);
+    auto it = s.consentCodes.find(user);
+    bool ok = it != s.consentCodes.end() && it->second == code;
+    uint32_t session = s.session;
+    uint16_t ucp = attributeHandle(USER_CONTROL_POINT_HANDLE);
+    Scale *target = &s;
+    afterMs(scaleProfile.gattOpMs, [target, ucp, session, ok] { indicate(*target, ucp, session, {0x20, 0x02, uint8_t(ok ? 0x01 : 0x05)}); });
+    if (!ok) {
+        return;
+    }
+    uint16_t bcm = attributeHandle(BODY_COMPOSITION_HANDLE);
+    uint32_t delayMs = scaleProfile.gattOpMs;
+    for (const auto &record : s.history) {
+        if (record.size() > FRAME_USER_ID_OFFSET && record[FRAME_USER_ID_OFFSET] == user) {
+            delayMs += scaleProfile.historyFrameMs;
+            afterMs(delayMs, [target, bcm, session, record] { indicate(*target, bcm, session, record); });
+        }
+    }
+}
+
+// ATT server of the scale, returns 0 or an ATT error in NimBLE's BLE_HS_ERR_ATT_BASE range
+inline int readAttribute(Scale &s, uint16_t handle, std::vector<uint8_t> &out) {
+    if (handle == attributeHandle(BATTERY_LEVEL_HANDLE)) {
+        out = {s.battery};
+        return 0;
+    }
+    if (handle == attributeHandle(CURRENT_TIME_HANDLE)) {
+        out.assign(10, 0);
+        return 0;
+    }
+    return BLE_HS_ERR_ATT_BASE + BLE_ATT_ERR_INVALID_HANDLE;
+}
+
+inline int writeAttribute(Scale &s, uint16_t handle, const uint8_t *data, size_t length) {
+    if (handle == attributeHandle(CURRENT_TIME_HANDLE)) {
+        return 0;
+    }
+    if (handle == attributeHandle(USER_CONTROL_POINT_HANDLE)) {
+        userControlPoint(s, data, length);
+        return 0;
+    }
+    for (uint16_t value : {BODY_COMPOSITION_HANDLE, USER_CONTROL_POINT_HANDLE}) {
+        if (handle == attributeHandle(value) + 1) {
+            if (length >= 1 && (data[0] & 0x02)) {
+                enableIndications(s, attributeHandle(value));
+            }
+            return 0;
+        }
+    }
+    return BLE_HS_ERR_ATT_BASE + BLE_ATT_ERR_INVALID_HANDLE;
+}
+
+// completes a handle-based GATT operation one round trip later, like the host task would
+inline int gattOperation(uint16_t connHandle, uint16_t handle, ble_gatt_attr_fn *cb, void *arg,
+                         std::function<int(Scale &, std::vector<uint8_t> &)> serve) {
+    if (connHandle == 0 || connHandle > SCALE_SLOTS || !scales[connHandle - 1].client) {
+        return BLE_HS_ENOTCONN;
+    }
+    Scale *target = &scales[connHandle - 1];
+    uint32_t session = target->session;
+    afterMs(bleDelayMs(scaleProfile.gattOpMs), [target, connHandle, handle, cb, arg, serve, session] {
+        os_mbuf om;
+        ble_gatt_error error{0, handle};
+        if (session != target->session || !target->client) {
+            error.status = BLE_HS_ENOTCONN;
+        } else {
+            error.status = serve(*target, om.data);
+        }
+        ble_gatt_attr attr{handle, 0, error.status == 0 ? &om : nullptr};
+        if (cb) {
+            cb(connHandle, &error, &attr, arg);
+        }
+    });
+    return 0;
+}
+
+} // namespace fake
+
+inline int ble_gap_event_listener_register(ble_gap_event_listener *listener, ble_gap_event_fn *fn, void *arg) {
+    for (ble_gap_event_listener *it = fake::gapListeners; it; it = it->next) {
+        if (it == listener) {
+            return BLE_HS_EALREADY;
+        }
+    }
+    listener->fn = fn;
+    listener->arg = arg;
+    listener->next = fake::gapListeners;
+    fake::gapListeners = listener;
+    return 0;
+}
+
+inline int ble_gattc_read(uint16_t conn_handle, uint16_t attr_handle, ble_gatt_attr_fn *cb, void *cb_arg) {
+    return fake::gattOperation(conn_handle, attr_handle, cb, cb_arg, [attr_handle](fake::Scale &s, std::vector<uint8_t> &out) {
+        return fake::readAttribute(s, attr_handle, out);
+    });
+}
+
+inline int ble_gattc_write_flat(uint16_t conn_handle, uint16_t attr_handle, const void *data, uint16_t data_len,
+                                ble_gatt_attr_fn *cb, void *cb_arg) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    std::vector<uint8_t> value(bytes, bytes + data_len);
+    return fake::gattOperation(conn_handle, attr_handle, cb, cb_arg, [attr_handle, value](fake::Scale &s, std::vector<uint8_t> &) {
+        return fake::writeAttribute(s, attr_handle, value.data(), value.size());
+    });
+}
+
+inline std::string NimBLERemoteCharacteristic::readValue() {
+    fake::bleRoundTripMs(fake::scaleProfile.gattOpMs);
+    std::vector<uint8_t> value;
+    fake::Scale *s = fake::scaleOn(client_);
+    if (s && fake::readAttribute(*s, handle_, value) == 0) {
+        value_.assign(value.begin(), value.end());
+    }
+    return value_;
+}
+
+inline bool NimBLERemoteCharacteristic::writeValue(const uint8_t *data, size_t length, bool response) {
+    if (response) {
+        fake::bleRoundTripMs(fake::scaleProfile.gattOpMs);
+    }
+    value_.assign(reinterpret_cast<const char *>(data), length);
+    fake::Scale *s = fake::scaleOn(client_);
+    return s && fake::writeAttribute(*s, handle_, data, length) == 0;
+}
+
+inline bool NimBLERemoteCharacteristic::subscribe(bool notifications, notify_callback callback, bool response) {
+    fake::bleRoundTripMs(fake::scaleProfile.gattOpMs);
+    callback_ = callback;
+    fake::Scale *s = fake::scaleOn(client_);
+    if (s) {
+        fake::enableIndications(*s, handle_);
+    }
+    return s != nullptr;
+}
+
+inline NimBLERemoteDescriptor *NimBLERemoteCharacteristic::getDescriptor(const NimBLEUUID &uuid) {
+    fake::bleRoundTripMs(fake::scaleProfile.discoveryMs);
+    return indicate_ && uuid == NimBLEUUID("2902") ? &cccd_ : nullptr;
+}
+
+inline NimBLERemoteCharacteristic *NimBLERemoteService::getCharacteristic(const NimBLEUUID &uuid) {
+    fake::bleRoundTripMs(fake::scaleProfile.discoveryMs);
+    for (auto &characteristic : characteristics_) {
+        if (characteristic.getUUID() == uuid) {
+            return &characteristic;
+        }
+    }
+    return nullptr;
+}
+
+inline bool NimBLEClient::connect(NimBLEAdvertisedDevice *device, bool deleteAttributes) {
+    return connect(device->getAddress(), deleteAttributes);
+}
+
+// the blocking form connects to the advertising scale; the asynchronous one waits for its
+// next advert and reports through the client callbacks. Like NimBLE-Arduino, the blocking
+// form stops a running scan, the controller cannot scan and initiate at once
+inline bool NimBLEClient::connect(const NimBLEAddress &address, bool deleteAttributes, bool asyncConnect,
+                                  bool exchangeMTU) {
+    fake::Scale *s = fake::scaleAt(address);
+    if (!asyncConnect) {
+        if (connected_ || fake::connectPending()) {
+            return false;
+        }
+        fake::scan.stop();
+        fake::bleRoundTripMs(s ? fake::connectMsOf(*s) : fake::scaleProfile.connectMs);
+        if (!s || !s->awake || s->client || fake::scaleProfile.connectFails || fake::connectionCount() >= fake::maxConnections) {
+            return false;
+        }
+        fake::buildConnection(*s, this, deleteAttributes);
+        return true;
+    }
+    if (connected_ || fake::connectPending()) {
+        return false;
+    }
+    deleteAttributes_ = deleteAttributes;
+    connectStartedUs_ = fake::nowUs;
+    uint32_t attempt = 0;
+    if (s) {
+        attempt = ++s->connectAttempt;
+        s->initiator = this;
+    }
+    NimBLEClient *self = this;
+    fake::afterMs(connectTimeoutMs_, [self, s, attempt] {
+        if (s && s->initiator == self && s->connectAttempt == attempt) {
+            s->initiator = nullptr;
+            if (self->callbacks_) {
+                fake::onHostTask([&] { self->callbacks_->onConnectFail(self, BLE_HS_ETIMEOUT); });
+            }
+        }
+    });
+    return true;
+}
+
+inline bool NimBLEClient::cancelConnect() {
+    for (fake::Scale &s : fake::scales) {
+        if (s.initiator == this || s.connecting == this) {
+            s.initiator = nullptr;
+            s.connecting = nullptr;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool NimBLEClient::disconnect() {
+    if (connected_) {
+        fake::bleRoundTripMs(fake::scaleProfile.disconnectMs);
+    }
+    bool wasConnected = connected_;
+    connected_ = false;
+    if (fake::Scale *s = fake::scaleOn(this)) {
+        s->client = nullptr;
+        fake::scheduleAdvert(*s, s->session); // advertises again until it powers down
+    }
+    if (wasConnected && callbacks_) {
+        fake::onHostTask([&] { callbacks_->onDisconnect(this, 0); });
+    }
+    return true;
+}
+
+inline NimBLERemoteService *NimBLEClient::getService(const NimBLEUUID &uuid) {
+    fake::bleRoundTripMs(fake::scaleProfile.discoveryMs);
+    fake::Scale *s = fake::scaleOn(this);
+    if (services_.empty() && connected_ && s) {
+        fake::discoverServices(*s, this);
+    }
+    for (auto &service : services_) {
+        if (service.getUUID() == uuid) {
+            return &service;
+        }
+    }
+    return nullptr;
+}
+
+class NimBLEDevice {
+  public:
+    static bool init(const std::string &deviceName) { return true; }
+    static bool setPower(int powerLevel) { return true; }
+    static NimBLEScan *getScan() { return &fake::scan; }
+    static NimBLEClient *createClient() {
+        fake::clientsCreated++;
+        return new NimBLEClient();
+    }
+    static bool deleteClient(NimBLEClient *client) {
+        client->cancelConnect();
+        if (fake::Scale *s = fake::scaleOn(client)) {
+            s->client = nullptr;
+            fake::scheduleAdvert(*s, s->session);
+        }
+        delete client;
+        return true;
+    }
+};
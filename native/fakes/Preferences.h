@@ -0,0 +1,79 @@
+#pragma once
+
+// Host-side stand-in for the ESP32 Preferences (NVS) library; survives fake reboots.
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace fake {
+
+inline std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs;
+inline uint32_t nvsWrites = 0;
+inline uint64_t nvsEntries = 0; // 32 byte NVS entries written, for flash wear estimates
+
+constexpr size_t NVS_ENTRY_SIZE = 32;
+constexpr size_t NVS_ENTRIES_PER_PAGE = 126; // 4096 byte page, minus header and entry state bitmap
+
+} // namespace fake
+
+class Preferences {
+  public:
+    bool begin(const char *name, bool readOnly = false) {
+        namespace_ = name;
+        return true;
+    }
+    void end() {}
+
+    bool isKey(const char *key) {
+        auto &space = fake::nvs[namespace_];
+        return space.find(key) != space.end();
+    }
+    bool remove(const char *key) { return fake::nvs[namespace_].erase(key) > 0; }
+    bool clear() {
+        fake::nvs[namespace_].clear();
+        return true;
+    }
+
+    size_t putBytes(const char *key, const void *value, size_t length) {
+        auto bytes = static_cast<const uint8_t *>(value);
+        fake::nvs[namespace_][key].assign(bytes, bytes + length);
+        fake::nvsWrites++;
+        // blob index and chunk header, then the data in whole entries
+        fake::nvsEntries += 2 + (length + fake::NVS_ENTRY_SIZE - 1) / fake::NVS_ENTRY_SIZE;
+        return length;
+    }
+    size_t getBytes(const char *key, void *buffer, size_t maxLength) {
+        auto &space = fake::nvs[namespace_];
+        auto it = space.find(key);
+        if (it == space.end()) {
+            return 0;
+        }
+        size_t length = std::min(maxLength, it->second.size());
+        memcpy(buffer, it->second.data(), length);
+        return length;
+    }
+    size_t getBytesLength(const char *key) {
+        auto &space = fake::nvs[namespace_];
+        auto it = space.find(key);
+        return it == space.end() ? 0 : it->second.size();
+    }
+
+    size_t putUInt(const char *key, uint32_t value) {
+        auto bytes = reinterpret_cast<const uint8_t *>(&value);
+        fake::nvs[namespace_][key].assign(bytes, bytes + sizeof(value));
+        fake::nvsWrites++;
+        fake::nvsEntries++; // integers live in the entry itself
+        return sizeof(value);
+    }
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0) {
+        uint32_t value = defaultValue;
+        getBytes(key, &value, sizeof(value));
+        return value;
+    }
+
+  private:
+    std::string namespace_;
+};
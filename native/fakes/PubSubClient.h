@@ -0,0 +1,256 @@
+#pragma once
+
+// Host-side PubSubClient stand-in; publishes are recorded in fake::published.
+// Packets written through write() reach a fake broker that answers QoS 1
+// publishes with a PUBACK on the socket after network.brokerRttMs. loop() keeps
+// the connection alive like the real one: a PINGREQ once the keep-alive passed
+// without traffic, and MQTT_CONNECTION_TIMEOUT if it passes again before loop()
+// read the PINGRESP.
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTTPINGRESP (13 << 4)
+
+namespace fake {
+
+struct Publish {
+    uint64_t atUs;
+    std::string topic;
+    std::string payload;
+    bool retained;
+    uint8_t qos;
+};
+
+inline std::vector<Publish> published;
+inline bool recordPublishes = true; // off for allocation counts, `published` and the PUBACK events allocate
+inline uint32_t publishCount = 0;
+inline uint32_t failWrite = 0; // the write() that takes nothing, counted from 1, 0 for none
+inline uint32_t mqttConnects = 0; // connections the broker accepted
+inline uint32_t pingRequests = 0;
+
+// called for every publish, lets the bench driver react without scanning `published`
+inline std::function<void(const Publish &)> onPublish;
+
+} // namespace fake
+
+class PubSubClient {
+  public:
+    explicit PubSubClient(WiFiClient &client) : client_(client) {}
+
+    bool setBufferSize(uint16_t size) {
+        bufferSize_ = size;
+        return true;
+    }
+    PubSubClient &setServer(const char *domain, uint16_t port) { return *this; }
+    PubSubClient &setSocketTimeout(uint16_t timeout) { return *this; }
+    PubSubClient &setKeepAlive(uint16_t keepAlive) {
+        keepAliveS_ = keepAlive;
+        return *this;
+    }
+
+    bool connect(const char *id, const char *user, const char *pass) {
+        fake::advanceMs(fake::network.mqttConnectMs);
+        dropConnection();
+        if (WiFi.status() != WL_CONNECTED || !fake::network.brokerAvailable) {
+            state_ = MQTT_CONNECT_FAILED;
+            return false;
+        }
+        client_.open();
+        state_ = MQTT_CONNECTED;
+        fake::mqttConnects++;
+        lastInActivity_ = lastOutActivity_ = millis();
+        pingOutstanding_ = false;
+        return true;
+    }
+    void disconnect() {
+        dropConnection();
+        state_ = MQTT_DISCONNECTED;
+    }
+    bool connected() {
+        if (state_ == MQTT_CONNECTED && WiFi.status() != WL_CONNECTED) {
+            dropConnection();
+            state_ = MQTT_CONNECTION_TIMEOUT;
+        } else if (state_ == MQTT_CONNECTED && !client_.connected()) {
+            dropConnection();
+            state_ = MQTT_CONNECTION_LOST;
+        }
+        return state_ == MQTT_CONNECTED;
+    }
+    int state() const { return state_; }
+
+    // like the real loop(): the keep-alive, then one packet from the socket; a PINGRESP ends
+    // the outstanding ping, a PUBACK is dropped
+    bool loop() {
+        if (!connected()) {
+            return false;
+        }
+        unsigned long now = millis();
+        if (now - lastInActivity_ > keepAliveS_ * 1000UL || now - lastOutActivity_ > keepAliveS_ * 1000UL) {
+            if (pingOutstanding_) {
+                dropConnection();
+                state_ = MQTT_CONNECTION_TIMEOUT;
+                return false;
+            }
+            ping();
+            lastInActivity_ = lastOutActivity_ = now;
+            pingOutstanding_ = true;
+        }
+        if (client_.available() > 0) {
+            uint8_t header = client_.read();
+            size_t remaining = 0;
+            for (uint8_t shift = 0;; shift += 7) {
+                int digit = client_.read();
+                if (digit < 0) {
+                    return true;
+                }
+                remaining |= size_t(digit & 0x7F) << shift;
+                if (!(digit & 0x80)) {
+                    break;
+                }
+            }
+            while (remaining-- > 0 && client_.read() >= 0) {
+            }
+            lastInActivity_ = now;
+            if (header == MQTTPINGRESP) {
+                pingOutstanding_ = false;
+            }
+        }
+        return true;
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained = false) {
+        return publish(topic, reinterpret_cast<const uint8_t *>(payload), strlen(payload), retained);
+    }
+
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained = false) {
+        if (!connected() || strlen(topic) + length + 7 > bufferSize_) {
+            return false;
+        }
+        lastOutActivity_ = millis();
+        deliver(topic, strlen(topic), payload, length, retained, 0, 0);
+        return true;
+    }
+
+    // raw packets for the connection, parsed by the broker once complete
+    size_t write(const uint8_t *data, size_t length) {
+        if (fake::failWrite > 0 && --fake::failWrite == 0) {
+            return 0;
+        }
+        if (!connected() || txLength_ + length > sizeof(tx_)) {
+            return 0;
+        }
+        memcpy(tx_ + txLength_, data, length);
+        txLength_ += length;
+        lastOutActivity_ = millis();
+        parsePackets();
+        return length;
+    }
+
+  private:
+    void dropConnection() {
+        connection_++;
+        txLength_ = 0;
+        client_.stop();
+    }
+
+    void parsePackets() {
+        while (txLength_ >= 2) {
+            size_t remaining = 0;
+            size_t at = 1;
+            for (uint8_t shift = 0; at < txLength_; shift += 7) {
+                uint8_t digit = tx_[at++];
+                remaining |= size_t(digit & 0x7F) << shift;
+                if (!(digit & 0x80)) {
+                    break;
+                }
+            }
+            if (at + remaining > txLength_) {
+                return;
+            }
+            const uint8_t *body = tx_ + at;
+            uint8_t header = tx_[0];
+            if ((header >> 4) == 3) {
+                uint8_t qos = (header >> 1) & 0x03;
+                size_t topicLength = (body[0] << 8) | body[1];
+                size_t payloadAt = 2 + topicLength + (qos ? 2 : 0);
+                uint16_t packetId = qos ? (body[2 + topicLength] << 8) | body[3 + topicLength] : 0;
+                deliver(reinterpret_cast<const char *>(body + 2), topicLength, body + payloadAt, remaining - payloadAt,
+                        header & 0x01, qos, packetId);
+            }
+            memmove(tx_, tx_ + at + remaining, txLength_ - at - remaining);
+            txLength_ -= at + remaining;
+        }
+    }
+
+    // the broker gets the message unless the link loses it, and acknowledges a QoS 1 one
+    void deliver(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, bool retained, uint8_t qos,
+                 uint16_t packetId) {
+        fake::publishCount++;
+        if (fake::publishLost()) {
+            fake::lostPublishes++;
+            return;
+        }
+        if (qos) {
+            acknowledge(packetId);
+        }
+        if (!fake::recordPublishes) {
+            return;
+        }
+        fake::published.push_back({fake::nowUs, std::string(topic, topicLength),
+                                   std::string(reinterpret_cast<const char *>(payload), length), retained, qos});
+        if (fake::onPublish) {
+            fake::onPublish(fake::published.back());
+        }
+    }
+
+    void ping() {
+        static constexpr uint8_t pingresp[2] = {MQTTPINGRESP, 0x00};
+        fake::pingRequests++;
+        if (!fake::recordPublishes) {
+            client_.receive(pingresp, sizeof(pingresp));
+            return;
+        }
+        uint32_t connection = connection_;
+        fake::afterMs(fake::network.brokerRttMs, [this, connection] {
+            if (connection == connection_) {
+                client_.receive(pingresp, sizeof(pingresp));
+            }
+        });
+    }
+
+    void acknowledge(uint16_t packetId) {
+        uint8_t puback[4] = {0x40, 0x02, uint8_t(packetId >> 8), uint8_t(packetId)};
+        if (!fake::recordPublishes) {
+            client_.receive(puback, sizeof(puback)); // no scheduled event, it would allocate
+            return;
+        }
+        uint32_t connection = connection_;
+        fake::afterMs(fake::network.brokerRttMs, [this, connection, puback] {
+            if (connection == connection_) {
+                client_.receive(puback, sizeof(puback));
+            }
+        });
+    }
+
+    WiFiClient &client_;
+    int state_ = MQTT_DISCONNECTED;
+    uint16_t bufferSize_ = 256;
+    uint32_t connection_ = 0; // a PUBACK of an earlier connection never arrives
+    uint16_t keepAliveS_ = 15; // MQTT_KEEPALIVE
+    unsigned long lastInActivity_ = 0;
+    unsigned long lastOutActivity_ = 0;
+    bool pingOutstanding_ = false;
+    uint8_t tx_[2048];
+    size_t txLength_ = 0;
+};
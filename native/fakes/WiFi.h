@@ -0,0 +1,102 @@
+#pragma once
+
+// Host-side WiFi stand-in driven by fake::network.
+
+#include <Arduino.h>
+
+enum wl_status_t {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6,
+};
+
+// the MQTT socket; the fake broker in PubSubClient.h queues what it sends here
+class WiFiClient {
+  public:
+    int available() { return int(rxCount_); }
+    int peek() { return rxCount_ == 0 ? -1 : rx_[rxHead_]; }
+    int read() {
+        if (rxCount_ == 0) {
+            return -1;
+        }
+        uint8_t byte = rx_[rxHead_];
+        rxHead_ = (rxHead_ + 1) % sizeof(rx_);
+        rxCount_--;
+        return byte;
+    }
+
+    void receive(const uint8_t *data, size_t length) {
+        for (size_t i = 0; i < length && rxCount_ < sizeof(rx_); i++) {
+            rx_[(rxHead_ + rxCount_++) % sizeof(rx_)] = data[i];
+        }
+    }
+    void clearReceived() { rxHead_ = rxCount_ = 0; }
+
+    // closes the socket under PubSubClient, which notices on its next connected()
+    void stop() {
+        open_ = false;
+        clearReceived();
+    }
+    uint8_t connected() { return open_; }
+    void open() { open_ = true; }
+
+  private:
+    bool open_ = false;
+    uint8_t rx_[1024];
+    size_t rxHead_ = 0;
+    size_t rxCount_ = 0;
+};
+
+class FakeWiFi {
+  public:
+    void begin(const char *ssid, const char *password) {
+        status_ = WL_DISCONNECTED;
+        fake::wifiAssociated = false;
+        uint32_t attempt = ++attempt_;
+        if (!fake::network.wifiAvailable) {
+            return;
+        }
+        fake::afterMs(fake::network.wifiAssociateMs, [this, attempt] {
+            if (attempt == attempt_ && fake::network.wifiAvailable) {
+                status_ = WL_CONNECTED;
+                fake::wifiAssociated = true;
+                syncClock(attempt);
+            }
+        });
+    }
+    bool disconnect(bool wifiOff = false) {
+        attempt_++;
+        status_ = WL_DISCONNECTED;
+        fake::wifiAssociated = false;
+        return true;
+    }
+    bool setSleep(bool enabled) { return true; }
+    wl_status_t status() const { return status_; }
+    IPAddress localIP() const { return IPAddress(); }
+
+  private:
+    // SNTP asks its server once the station is up
+    void syncClock(uint32_t attempt) {
+        if (!fake::sntpConfigured) {
+            return;
+        }
+        fake::afterMs(fake::network.ntpSyncMs, [this, attempt] {
+            if (attempt != attempt_ || status_ != WL_CONNECTED) {
+                return;
+            }
+            struct timeval tv = {fake::bootEpoch + int64_t(fake::nowUs / 1000000), 0}; // the true time
+            fake::setWallTime(&tv);
+            fake::sntpSyncs++;
+            if (fake::sntpCallback) {
+                fake::sntpCallback(&tv);
+            }
+        });
+    }
+
+    wl_status_t status_ = WL_IDLE_STATUS;
+    uint32_t attempt_ = 0;
+};
+
+inline FakeWiFi WiFi;
@@ -0,0 +1,109 @@
+#pragma once
+
+// Host-side stand-in for the ESP-IDF LEDC driver. A fade jumps straight to its target
+// duty; fake::ledcFades counts the fades started.
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+
+typedef enum {
+    LEDC_LOW_SPEED_MODE = 0,
+    LEDC_SPEED_MODE_MAX,
+} ledc_mode_t;
+
+typedef enum {
+    LEDC_CHANNEL_0 = 0,
+    LEDC_CHANNEL_MAX = 6,
+} ledc_channel_t;
+
+typedef enum {
+    LEDC_TIMER_0 = 0,
+    LEDC_TIMER_MAX = 4,
+} ledc_timer_t;
+
+typedef enum {
+    LEDC_TIMER_8_BIT = 8,
+} ledc_timer_bit_t;
+
+typedef enum {
+    LEDC_AUTO_CLK = 0,
+    LEDC_USE_APB_CLK,
+    LEDC_USE_RTC8M_CLK,
+    LEDC_USE_XTAL_CLK,
+} ledc_clk_cfg_t;
+
+typedef enum {
+    LEDC_INTR_DISABLE = 0,
+    LEDC_INTR_FADE_END,
+} ledc_intr_type_t;
+
+typedef struct {
+    ledc_mode_t speed_mode;
+    ledc_timer_bit_t duty_resolution;
+    ledc_timer_t timer_num;
+    uint32_t freq_hz;
+    ledc_clk_cfg_t clk_cfg;
+} ledc_timer_config_t;
+
+typedef struct {
+    int gpio_num;
+    ledc_mode_t speed_mode;
+    ledc_channel_t channel;
+    ledc_intr_type_t intr_type;
+    ledc_timer_t timer_sel;
+    uint32_t duty;
+    int hpoint;
+} ledc_channel_config_t;
+
+typedef enum {
+    LEDC_FADE_NO_WAIT = 0,
+    LEDC_FADE_WAIT_DONE,
+    LEDC_FADE_MAX,
+} ledc_fade_mode_t;
+
+namespace fake {
+
+inline uint32_t ledcFades = 0;
+inline uint32_t ledcFadeTarget = 0;
+
+} // namespace fake
+
+inline esp_err_t ledc_timer_config(const ledc_timer_config_t *config) {
+    return 0;
+}
+
+inline esp_err_t ledc_channel_config(const ledc_channel_config_t *config) {
+    fake::ledcDuty = config->duty;
+    return 0;
+}
+
+inline esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty) {
+    fake::ledcDuty = duty;
+    return 0;
+}
+
+inline esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel) {
+    fake::ledcWrites++;
+    return 0;
+}
+
+inline esp_err_t ledc_fade_func_install(int intr_alloc_flags) {
+    return 0;
+}
+
+inline esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms) {
+    fake::ledcFadeTarget = target_duty;
+    return 0;
+}
+
+// the fake's fade is over as soon as it starts, nothing to stop
+inline esp_err_t ledc_fade_stop(ledc_mode_t speed_mode, ledc_channel_t channel) {
+    return 0;
+}
+
+inline esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode) {
+    fake::ledcFades++;
+    fake::ledcDuty = fake::ledcFadeTarget;
+    return 0;
+}
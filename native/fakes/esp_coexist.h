@@ -0,0 +1,16 @@
+#pragma once
+
+// Host-side stand-in for the ESP-IDF BLE/WiFi coexistence API.
+
+typedef enum {
+    ESP_COEX_PREFER_WIFI = 0,
+    ESP_COEX_PREFER_BT,
+    ESP_COEX_PREFER_BALANCE,
+    ESP_COEX_PREFER_NUM,
+} esp_coex_prefer_t;
+
+typedef int esp_err_t;
+
+inline esp_err_t esp_coex_preference_set(esp_coex_prefer_t prefer) {
+    return 0;
+}
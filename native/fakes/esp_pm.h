@@ -0,0 +1,25 @@
+#pragma once
+
+// Host-side stand-in for the ESP-IDF power management API; the configuration is kept in
+// fake::pmConfig.
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+
+typedef struct {
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_esp32c3_t;
+
+namespace fake {
+
+inline esp_pm_config_esp32c3_t pmConfig = {};
+
+} // namespace fake
+
+inline esp_err_t esp_pm_configure(const void *config) {
+    fake::pmConfig = *static_cast<const esp_pm_config_esp32c3_t *>(config);
+    return ESP_OK;
+}
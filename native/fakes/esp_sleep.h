@@ -0,0 +1,21 @@
+#pragma once
+
+// Host-side stand-in for the ESP-IDF sleep API.
+
+typedef int esp_err_t;
+
+typedef enum {
+    ESP_PD_DOMAIN_RTC_PERIPH = 0,
+    ESP_PD_DOMAIN_RTC8M,
+    ESP_PD_DOMAIN_MAX,
+} esp_sleep_pd_domain_t;
+
+typedef enum {
+    ESP_PD_OPTION_OFF = 0,
+    ESP_PD_OPTION_ON,
+    ESP_PD_OPTION_AUTO,
+} esp_sleep_pd_option_t;
+
+inline esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option) {
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// Host-side stand-in for the ESP-IDF SNTP client. Once configTime() ran, every WiFi
+// association syncs the clock after fake::network.ntpSyncMs (see WiFi.h).
+
+#include <sys/time.h>
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+namespace fake {
+
+inline bool sntpConfigured = false;
+inline sntp_sync_time_cb_t sntpCallback = nullptr;
+inline uint32_t sntpSyncs = 0;
+
+} // namespace fake
+
+inline void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+    fake::sntpCallback = callback;
+}
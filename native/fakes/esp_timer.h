@@ -0,0 +1,12 @@
+#pragma once
+
+// Host-side stand-in for the ESP-IDF high resolution timer.
+
+#include <cstdint>
+
+#include "fake_world.h"
+
+// microseconds since boot, 64 bit so it does not wrap like micros()
+inline int64_t esp_timer_get_time() {
+    return int64_t(fake::nowUs);
+}
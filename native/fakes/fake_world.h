@@ -0,0 +1,99 @@
+#pragma once
+
+// Scriptable stand-in for the clock, radio and network of the ESP32.
+// Only used by the [env:native] build, see native/bench_main.cpp.
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+
+namespace fake {
+
+// virtual time, only advanced by delay(), blocking fake calls and the bench driver
+inline uint64_t nowUs = 0;
+
+// wall clock at boot (2025-01-06 07:00:00 UTC, a Monday morning)
+inline int64_t bootEpoch = 1736146800;
+
+inline std::multimap<uint64_t, std::function<void()>> events;
+
+inline void at(uint64_t us, std::function<void()> fn) {
+    events.emplace(us, std::move(fn));
+}
+
+inline void afterMs(uint32_t ms, std::function<void()> fn) {
+    at(nowUs + uint64_t(ms) * 1000, std::move(fn));
+}
+
+// advance the clock, firing every event that becomes due on the way
+inline void advanceUs(uint64_t us) {
+    uint64_t target = nowUs + us;
+    while (!events.empty() && events.begin()->first <= target) {
+        auto it = events.begin();
+        if (it->first > nowUs) {
+            nowUs = it->first;
+        }
+        auto fn = std::move(it->second);
+        events.erase(it);
+        fn();
+    }
+    nowUs = std::max(nowUs, target); // an event may have blocked past it
+}
+
+inline void advanceMs(uint32_t ms) {
+    advanceUs(uint64_t(ms) * 1000);
+}
+
+struct NetworkProfile {
+    uint32_t wifiAssociateMs = 2500; // association + DHCP
+    uint32_t mqttConnectMs = 150;
+    bool wifiAvailable = true;
+    bool brokerAvailable = true;
+    uint32_t brokerRttMs = 20; // a PUBLISH until its PUBACK
+    uint32_t publishLossPercent = 0; // publishes the link drops on the way to the broker, QoS 1 ones go unacknowledged
+    float coexBleSlowdown = 1.3f; // BLE round trips take this much longer while WiFi shares the radio
+    uint32_t ntpSyncMs = 300; // association until the first SNTP answer
+};
+
+inline NetworkProfile network;
+inline bool wifiAssociated = false;
+inline uint32_t lossState = 1;
+inline uint32_t lostPublishes = 0;
+
+// deterministic, so a run repeats for a given bench seed
+inline bool publishLost() {
+    lossState = lossState * 1103515245u + 12345u;
+    return (lossState >> 16) % 100 < network.publishLossPercent;
+}
+
+// duration of a BLE round trip, stretched when the coexistence arbiter also serves WiFi
+inline uint32_t bleDelayMs(uint32_t ms) {
+    return wifiAssociated ? uint32_t(ms * network.coexBleSlowdown) : ms;
+}
+
+// runs when a task has blocked in a fake call, as the scheduler would run the lower priority
+// tasks meanwhile; unset, the driver runs them after the blocking task's pass
+inline std::function<void()> whileBlocked;
+
+// a blocking BLE round trip
+inline void bleRoundTripMs(uint32_t ms) {
+    advanceMs(bleDelayMs(ms));
+    if (whileBlocked) {
+        whileBlocked();
+    }
+}
+
+// thrown by ESP.restart() so the driver can count reboots instead of dying
+struct Restart {};
+
+// drops pending events between benchmark suites; the clock keeps running
+// forward because the firmware's millis() timers assume it never goes back
+inline void reset() {
+    events.clear();
+    wifiAssociated = false;
+    lossState = 1;
+    lostPublishes = 0;
+}
+
+} // namespace fake
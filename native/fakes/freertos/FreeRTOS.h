@@ -0,0 +1,20 @@
+#pragma once
+
+// Host-side FreeRTOS subset: static queues and direct task notifications. Tasks are
+// created but never run; the bench runs their passes the way the scheduler would
+// (runTasksOnce() in native/bench/session_latency.h).
+
+#include <cstddef>
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t; // ESP-IDF counts stack depth in bytes
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define errQUEUE_FULL 0
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms)) // CONFIG_FREERTOS_HZ=1000
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#include <cstring>
+#include <mutex>
+
+// a ring over the caller's storage, locked because the bench posts from other threads
+struct StaticQueue_t {
+    std::mutex lock;
+    uint8_t *storage = nullptr;
+    UBaseType_t length = 0;
+    UBaseType_t itemSize = 0;
+    UBaseType_t head = 0;
+    UBaseType_t count = 0;
+};
+
+typedef StaticQueue_t *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->storage = storage;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+// never blocks on the host, a full queue fails at once
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->count == queue->length) {
+        return errQUEUE_FULL;
+    }
+    UBaseType_t slot = (queue->head + queue->count) % queue->length;
+    memcpy(queue->storage + slot * queue->itemSize, item, queue->itemSize);
+    queue->count++;
+    return pdPASS;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->storage + queue->head * queue->itemSize, queue->itemSize);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    return queue->count;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#include "../fake_world.h"
+
+#include <atomic>
+
+// a binary semaphore given from the NimBLE host task's events
+struct StaticSemaphore_t {
+    std::atomic<uint32_t> count{0};
+};
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *semaphore) {
+    semaphore->count = 0;
+    return semaphore;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    uint32_t empty = 0;
+    return semaphore->count.compare_exchange_strong(empty, 1) ? pdTRUE : pdFALSE;
+}
+
+// a blocking call: the clock runs from event to event until the semaphore is given or the
+// wait is over; portMAX_DELAY with nothing scheduled fails instead of hanging the bench
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+    uint64_t until = ticksToWait == portMAX_DELAY ? UINT64_MAX : fake::nowUs + uint64_t(ticksToWait) * 1000;
+    while (semaphore->count == 0) {
+        if (fake::nowUs >= until || (fake::events.empty() && until == UINT64_MAX)) {
+            return pdFALSE;
+        }
+        uint64_t next = fake::events.empty() ? until : std::min(fake::events.begin()->first, until);
+        fake::advanceUs(next > fake::nowUs ? next - fake::nowUs : 0);
+        if (fake::whileBlocked) {
+            fake::whileBlocked();
+        }
+    }
+    semaphore->count = 0;
+    return pdTRUE;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+#include <atomic>
+
+struct StaticTask_t {
+    const char *name = nullptr;
+    std::atomic<uint32_t> notifications{0};
+    uint64_t serialBlockedUs = 0; // its writes to Serial waited for the UART this long
+};
+
+typedef StaticTask_t *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+namespace fake {
+
+inline TaskHandle_t currentTask = nullptr; // the task whose pass the bench is running, nullptr for the NimBLE host task
+
+} // namespace fake
+
+// the task function is not called, see FreeRTOS.h
+inline TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+                                      UBaseType_t priority, StackType_t *stack, StaticTask_t *task) {
+    task->name = name;
+    task->notifications = 0;
+    return task;
+}
+
+inline void vTaskDelete(TaskHandle_t task) {}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return fake::currentTask;
+}
+
+// nothing preempts the bench
+inline void vTaskSuspendAll() {}
+
+inline BaseType_t xTaskResumeAll() {
+    return pdFALSE;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    task->notifications++;
+    return pdPASS;
+}
+
+// never blocks on the host: returns the notifications fake::currentTask had
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+    if (fake::currentTask == nullptr) {
+        return 0;
+    }
+    if (clearOnExit) {
+        return fake::currentTask->notifications.exchange(0);
+    }
+    uint32_t count = fake::currentTask->notifications;
+    if (count > 0) {
+        fake::currentTask->notifications--;
+    }
+    return count;
+}
@@ -0,0 +1,49 @@
+// libFuzzer target for the Body Composition Measurement decoder, host only:
+//   clang++ -std=gnu++17 -g -O1 -fsanitize=fuzzer,address,undefined -I include native/fuzz/bcm_decoder_fuzz.cpp -o bcm_decoder_fuzz
+//   ./bcm_decoder_fuzz -max_len=256
+// The input is a resolution byte followed by packets, each prefixed with its
+// length, so multiple packet measurements and their interleavings get explored.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "body_composition.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+    BodyCompositionDecoder decoder(data[0] & 0x07, data[0] >> 3);
+    size_t pos = 1;
+    while (pos < size) {
+        size_t length = data[pos++];
+        if (length > size - pos) {
+            length = size - pos;
+        }
+        // a copy of exactly `length` bytes, so ASan catches any read past the packet
+        uint8_t *packet = static_cast<uint8_t *>(malloc(length ? length : 1));
+        for (size_t i = 0; i < length; i++) {
+            packet[i] = data[pos + i];
+        }
+        BcmResult result = decoder.decode(packet, length);
+        if (result == BcmResult::TRUNCATED && length >= 4) {
+            uint16_t flags = readUint16Le(packet);
+            if (length >= bcmFrameLength(flags)) {
+                abort(); // rejected a frame that holds every announced field
+            }
+        }
+        if (result == BcmResult::COMPLETE) {
+            const BodyComposition &composition = decoder.result();
+            float values[] = {composition.fatPercentage, composition.musclePercentage, composition.weightKg,
+                              composition.bodyWaterMassKg, composition.heightM, composition.impedanceOhm};
+            for (float value : values) {
+                if (!isfinite(value) || value < 0.0f) {
+                    abort();
+                }
+            }
+        }
+        free(packet);
+        pos += length;
+    }
+    return 0;
+}
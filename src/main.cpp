@@ -3,80 +3,309 @@
 #include <NimBLEScan.h>
 #include <PubSubClient.h>
 #include <WiFi.h>
+#include <driver/ledc.h>
+#include <esp_coexist.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_sntp.h>
 #include <time.h>
 
+#include "advert_filter.h"
+#include "ble_trace.h"
+#include "command_queue.h"
 #include "config.h"
+#include "event_log.h"
+#include "frame_queue.h"
+#include "gatt_cache.h"
+#include "history_cursor.h"
+#include "latency_stats.h"
 #include "measurement_helpers.h"
+#include "mqtt_topics.h"
+#include "qos1_publisher.h"
+#include "scan_schedule.h"
+#include "user_trends.h"
+
+// keep WiFi and the MQTT session up while BLE scans, so a measurement costs a
+// single publish instead of a full WiFi + MQTT handshake (uses BLE/WiFi coexistence)
+bool persistentConnection = false;
+
+// ask the scale for the stored measurements of every user in SCALE_USERS (config.h) on each
+// connection, so weigh-ins missed while WiFi or the bridge was down are recovered
+bool historySync = false;
+
+// publish the logged measurements as one CBOR message per batch on smartscale/measurementBatch
+// (layout in writeMeasurementCbor()), the newest one of a batch still goes out as JSON too
+bool binaryBatches = false;
+
+// topics of the bridge itself (boot time, stats, counters); a scale's own values go out under
+// the topic of its SCALES entry (config.h)
+constexpr char MAIN_TOPIC[] = "smartscale/";
+static_assert(topicsFit(MAIN_TOPIC), "MAIN_TOPIC plus a topic name exceeds TOPIC_MAX_LENGTH");
+constexpr TopicTable TOPICS = joinTopics(MAIN_TOPIC);
+
+constexpr size_t MAX_SCALES = CONFIG_BT_NIMBLE_MAX_CONNECTIONS; // one link per scale
+constexpr size_t SCALE_COUNT = sizeof(SCALES) / sizeof(SCALES[0]);
+static_assert(SCALE_COUNT > 0 && SCALE_COUNT <= MAX_SCALES, "SCALES needs 1..CONFIG_BT_NIMBLE_MAX_CONNECTIONS entries");
+
+constexpr bool scaleTopicsFit() {
+    for (const ScaleConfig &config : SCALES) {
+        if (!topicsFit(config.topic)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-const bool DEBUG = true;
-
-const char *MAIN_TOPIC = "smartscale/";
-
-const char *BOOT_TIME_TOPIC = "bootTime";
-const char *BATTERY_LEVEL_TOPIC = "battery";
-
-const char *MEASUREMENT_TOPIC = "measurement";
-const char *MEASUREMENT_TIME_TOPIC = "measurementTime";
-const char *MEASUREMENT_COUNT_TOPIC = "measurementCount";
-
-const char *LOOP_COUNT_TOPIC = "loopCount";
+static_assert(scaleTopicsFit(), "a topic of SCALES plus a topic name exceeds TOPIC_MAX_LENGTH");
 
 constexpr auto BLUE_LED_PIN = 8;
 
 // LED PWM Configuration
-constexpr int PWM_CHANNEL = 0;
+constexpr ledc_channel_t PWM_CHANNEL = LEDC_CHANNEL_0;
 constexpr int PWM_FREQ = 5000;
 constexpr int PWM_RESOLUTION = 8;
 constexpr int MAX_DUTY = 255;
-constexpr int DEFAULT_MAX_BRIGHTNESS = (MAX_DUTY * 0.3); // 30% brightness
-
-int currentMaxBrightness = DEFAULT_MAX_BRIGHTNESS;
-
-constexpr auto BT_DISCONNECT_DELAY_MS = 55000; // time it takes for the scale to power down after the user steps off
-constexpr auto SERIAL_STARTUP_DELAY_MS = 2000; // time to wait for Serial to initialize
-constexpr auto WAIT_FOR_PUBLISH_DELAY_MS = 1000; // time to wait after publishing before disconnecting MQTT
+constexpr uint8_t DEFAULT_MAX_BRIGHTNESS = MAX_DUTY * 3 / 10; // 30% brightness, while looking for the scale
+constexpr uint8_t FULL_BRIGHTNESS = MAX_DUTY; // connected to the scale
+
+constexpr auto BT_DISCONNECT_DELAY_MS = 55000; // upper bound for the scale to power down after the user steps off
+constexpr auto SCALE_ABSENT_MS = 3000; // the scale has powered down once none of its adverts was seen for this long
+constexpr auto SCALE_WAKE_UP_GAP_MS = 1500; // adverts resuming after a pause this long are a new step-on
+constexpr auto BACK_TO_BACK_MS = 30000; // a step-on this soon after the scale powered down is the next one in line
+constexpr auto MULTIPLE_PACKET_GAP_MS = 2000; // the two packets of a measurement are indicated back to back
+constexpr auto PUBACK_TIMEOUT_MS = 3000; // no PUBACK for this long: the connection is dead, reconnect and publish again
 constexpr auto WAIT_FOR_MEASUREMENT_TIMEOUT_MS = 30000; // time to wait for measurement indication before disconnecting
+constexpr auto MEASUREMENT_LINGER_MS = 10000; // keep the BLE link open this long after the last indication for further frames
+constexpr auto HISTORY_QUIET_MS = 1500; // a user's stored measurements are complete once no frame arrived for this long
+constexpr auto HISTORY_USER_TIMEOUT_MS = 10000; // move on to the next user if the scale does not answer the consent
+constexpr auto WIFI_CONNECT_TIMEOUT_MS = 10000; // give up on a single WiFi association attempt after this
+constexpr auto NETWORK_RETRY_BASE_MS = 1000; // first retry delay, doubled after every failed attempt
+constexpr auto NETWORK_RETRY_MAX_MS = 60000; // upper bound for the retry delay
+constexpr auto NETWORK_MAX_ATTEMPTS = 8; // postpone publishing after this many failed attempts in a row
+constexpr auto NTP_SYNC_TIMEOUT_MS = 15000; // WiFi stays up this long for the first SNTP sync after a power-on
+constexpr time_t CLOCK_VALID_AFTER = 1451606400; // 2016-01-01, the test of getLocalTime(); before it the clock was never set
+constexpr uint32_t RETAINED_MAGIC = 0x5343414c;
+constexpr auto LOG_RETRY_MS = 5 * 60000; // the logged measurements are published again after this long, or with the next one
+constexpr uint32_t LOG_REPLAY_BATCH = 8; // logged measurements published per pass of the publish task, acknowledged together
+constexpr auto MQTT_SOCKET_TIMEOUT_S = 2; // bounds how long a single mqttClient.connect() can block
+constexpr auto MQTT_KEEPALIVE_S = 15; // PubSubClient's default, a ping unanswered for this long closes the connection
+constexpr auto DIRECT_CONNECT_WINDOW_MS = 30000; // length of one direct connect attempt to the cached scale address
+constexpr auto DIRECT_CONNECT_RETRY_MS = 1000; // pause before retrying a direct connect that could not be started
+constexpr ScanParams QUIET_SCAN = {SCAN_WINDOW_MS, SCAN_QUIET_INTERVAL_MS}; // config.h
+constexpr ScanParams BUSY_SCAN = {SCAN_WINDOW_MS, SCAN_BUSY_INTERVAL_MS};
+constexpr ScanParams CONTINUOUS_SCAN = {SCAN_WINDOW_MS, SCAN_WINDOW_MS}; // the presence scan must not miss an advert
+constexpr auto CPU_MAX_FREQ_MHZ = 160;
+constexpr auto CPU_MIN_FREQ_MHZ = 40; // the XTAL frequency, lowest the BLE controller allows
+constexpr auto DIRECT_CONNECT_FALLBACK_MS = 7UL * 24 * 3600 * 1000; // scan by name again if the cached scale was not seen for this long (replaced scale)
+constexpr uint32_t WAIT_FOREVER = UINT32_MAX; // a task pass returning this blocks until the task is woken
+constexpr auto NETWORK_POLL_MS = 20; // WiFi association and the MQTT retry timer post no event, polled this often
+constexpr auto PUBACK_POLL_MS = 10; // PubSubClient has no receive callback, the socket is read this often while PUBACKs are due
+constexpr auto MQTT_KEEPALIVE_POLL_MS = 1000; // mqttClient.loop() on an idle connection, well within MQTT_KEEPALIVE_S
 
 constexpr size_t MQTT_BUFFER_SIZE = 1024;
+constexpr size_t MEASUREMENT_JSON_SIZE = 128; // {"p_id":255,"time":"2025-12-26T18:38:30Z",...} is about 90 bytes
+constexpr size_t TREND_JSON_SIZE = 192; // {"p_id":255,"time":...,"n":65535,"weight":...,"bmi":...} is about 160 bytes
+constexpr size_t MEASUREMENT_BATCH_SIZE = 1 + LOG_REPLAY_BATCH * MEASUREMENT_CBOR_MAX;
+constexpr size_t STATS_JSON_SIZE = 900; // {"up":...,"heap":[...], a [count,p50,p90,max] per state and operation}
+constexpr size_t FRAME_QUEUE_CAPACITY = 64; // indications buffered until the publish pipeline drains them, sized for a history sync
+
+static_assert(MEASUREMENT_BATCH_SIZE + TOPIC_MAX_LENGTH + 7 <= MQTT_BUFFER_SIZE, "a batch fits one MQTT message");
+static_assert(STATS_JSON_SIZE + TOPIC_MAX_LENGTH + 7 <= MQTT_BUFFER_SIZE, "the stats fit one MQTT message");
 
 const auto GMT_OFFSET_SEC = 3600;
 const auto DAYLIGHT_OFFSET_SEC = 3600;
 
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
+Qos1Publisher qos1(mqttClient, espClient);
 
 enum class AppState {
     SCANNING,
     CONNECTING,
     CONNECTED_WAIT,
+    SYNC_HISTORY,
     WAIT_FOR_MEASUREMENT,
-    PUBLISH_MEASUREMENT,
-    WAIT_FOR_PUBLISH,
     WAIT_FOR_SCALE_TO_DISAPPEAR
 };
 
-AppState currentAppState = AppState::SCANNING;
-unsigned long stateTimer = 0;
+// dwell time per AppState over all scale sessions, for the stats topic
+constexpr size_t APP_STATE_COUNT = size_t(AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) + 1;
+const char *const APP_STATE_NAMES[APP_STATE_COUNT] = {"scanning", "connecting", "connectedWait", "syncHistory",
+                                                      "waitForMeasurement", "waitForScaleToDisappear"};
+LatencyHistogram appStateDwell[APP_STATE_COUNT];
+
+// one scan serves every session: it waits for the scales not found yet with the duty cycle of
+// the plan, or watches every advert while a scale powers down after its session
+enum class ScanMode : uint8_t { OFF, WAIT, PRESENCE };
+
+ScanSchedule scanSchedule;
+ScanMode scanMode = ScanMode::OFF;
+ScanParams scanModeParams = {}; // of the running scan
+ScanParams scanParams = {}; // of the running wait for a scale, {} while none runs
+unsigned long scanParamsAt = 0;
+uint64_t scanRadioMs = 0; // time the radio listened for the scales, window / interval of the wait
+
+// network side of the pipeline, runs next to the BLE session so a measurement
+// is published while the scale link stays open for further indications
+enum class PublishState {
+    IDLE,
+    WIFI_CONNECTING,
+    MQTT_CONNECTING,
+    PUBLISHING,
+    WAIT_FOR_PUBLISH
+};
+
+PublishState currentPublishState = PublishState::IDLE;
+uint32_t publishedThrough = 0; // newest log record handed to the broker, acknowledged or not
 
-enum class BlinkState {
-    OFF,
-    ON
+// raw indication frames, handed from the NimBLE host task to the publish task
+FrameQueue<FRAME_QUEUE_CAPACITY> frameQueue;
+
+// the BLE session, the publish pipeline, the LED and the log output each run in a task of their own
+// (startTasks()); a task runs a pass of its state machine, then blocks until it is woken or its wait runs out
+enum class TaskId : uint8_t { BLE, PUBLISH, LED, LOG, COUNT };
+TaskHandle_t taskHandles[size_t(TaskId::COUNT)] = {};
+uint64_t taskBusyUs[size_t(TaskId::COUNT)] = {}; // time spent in passes, the blocking calls in them included
+uint32_t taskPasses[size_t(TaskId::COUNT)] = {};
+uint64_t statsBusyUs = 0; // sum of taskBusyUs at the last stats message
+unsigned long statsAt = 0;
+
+void startTasks(); // with the task passes, after setup()
+
+// from any task, including the NimBLE host task
+void wakeTask(TaskId task) {
+    if (taskHandles[size_t(task)] != nullptr) {
+        xTaskNotifyGive(taskHandles[size_t(task)]);
+    }
+}
+
+// the BLE session with one scale of SCALES; the BLE task runs them all, the NimBLE host task
+// and the publish task reach theirs through the client, the connection handle or the frame
+struct ScaleSession {
+    const ScaleConfig *config = nullptr;
+    uint8_t index = 0; // into SCALES, carried by its frames and log records
+    TopicTable topics = {}; // joined once in beginScales()
+    NimBLEClient *client = nullptr; // created once in setup() and reused by every session
+
+    std::atomic<AppState> state{AppState::SCANNING}; // read by the NimBLE host task and the publish task
+    unsigned long stateTimer = 0;
+    AppState trackedState = AppState::SCANNING;
+    unsigned long stateEnteredAt = 0;
+    unsigned long scanStartedAt = 0;
+
+    // written by the NimBLE host task when the scan finds the scale, address before found
+    NimBLEAddress address;
+    std::atomic<uint64_t> addressKey{0}; // packAddress(address), what the host task compares adverts with
+    std::atomic<bool> found{false};
+    bool pinned = false; // the config gives the address, no other scale is taken
+    NimBLEAddress pinnedAddress;
+    bool directConnectStarted = false; // a direct connect to the cached address is pending or retrying
+    std::atomic<bool> directConnectFailed{false};
+    ScanParams directConnectParams = {};
+    std::atomic<unsigned long> lastSeenAt{0}; // read by the NimBLE host task
+
+    // address and GATT handles of the scale, so a reconnect skips the scan and the discovery
+    GattCache gattCache;
+    std::atomic<bool> usesCachedHandles{false}; // indications arrive through onGapEvent() instead of the NimBLEClient
+    NimBLERemoteCharacteristic *userControlPoint = nullptr;
+    uint16_t userControlPointHandle = 0; // set instead of userControlPoint when the session uses cached handles
+    std::atomic<int16_t> ucpResult{-1}; // result of the last consent, -1 while pending
+
+    HistoryCursor historyCursor;
+    size_t historyUser = 0; // index into SCALE_USERS
+    bool historyConsentSent = false;
+    unsigned long historyTimer = 0;
+
+    std::atomic<uint32_t> framesReceived{0}; // indicated, counted by the NimBLE host task only
+    uint32_t frameBase = 0; // framesReceived when the session started
+    uint32_t measurementCount = 0; // frames of this session
+    unsigned long lastIndicationAt = 0;
+
+    // presence of the scale after a session, fed by the scan in WAIT_FOR_SCALE_TO_DISAPPEAR
+    std::atomic<unsigned long> advertAt{0}; // millis() of the last advert of the scale
+    std::atomic<bool> wokeUp{false};
+    unsigned long sessionEndedAt = 0;
+    unsigned long departedAt = 0; // millis() of the last advert before the scale powered down, 0 once counted
+    unsigned long stepOnAt = 0; // the scale was found, or the direct connect came up
+    uint32_t lastDepartureMs = 0; // how long the scale kept advertising after the last session
+    uint32_t backToBackCount = 0; // sessions stepped on within BACK_TO_BACK_MS of the scale powering down
+
+    std::atomic<uint8_t> batteryLevel{0}; // read by the publish task
+
+    // read by the publish task only
+    BodyCompositionDecoder decoder{SCALE_MASS_RESOLUTION};
+    UserTrends trends;
+    unsigned long lastFrameReceivedAt = 0;
 };
 
+ScaleSession scales[MAX_SCALES];
+size_t scaleCount = 0;
+
+uint32_t historySkippedCount = 0; // stored measurements that were already published, told apart after the decode
+uint32_t unpublishableCount = 0; // logged measurements dropped because they could not be formatted
+std::atomic<uint32_t> dedupHits{0}; // repeated frames dropped at the indication, written by the NimBLE host task only
+uint32_t gattCacheHits = 0;
+uint32_t gattCacheMisses = 0;
+
+// exponential backoff shared by the WiFi and MQTT connection states
+struct NetworkRetry {
+    uint8_t attempts = 0;
+    unsigned long nextAttemptAt = 0;
+
+    bool due() const {
+        return (long)(millis() - nextAttemptAt) >= 0;
+    }
+
+    void reset() {
+        attempts = 0;
+        nextAttemptAt = millis();
+    }
+
+    void fail() {
+        attempts++;
+        unsigned long backoff = (unsigned long)NETWORK_RETRY_BASE_MS << (attempts < 7 ? attempts - 1 : 6);
+        if (backoff > NETWORK_RETRY_MAX_MS) {
+            backoff = NETWORK_RETRY_MAX_MS;
+        }
+        nextAttemptAt = millis() + backoff;
+    }
+
+    bool exhausted() const {
+        return attempts >= NETWORK_MAX_ATTEMPTS;
+    }
+};
+
+NetworkRetry networkRetry;
+unsigned long logRetryAt = 0;
+bool wifiConnectStarted = false;
+unsigned long networkSetupStartedAt = 0;
+
 enum class LedMode {
     PULSE,
     OFF,
 };
 
-uint16_t blinkOnDurationMs = 200;
-uint16_t blinkOffDurationMs = 800;
+// what the other tasks ask the LED task to show
+struct LedCommand {
+    LedMode mode;
+    uint16_t onDurationMs; // the pulse brightens over this long
+    uint16_t offDurationMs; // and dims back to off over this long
+    uint8_t maxBrightness;
+    uint32_t fadeOutMs; // the pulse dims to off over this long, 0 keeps its brightness
+};
 
-LedMode currentLedMode = LedMode::OFF;
-unsigned long lastBlinkToggle = 0;
+CommandQueue<LedCommand, 4> ledCommands;
+LedCommand currentLed = {LedMode::OFF, 0, 0, 0, 0};
+unsigned long ledCommandAt = 0;
+bool ledRampUp = false; // direction of the next hardware fade
+unsigned long ledRampStartedAt = 0;
+uint16_t ledRampMs = 0; // LEDC is busy fading until ledRampStartedAt + ledRampMs
 
-NimBLEClient *pClient = nullptr;
+// what the LED shows for the sessions, the one furthest along wins
+enum class LedShow : uint8_t { NONE, SCANNING, DISAPPEARING, CONNECTED, CONNECTING };
+LedShow ledShow = LedShow::NONE;
 
-const char *SCALE_DEVICE_NAME = "Shape100"; // The name of the scale device we are looking for
+constexpr uint16_t SCALE_SERVICE_UUID16 = 0x181B; // Body Composition, matched when the scale advertises it
 
 // Service and Characteristic UUIDs
 static NimBLEUUID SVC_BATTERY("180f");
@@ -88,468 +317,1802 @@ static NimBLEUUID CHR_CURRENT_TIME("2a2b");
 static NimBLEUUID SVC_BODY_COMPOSITION("0000181b-0000-1000-8000-00805f9b34fb");
 static NimBLEUUID CHR_BODY_COMPOSITION_MEASUREMENT("00002a9c-0000-1000-8000-00805f9b34fb");
 
-NimBLEAdvertisedDevice *scaleDevice = nullptr;
+static NimBLEUUID SVC_USER_DATA("181c");
+static NimBLEUUID CHR_USER_CONTROL_POINT("2a9f");
+
+constexpr uint8_t UCP_OP_CONSENT = 0x02;
+constexpr uint8_t UCP_OP_RESPONSE = 0x20;
+constexpr uint8_t UCP_RESULT_SUCCESS = 0x01;
+
+// kept in RTC memory across a restart (not across a power cycle), valid while magic matches
+struct RetainedState {
+    uint32_t magic;
+    uint32_t loopCount;
+    uint16_t measurementCount;
+    // wall clock at the last task pass once the clock was set; every task stores it, so it is an
+    // unsigned 32-bit count of seconds (good until 2106), not a time_t the C3 writes in two halves
+    std::atomic<uint32_t> knownTime;
+};
+
+RTC_NOINIT_ATTR RetainedState retained;
+
+uint16_t &measurementCount = retained.measurementCount;
+uint32_t &loopCount = retained.loopCount;
+
+// SNTP runs in the background whenever WiFi is up; nothing waits for it at boot
+std::atomic<bool> timeSynced{false}; // set by SNTP, or kept across a restart
+bool bootTimePending = true; // smartscale/bootTime goes out with the first publishing round that knows the time
+unsigned long setupStartedAt = 0;
+unsigned long wifiConnectedAt = 0;
+bool firstScanStarted = false;
+unsigned long bootToScanMs = 0; // setup() until the first scan or direct connect
 
-uint8_t batteryLevel = 0;
-uint16_t measurementCount = 0;
-uint32_t loopCount = 0;
+// radio-on cost vs. latency benefit of the persistent connection
+uint64_t wifiOnTimeMs = 0; // total time WiFi was associated
+unsigned long wifiOnTimeCheckedAt = 0;
+uint32_t lastNetworkSetupMs = 0; // duration of the last WiFi + MQTT connect
+uint32_t latencySavedMs = 0; // sum of lastNetworkSetupMs over publishes that found the session already up
 
 void setLed(bool on) {
     // Active LOW: 0 is ON (Max brightness), 255 is OFF.
-    int duty = on ? (MAX_DUTY - currentMaxBrightness) : MAX_DUTY;
-    ledcWrite(PWM_CHANNEL, duty);
+    int duty = on ? (MAX_DUTY - DEFAULT_MAX_BRIGHTNESS) : MAX_DUTY;
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, PWM_CHANNEL, duty);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, PWM_CHANNEL);
 }
 
-bool ledState = false;
+void setLedModeBlink(uint16_t onDurationMs = 200, uint16_t offDurationMs = 800, uint8_t maxBrightness = DEFAULT_MAX_BRIGHTNESS,
+                     uint32_t fadeOutMs = 0) {
+    ledCommands.post({LedMode::PULSE, onDurationMs, offDurationMs, maxBrightness, fadeOutMs});
+}
 
-void setLedModeBlink(uint16_t onDurationMs = 200, uint16_t offDurationMs = 800) {
-    currentLedMode = LedMode::PULSE;
-    currentMaxBrightness = DEFAULT_MAX_BRIGHTNESS;
+void setLedModeOff() {
+    ledCommands.post({LedMode::OFF, 0, 0, 0, 0});
+}
 
-    blinkOnDurationMs = onDurationMs;
-    blinkOffDurationMs = offDurationMs;
+// the LEDC peripheral ramps the duty in hardware, the task only starts one ramp per half period
+void startLedRamp(uint8_t brightness, uint16_t durationMs) {
+    ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, PWM_CHANNEL, MAX_DUTY - brightness, durationMs); // Active LOW
+    ledc_fade_start(LEDC_LOW_SPEED_MODE, PWM_CHANNEL, LEDC_FADE_NO_WAIT);
+    ledRampStartedAt = millis();
+    ledRampMs = durationMs;
 }
 
-void setLedModeOff() {
-    currentLedMode = LedMode::OFF;
-    setLed(false);
+// LED task: applies the queued commands and starts the next fade of the pulse, sleeps while the LED is off
+uint32_t ledTaskPass() {
+    bool received = false;
+    LedCommand command;
+    while (ledCommands.receive(command)) {
+        currentLed = command;
+        ledCommandAt = millis();
+        ledRampUp = true;
+        received = true;
+    }
+
+    // a running fade holds the LEDC channel until its end, unless a new command stops it
+    uint32_t rampElapsedMs = millis() - ledRampStartedAt;
+    if (rampElapsedMs < ledRampMs) {
+        if (!received) {
+            return ledRampMs - rampElapsedMs;
+        }
+        ledc_fade_stop(LEDC_LOW_SPEED_MODE, PWM_CHANNEL); // a status change shows at once, not at the end of the fade
+    }
+    ledRampMs = 0;
+    if (received && currentLed.mode == LedMode::OFF) {
+        setLed(false);
+    }
+
+    switch (currentLed.mode) {
+        case LedMode::PULSE: {
+            uint8_t brightness = currentLed.maxBrightness;
+            if (currentLed.fadeOutMs > 0) {
+                brightness = constrain(map(millis() - ledCommandAt, 0, currentLed.fadeOutMs, brightness, 0), 0, brightness);
+            }
+            if (ledRampUp) {
+                startLedRamp(brightness, currentLed.onDurationMs);
+            } else {
+                startLedRamp(0, currentLed.offDurationMs);
+            }
+            ledRampUp = !ledRampUp;
+            return ledRampMs;
+        }
+
+        case LedMode::OFF:
+            break;
+    } // end switch led mode
+    return WAIT_FOREVER;
 }
 
-void logHexPayload(const uint8_t *data, size_t length) {
-    Serial.print("Received measurement data: ");
-    for (size_t i = 0; i < length; i++) {
-        Serial.printf("%02x", data[i]);
+// one decimal and no trailing ".0", like the ArduinoJson output this replaced; integer
+// formatting keeps newlib's float printf, which allocates, out of the publish path
+void formatTenths(char *buffer, size_t size, float value) {
+    long tenths = lround(value * 10.0);
+    unsigned long magnitude = tenths < 0 ? -tenths : tenths;
+    const char *sign = tenths < 0 ? "-" : "";
+    if (magnitude % 10 == 0) {
+        snprintf(buffer, size, "%s%lu", sign, magnitude / 10);
+    } else {
+        snprintf(buffer, size, "%s%lu.%lu", sign, magnitude / 10, magnitude % 10);
     }
-    Serial.println();
 }
 
-bool generateMeasurementJson(String &outJson) {
+// serializes `measurement` into `buffer`, no heap; false without a time or if it does not fit
+bool writeMeasurementJson(char *buffer, size_t size) {
     if (measurement.time[0] == '\0') {
         return false;
     }
-    DynamicJsonDocument doc(256);
+    char weight[12], fat[12], water[12], muscle[12];
+    formatTenths(weight, sizeof(weight), measurement.weightKg);
+    formatTenths(fat, sizeof(fat), measurement.fatPercentage);
+    formatTenths(water, sizeof(water), measurement.waterPercentage);
+    formatTenths(muscle, sizeof(muscle), measurement.musclePercentage);
+    int length = snprintf(buffer, size, "{\"p_id\":%u,\"time\":\"%s\",\"weight\":%s,\"fat\":%s,\"water\":%s,\"muscle\":%s}",
+                          measurement.pID, measurement.time, weight, fat, water, muscle);
+    return length > 0 && (size_t)length < size;
+}
 
-    doc["p_id"] = measurement.pID;
-    doc["time"] = measurement.time;
-    doc["weight"] = round(measurement.weightKg * 10.0) / 10.0;
-    doc["fat"] = round(measurement.fatPercentage * 10.0) / 10.0;
-    doc["water"] = round(measurement.waterPercentage * 10.0) / 10.0;
-    doc["muscle"] = round(measurement.musclePercentage * 10.0) / 10.0;
-    serializeJson(doc, outJson);
-    return true;
+// the running statistics of user `userID`: moving averages of weight, fat, water and muscle,
+// the weight range of the last TREND_DAYS days, the slope in kg per week and the BMI of the
+// average weight if USER_HEIGHT_CM has the user; no heap, false if it does not fit
+bool writeTrendJson(char *buffer, size_t size, uint8_t userID, const UserTrend &trend) {
+    char time[25], weight[12], fat[12], water[12], muscle[12], lightest[12], heaviest[12], bmi[20] = "";
+    formatScaleTime(time, sizeof(time), trend.scaleTime);
+    formatTenths(weight, sizeof(weight), trend.weight);
+    formatTenths(fat, sizeof(fat), trend.fat);
+    formatTenths(water, sizeof(water), trend.water);
+    formatTenths(muscle, sizeof(muscle), trend.muscle);
+    formatTenths(lightest, sizeof(lightest), trend.windowMin() / 10.0f);
+    formatTenths(heaviest, sizeof(heaviest), trend.windowMax() / 10.0f);
+    long slope = lround(trend.slope * 7.0f * 100.0f); // 0.01 kg per week
+    unsigned long magnitude = slope < 0 ? -slope : slope;
+    uint8_t heightCm = userID >= 1 && userID <= MAX_SCALE_USERS ? USER_HEIGHT_CM[userID - 1] : 0;
+    if (heightCm > 0) {
+        char value[12];
+        formatTenths(value, sizeof(value), trend.weight * 10000.0f / (heightCm * heightCm));
+        snprintf(bmi, sizeof(bmi), ",\"bmi\":%s", value);
+    }
+    int length = snprintf(buffer, size,
+                          "{\"p_id\":%u,\"time\":\"%s\",\"n\":%u,\"weight\":%s,\"fat\":%s,\"water\":%s,\"muscle\":%s,"
+                          "\"min\":%s,\"max\":%s,\"slope\":%s%lu.%02lu%s}",
+                          userID, time, trend.count, weight, fat, water, muscle, lightest, heaviest, slope < 0 ? "-" : "",
+                          magnitude / 100, magnitude % 100, bmi);
+    return length > 0 && (size_t)length < size;
+}
+
+// the session a client belongs to, nullptr for one of no session
+ScaleSession *sessionOn(const NimBLEClient *client) {
+    for (size_t i = 0; i < scaleCount; i++) {
+        if (client != nullptr && scales[i].client == client) {
+            return &scales[i];
+        }
+    }
+    return nullptr;
+}
+
+// runs on the NimBLE host task: only enqueue, the publish task decodes and publishes. A frame
+// the scale indicates again (a history sync, a session cut short) is dropped here
+void queueFrame(ScaleSession &session, const uint8_t *data, size_t length) {
+    if (length > FRAME_MAX_LENGTH) {
+        frameQueue.countDrop(); // before the trace too, which must not copy more than a frame holds
+        return;
+    }
+    if (bleTrace) {
+        writeTrace(TraceType::INDICATION, session.index, data, length);
+    }
+    uint8_t userID;
+    uint32_t scaleTime;
+    bool keyed = frameKey(data, length, userID, scaleTime);
+    if (keyed && session.historyCursor.isRepeat(userID, scaleTime)) {
+        dedupHits.store(dedupHits.load() + 1); // single writer
+        session.framesReceived.store(session.framesReceived.load() + 1); // the scale is still sending
+        wakeTask(TaskId::BLE);
+        return;
+    }
+    if (frameQueue.push(data, length, millis(), session.index)) {
+        if (keyed) {
+            session.historyCursor.queued(userID, scaleTime);
+        }
+        session.framesReceived.store(session.framesReceived.load() + 1); // single writer
+    }
+    wakeTask(TaskId::PUBLISH);
+    wakeTask(TaskId::BLE); // counts the frames of the session
+}
+
+// runs on the NimBLE host task
+void handleConsentResponse(ScaleSession &session, const uint8_t *data, size_t length) {
+    if (length >= 3 && data[0] == UCP_OP_RESPONSE && data[1] == UCP_OP_CONSENT) {
+        session.ucpResult = data[2];
+        wakeTask(TaskId::BLE);
+    }
 }
 
 void indicateBodyComposition(NimBLERemoteCharacteristic *remoteCharacteristic, uint8_t *rawData, size_t length, bool isNotify) {
-    Serial.println("Body Composition indication received:");
-    logHexPayload(rawData, length);
+    if (ScaleSession *session = sessionOn(remoteCharacteristic->getClient())) {
+        queueFrame(*session, rawData, length);
+    }
+}
 
-    measurementCount++;
+void indicateUserControlPoint(NimBLERemoteCharacteristic *remoteCharacteristic, uint8_t *rawData, size_t length, bool isNotify) {
+    if (ScaleSession *session = sessionOn(remoteCharacteristic->getClient())) {
+        handleConsentResponse(*session, rawData, length);
+    }
+}
 
-    if (buildMeasurementFromBodyCompositionFrame(rawData, length)) {
-        storeMeasurement();
-        if(DEBUG) Serial.println("State -> PUBLISH_MEASUREMENT");
-        currentAppState = AppState::PUBLISH_MEASUREMENT;
-        return;
+// the session holding connection `connHandle`
+ScaleSession *sessionOnConnection(uint16_t connHandle) {
+    for (size_t i = 0; i < scaleCount; i++) {
+        NimBLEClient *client = scales[i].client;
+        if (client != nullptr && client->getConnHandle() == connHandle) {
+            return &scales[i];
+        }
+    }
+    return nullptr;
+}
+
+// runs on the NimBLE host task; a session set up from cached handles has no discovered
+// characteristics, so the NimBLEClient does not dispatch its indications to any callback
+int onGapEvent(ble_gap_event *event, void *arg) {
+    if (event->type != BLE_GAP_EVENT_NOTIFY_RX) {
+        return 0;
+    }
+    ScaleSession *session = sessionOnConnection(event->notify_rx.conn_handle);
+    if (session == nullptr || !session->usesCachedHandles) {
+        return 0;
+    }
+    uint8_t data[FRAME_MAX_LENGTH];
+    size_t length = OS_MBUF_PKTLEN(event->notify_rx.om);
+    size_t copied = length < sizeof(data) ? length : sizeof(data);
+    os_mbuf_copydata(event->notify_rx.om, 0, copied, data);
+
+    uint16_t handle = event->notify_rx.attr_handle;
+    if (handle == session->gattCache.handles().bodyComposition) {
+        if (length > copied) {
+            frameQueue.countDrop(); // longer than any Body Composition frame, never passed on cut short
+        } else {
+            queueFrame(*session, data, copied);
+        }
+    } else if (handle == session->userControlPointHandle) {
+        handleConsentResponse(*session, data, copied);
+    }
+    return 0;
+}
+
+static ble_gap_event_listener gapEventListener;
+
+void traceConnection(const ScaleSession &session, TraceType type, int reason) {
+    if (bleTrace) {
+        uint8_t code = reason;
+        writeTrace(type, session.index, &code, sizeof(code));
+    }
+}
+
+class ScaleClientCallbacks : public NimBLEClientCallbacks {
+    void onConnect(NimBLEClient *client) {
+        wakeTask(TaskId::BLE);
+    }
+
+    void onConnectFail(NimBLEClient *client, int reason) {
+        if (ScaleSession *session = sessionOn(client)) {
+            session->directConnectFailed = true;
+            traceConnection(*session, TraceType::CONNECT_FAILED, reason);
+        }
+        wakeTask(TaskId::BLE);
+    }
+
+    void onDisconnect(NimBLEClient *client, int reason) {
+        if (ScaleSession *session = sessionOn(client)) {
+            traceConnection(*session, TraceType::DISCONNECTED, reason);
+        }
+        wakeTask(TaskId::BLE);
+    }
+};
+
+static ScaleClientCallbacks clientCallbacks;
+
+bool userControlPointAvailable(const ScaleSession &session) {
+    return session.userControlPoint != nullptr || session.userControlPointHandle != 0;
+}
+
+void requestUserHistory(ScaleSession &session, const ScaleUser &user) {
+    uint8_t consent[4] = {UCP_OP_CONSENT, user.index, (uint8_t)(user.consentCode & 0xFF), (uint8_t)(user.consentCode >> 8)};
+    session.ucpResult = -1;
+    if (session.userControlPoint) {
+        session.userControlPoint->writeValue(consent, sizeof(consent), true);
+    } else {
+        gattWriteByHandle(session.client->getConnHandle(), session.userControlPointHandle, consent, sizeof(consent));
     }
+    LOG_INFO("Requested stored measurements of user %d", user.index);
+}
 
-    Serial.println("Skipping measurement payload: unsupported format");
+// Current Time characteristic value, false without a synced local time
+bool buildCurrentTimeData(uint8_t *timeData) {
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo)) {
+        return false;
+    }
+    uint16_t year = timeinfo.tm_year + 1900;
+    // tm_wday: 0=Sunday, 1=Monday...
+    // Scale expects: 1=Monday... 7=Sunday
+    uint8_t weekday = (timeinfo.tm_wday == 0) ? 7 : timeinfo.tm_wday;
+
+    timeData[0] = year & 0xFF;
+    timeData[1] = (year >> 8) & 0xFF;
+    timeData[2] = timeinfo.tm_mon + 1;
+    timeData[3] = timeinfo.tm_mday;
+    timeData[4] = timeinfo.tm_hour;
+    timeData[5] = timeinfo.tm_min;
+    timeData[6] = timeinfo.tm_sec;
+    timeData[7] = weekday;
+    timeData[8] = 0;
+    timeData[9] = 0;
+    return true;
 }
 
-bool connectToScaleDevice() {
-    Serial.printf("Connecting to %s\n", scaleDevice->getAddress().toString().c_str());
+void logTimeSet(const uint8_t *timeData) {
+    LOG_INFO("Time set to: %04d-%02d-%02d %02d:%02d:%02d", timeData[0] | (timeData[1] << 8), timeData[2], timeData[3],
+                  timeData[4], timeData[5], timeData[6]);
+}
 
-    pClient = NimBLEDevice::createClient();
+// fast path: read, write and subscribe by the handles of an earlier discovery,
+// returns false when one of them does not match the scale anymore
+bool setupFromCachedHandles(ScaleSession &session) {
+    const GattHandles &handles = session.gattCache.handles();
+    uint16_t connHandle = session.client->getConnHandle();
+    if (historySync && handles.userControlPoint == 0) {
+        return false; // cached without history sync, discover the User Data Service once
+    }
+
+    uint8_t battery[4];
+    size_t length = sizeof(battery);
+    if (!gattReadByHandle(connHandle, handles.batteryLevel, battery, length) || length != 1) {
+        return false;
+    }
+    session.batteryLevel = battery[0];
+    LOG_INFO("Initial Battery: %d%%", battery[0]);
+
+    uint8_t timeData[10];
+    if (buildCurrentTimeData(timeData)) {
+        unsigned long writeStartedAt = millis();
+        if (!gattWriteByHandle(connHandle, handles.currentTime, timeData, sizeof(timeData))) {
+            return false;
+        }
+        recordLatency(Operation::TIME_WRITE, millis() - writeStartedAt);
+        logTimeSet(timeData);
+    } else {
+        LOG_INFO("Time not set (no local time)");
+    }
 
-    if (!pClient->connect(scaleDevice)) {
-        NimBLEDevice::deleteClient(pClient);
-        pClient = nullptr;
+    static const uint8_t ENABLE_INDICATIONS[2] = {0x02, 0x00};
+    session.usesCachedHandles = true; // before the CCCD write, the first indication may follow right away
+    unsigned long subscribeStartedAt = millis();
+    if (!gattWriteByHandle(connHandle, handles.bodyCompositionCccd, ENABLE_INDICATIONS, sizeof(ENABLE_INDICATIONS))) {
+        session.usesCachedHandles = false;
         return false;
     }
+    recordLatency(Operation::SUBSCRIBE, millis() - subscribeStartedAt);
+    LOG_INFO("Subscribed to body composition measurement indications (cached handle)");
+
+    if (historySync) {
+        session.userControlPointHandle = handles.userControlPoint;
+        if (!gattWriteByHandle(connHandle, handles.userControlPointCccd, ENABLE_INDICATIONS, sizeof(ENABLE_INDICATIONS))) {
+            LOG_ERROR("User Control Point not available, skipping history sync");
+            session.userControlPointHandle = 0;
+        }
+    }
+    return true;
+}
+
+void updateScan(); // with the scan plan below
+
+bool connectToScaleDevice(ScaleSession &session) {
+    NimBLEClient *pClient = session.client;
+    // a direct connect to the cached address has already established the link
+    if (!pClient->isConnected()) {
+        if (!session.found) {
+            return false; // the direct connection dropped before it was set up
+        }
+        char address[18];
+        formatAddress(session.address, address, sizeof(address));
+        LOG_INFO("Connecting to %s", address);
+
+        // keeps the attributes of an earlier full discovery, the session normally runs on cached handles
+        if (bleTrace) {
+            writeTrace(TraceType::CONNECT_START, session.index);
+        }
+        unsigned long connectStartedAt = millis();
+        bool connected = pClient->connect(session.address, false);
+        recordLatency(Operation::CONNECT, millis() - connectStartedAt);
+        if (!connected) {
+            return false;
+        }
+        updateScan(); // the other sessions listen again during the discovery and the subscription
+    }
+    if (bleTrace) {
+        writeTrace(TraceType::CONNECTED, session.index);
+    }
+
+    NimBLEAddress peer = pClient->getPeerAddress();
+    session.address = peer; // a direct connect was not found by the scan
+    session.addressKey = packAddress(peer);
+    if (session.gattCache.matches(peer)) {
+        if (setupFromCachedHandles(session)) {
+            gattCacheHits++;
+            return true;
+        }
+        LOG_INFO("Cached GATT handles do not match the scale, running full discovery");
+        gattCacheMisses++;
+        session.gattCache.invalidate();
+    }
+
+    pClient->deleteServices(); // attributes of an earlier discovery may be stale
+    GattHandles handles;
+    formatAddress(peer, handles.address, sizeof(handles.address));
+    handles.addressType = peer.getType();
 
     // Battery Service
+    unsigned long discoveryStartedAt = millis();
     NimBLERemoteService *pSvcBattery = pClient->getService(SVC_BATTERY);
+    recordLatency(Operation::DISCOVERY, millis() - discoveryStartedAt);
     if (pSvcBattery) {
         NimBLERemoteCharacteristic *pChrBattery = pSvcBattery->getCharacteristic(CHR_BATTERY_LEVEL);
         if (pChrBattery) {
+            handles.batteryLevel = pChrBattery->getHandle();
             if (pChrBattery->canRead()) {
                 std::string value = pChrBattery->readValue();
                 if (value.length() > 0) {
-                    batteryLevel = value[0];
-                    Serial.printf("Initial Battery: %d%%\n", batteryLevel);
+                    session.batteryLevel = uint8_t(value[0]);
+                    LOG_INFO("Initial Battery: %d%%", uint8_t(value[0]));
                 }
             }
         }
     }
 
     // Current Time Service
+    discoveryStartedAt = millis();
     NimBLERemoteService *pSvcTime = pClient->getService(SVC_CURRENT_TIME);
+    recordLatency(Operation::DISCOVERY, millis() - discoveryStartedAt);
     if (pSvcTime) {
         NimBLERemoteCharacteristic *pChrTime = pSvcTime->getCharacteristic(CHR_CURRENT_TIME);
-        Serial.println(pChrTime->getValue()); // just to check if it exists
+        if (pChrTime) {
+            auto value = pChrTime->getValue(); // just to check if it exists
+            LOG_DEBUG_BYTES("Current time: ", value.data(), value.size());
+        }
 
         if (pChrTime && pChrTime->canWrite()) {
-            struct tm timeinfo;
-            if (getLocalTime(&timeinfo)) {
-                uint16_t year = timeinfo.tm_year + 1900;
-                uint8_t month = timeinfo.tm_mon + 1;
-                uint8_t day = timeinfo.tm_mday;
-                uint8_t hour = timeinfo.tm_hour;
-                uint8_t minute = timeinfo.tm_min;
-                uint8_t second = timeinfo.tm_sec;
-                // tm_wday: 0=Sunday, 1=Monday...
-                // Scale expects: 1=Monday... 7=Sunday
-                uint8_t weekday = (timeinfo.tm_wday == 0) ? 7 : timeinfo.tm_wday;
-
-                uint8_t timeData[10];
-                timeData[0] = year & 0xFF;
-                timeData[1] = (year >> 8) & 0xFF;
-                timeData[2] = month;
-                timeData[3] = day;
-                timeData[4] = hour;
-                timeData[5] = minute;
-                timeData[6] = second;
-                timeData[7] = weekday;
-                timeData[8] = 0;
-                timeData[9] = 0;
-
+            handles.currentTime = pChrTime->getHandle();
+            uint8_t timeData[10];
+            if (buildCurrentTimeData(timeData)) {
+                unsigned long writeStartedAt = millis();
                 pChrTime->writeValue(timeData, 10, true);
-                Serial.printf("Time set to: %04d-%02d-%02d %02d:%02d:%02d\n", year, month, day, hour, minute, second);
+                recordLatency(Operation::TIME_WRITE, millis() - writeStartedAt);
+                logTimeSet(timeData);
             } else {
-                Serial.println("Time not set (no local time)");
+                LOG_INFO("Time not set (no local time)");
             }
         }
     }
 
+    discoveryStartedAt = millis();
     NimBLERemoteService *pSvcBodyComposition = pClient->getService(SVC_BODY_COMPOSITION);
+    recordLatency(Operation::DISCOVERY, millis() - discoveryStartedAt);
     if (pSvcBodyComposition) {
-        Serial.println("Found Body Composition Service");
+        LOG_INFO("Found Body Composition Service");
         NimBLERemoteCharacteristic *pChrBodyComposition = pSvcBodyComposition->getCharacteristic(CHR_BODY_COMPOSITION_MEASUREMENT);
         if (pChrBodyComposition && pChrBodyComposition->canIndicate()) {
-            if (pChrBodyComposition->subscribe(false, indicateBodyComposition)) {
-                Serial.println("Subscribed to body composition measurement indications");
+            unsigned long subscribeStartedAt = millis();
+            bool subscribed = pChrBodyComposition->subscribe(false, indicateBodyComposition);
+            recordLatency(Operation::SUBSCRIBE, millis() - subscribeStartedAt);
+            if (subscribed) {
+                LOG_INFO("Subscribed to body composition measurement indications");
+                NimBLERemoteDescriptor *pCccd = pChrBodyComposition->getDescriptor(NimBLEUUID("2902"));
+                if (pCccd) {
+                    handles.bodyComposition = pChrBodyComposition->getHandle();
+                    handles.bodyCompositionCccd = pCccd->getHandle();
+                }
             } else {
-                Serial.println("Failed to subscribe to body composition measurement indications!");
+                LOG_ERROR("Failed to subscribe to body composition measurement indications!");
             }
         }
     }
 
+    if (historySync) {
+        discoveryStartedAt = millis();
+        NimBLERemoteService *pSvcUserData = pClient->getService(SVC_USER_DATA);
+        recordLatency(Operation::DISCOVERY, millis() - discoveryStartedAt);
+        if (pSvcUserData) {
+            NimBLERemoteCharacteristic *pChrUcp = pSvcUserData->getCharacteristic(CHR_USER_CONTROL_POINT);
+            if (pChrUcp && pChrUcp->canIndicate() && pChrUcp->subscribe(false, indicateUserControlPoint)) {
+                session.userControlPoint = pChrUcp;
+                NimBLERemoteDescriptor *pCccd = pChrUcp->getDescriptor(NimBLEUUID("2902"));
+                if (pCccd) {
+                    handles.userControlPoint = pChrUcp->getHandle();
+                    handles.userControlPointCccd = pCccd->getHandle();
+                }
+            } else {
+                LOG_ERROR("User Control Point not available, skipping history sync");
+            }
+        }
+    }
+
+    if (handles.bodyComposition != 0) {
+        session.gattCache.store(handles);
+    }
     return true;
 }
 
-bool disconnectFromScaleDevice() {
-    if (pClient && pClient->isConnected()) {
-        pClient->disconnect();
+bool disconnectFromScaleDevice(ScaleSession &session) {
+    if (session.client->isConnected()) {
+        session.client->disconnect();
         return true;
     }
     return false;
 }
 
-class BLEScanCallbacks : public NimBLEScanCallbacks {
-    void onResult(const NimBLEAdvertisedDevice *advertisedDevice) {
-        if (advertisedDevice->haveName()) {
-            String name = advertisedDevice->getName().c_str();
-            String mac = advertisedDevice->getAddress().toString().c_str();
+// a scale this session has connected to, is pinned to or has just found
+bool sessionKnows(const ScaleSession &session, const NimBLEAddress &address) {
+    if (session.gattCache.matches(address) || (session.pinned && address == session.pinnedAddress)) {
+        return true;
+    }
+    return (session.found || session.state != AppState::SCANNING) && session.addressKey == packAddress(address);
+}
+
+// waiting for a scale it has no address of: none cached yet, or the cached one not seen for
+// so long it was probably replaced
+bool sessionTakesNewScale(const ScaleSession &session) {
+    if (session.pinned || session.found || session.state != AppState::SCANNING) {
+        return false;
+    }
+    return !session.gattCache.valid() || millis() - session.lastSeenAt >= DIRECT_CONNECT_FALLBACK_MS;
+}
+
+// only with a single scale: the controller initiates one connection at a time and cannot
+// scan meanwhile, so a pending direct connect would keep the other scales from being found
+bool useDirectConnect(const ScaleSession &session) {
+    return scaleCount == 1 && session.gattCache.valid() && millis() - session.lastSeenAt < DIRECT_CONNECT_FALLBACK_MS;
+}
+
+// runs on the NimBLE host task for every advert in range, so the filter works on the
+// raw payload and the address bytes without allocating. A known address belongs to its
+// session, an unknown scale goes to the first session that still looks for one
+ScaleSession *sessionForAdvert(const NimBLEAdvertisedDevice *advertisedDevice) {
+    const NimBLEAddress &address = advertisedDevice->getAddress();
+    for (size_t i = 0; i < scaleCount; i++) {
+        if (sessionKnows(scales[i], address)) {
+            return &scales[i];
+        }
+    }
+    const std::vector<uint8_t> &payload = advertisedDevice->getPayload();
+    bool bodyComposition = advertHasService16(payload.data(), payload.size(), SCALE_SERVICE_UUID16);
+    for (size_t i = 0; i < scaleCount; i++) {
+        if (sessionTakesNewScale(scales[i]) &&
+            (bodyComposition || advertNameContains(payload.data(), payload.size(), scales[i].config->name))) {
+            return &scales[i];
+        }
+    }
+    return nullptr;
+}
 
-            // Serial.printf("Device: %s @ %s\n", name.c_str(), mac.c_str());
+// the adverts of the scales only, a crowded scan would overrun the log
+void traceAdvert(const ScaleSession &session, const NimBLEAdvertisedDevice *advertisedDevice) {
+    uint8_t data[TRACE_DATA_SIZE];
+    const NimBLEAddress &address = advertisedDevice->getAddress();
+    memcpy(data, address.getVal(), 6);
+    data[6] = address.getType();
+    const std::vector<uint8_t> &payload = advertisedDevice->getPayload();
+    size_t length = payload.size() < sizeof(data) - 7 ? payload.size() : sizeof(data) - 7;
+    memcpy(data + 7, payload.data(), length);
+    writeTrace(TraceType::ADVERT, session.index, data, 7 + length);
+}
 
-            if (name.indexOf(SCALE_DEVICE_NAME) >= 0) {
-                Serial.printf("Found Scale: %s @ %s\n", name.c_str(), mac.c_str());
-                NimBLEDevice::getScan()->stop();
-                scaleDevice = new NimBLEAdvertisedDevice(*advertisedDevice);
-                return;
+// finds the scales and, after a session, notices the scale powering down or waking up again
+class BLEScanCallbacks : public NimBLEScanCallbacks {
+    void onResult(const NimBLEAdvertisedDevice *advertisedDevice) {
+        ScaleSession *session = sessionForAdvert(advertisedDevice);
+        if (session == nullptr) {
+            return;
+        }
+        if (bleTrace) {
+            traceAdvert(*session, advertisedDevice);
+        }
+        if (session->state == AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) {
+            unsigned long now = millis();
+            if (now - session->advertAt > SCALE_WAKE_UP_GAP_MS) {
+                session->wokeUp = true; // powered down and woken by the next step-on
+                wakeTask(TaskId::BLE);
             }
+            session->advertAt = now;
+            return;
         }
+        if (session->state != AppState::SCANNING || session->found) {
+            return;
+        }
+        // the connect needs the controller; the BLE task restarts the scan for the others once the link is up
+        NimBLEDevice::getScan()->stop();
+        session->address = advertisedDevice->getAddress();
+        session->addressKey = packAddress(session->address);
+        session->found = true;
+        wakeTask(TaskId::BLE);
+        char address[18];
+        formatAddress(session->address, address, sizeof(address));
+        LOG_INFO("Found Scale @ %s", address);
     }
 };
 
 static BLEScanCallbacks scanCallbacks;
 
-void connectToMqtt() {
-    uint connectAttempts = 0;
-    while (!mqttClient.connected()) {
-        if (connectAttempts > 5) {
-            ESP.restart();
+void disconnectFromMqtt() {
+    mqttClient.disconnect();
+    LOG_INFO("MQTT disconnected");
+}
+
+void disconnectFromWifi() {
+    WiFi.disconnect(true);
+    wifiConnectStarted = false;
+    LOG_INFO("WiFi disconnected");
+}
+
+// the publish pipeline gives up after NETWORK_MAX_ATTEMPTS, the measurements wait in the log;
+// the background connection in persistent mode keeps retrying at the maximum backoff
+void failNetworkAttempt() {
+    networkRetry.fail();
+    LOG_INFO("Retrying in %lums", networkRetry.nextAttemptAt - millis());
+}
+
+// non-blocking WiFi connect, returns true once associated
+bool pollWifi() {
+    if (WiFi.status() == WL_CONNECTED) {
+        if (wifiConnectStarted) {
+            recordLatency(Operation::WIFI_ASSOCIATE, millis() - networkSetupStartedAt);
+            LOG_INFO("WiFi connected, IP address: %s", WiFi.localIP().toString().c_str());
+            wifiConnectStarted = false;
+            wifiConnectedAt = millis();
+            networkRetry.reset();
         }
-        connectAttempts++;
+        return true;
+    }
 
-        Serial.println("Attempting MQTT connection...");
-        if (mqttClient.connect("ESP32ScaleClientX", MQTT_SERVER_USER, MQTT_SERVER_PASSWORD)) {
-            Serial.println("MQTT connected");
-        } else {
-            Serial.print("failed, rc=");
-            Serial.print(mqttClient.state());
-            Serial.println(" try again in 2 seconds");
-            delay(2000);
+    if (!wifiConnectStarted) {
+        if (networkRetry.due()) {
+            LOG_INFO("Connecting to %s", WIFI_SSID);
+            WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+            wifiConnectStarted = true;
+            networkSetupStartedAt = millis();
         }
+    } else if (millis() - networkSetupStartedAt > WIFI_CONNECT_TIMEOUT_MS) {
+        LOG_ERROR("WiFi connect timeout");
+        WiFi.disconnect();
+        wifiConnectStarted = false;
+        failNetworkAttempt();
     }
+    return false;
 }
 
-void disconnectFromMqtt() {
-    mqttClient.disconnect();
-    Serial.println("MQTT disconnected");
+// connects to the broker once a retry is due, returns true once connected
+bool pollMqtt() {
+    if (mqttClient.connected()) {
+        return true;
+    }
+    if (!networkRetry.due()) {
+        return false;
+    }
+
+    LOG_INFO("Attempting MQTT connection...");
+    unsigned long attemptStartedAt = millis();
+    bool connected = mqttClient.connect("ESP32ScaleClientX", MQTT_SERVER_USER, MQTT_SERVER_PASSWORD);
+    recordLatency(Operation::MQTT_CONNECT, millis() - attemptStartedAt);
+    if (connected) {
+        LOG_INFO("MQTT connected");
+        // includes the WiFi association when this connect was part of a fresh setup
+        unsigned long networkStartedAt = networkSetupStartedAt ? networkSetupStartedAt : attemptStartedAt;
+        lastNetworkSetupMs = millis() - networkStartedAt;
+        networkSetupStartedAt = 0;
+        networkRetry.reset();
+        return true;
+    }
+
+    LOG_ERROR("MQTT connect failed, rc=%d", mqttClient.state());
+    failNetworkAttempt();
+    return false;
 }
 
-void connectToWifi() {
-    Serial.println();
-    Serial.print("Connecting to ");
-    Serial.println(WIFI_SSID);
+void trackWifiOnTime() {
+    unsigned long now = millis();
+    if (WiFi.status() == WL_CONNECTED) {
+        wifiOnTimeMs += now - wifiOnTimeCheckedAt;
+    }
+    wifiOnTimeCheckedAt = now;
+}
 
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+// keeps WiFi and MQTT up in the background while the publish pipeline is idle
+void maintainPersistentConnection() {
+    if (pollWifi() && pollMqtt()) {
+        mqttClient.loop(); // keep-alive
+    }
+}
 
-    uint connectAttempts = 0;
-    while (WiFi.status() != WL_CONNECTED) {
-        if (connectAttempts > 5) {
-            ESP.restart();
-        }
-        connectAttempts++;
+bool clockValid() {
+    return time(nullptr) > CLOCK_VALID_AFTER;
+}
 
-        delay(1000);
-        Serial.print(".");
+// local hour of the day, -1 before the clock was set
+int localHour() {
+    time_t now = time(nullptr);
+    struct tm timeinfo;
+    if (!clockValid() || localtime_r(&now, &timeinfo) == nullptr) {
+        return -1;
     }
+    return timeinfo.tm_hour;
+}
 
-    Serial.println("");
-    Serial.println("WiFi connected");
-    Serial.println("IP address: ");
-    Serial.println(WiFi.localIP());
+// the scan plan changes on the hour
+uint32_t msUntilNextHour() {
+    time_t now = time(nullptr);
+    struct tm timeinfo;
+    if (!clockValid() || localtime_r(&now, &timeinfo) == nullptr) {
+        return WAIT_FOREVER;
+    }
+    return ((59 - timeinfo.tm_min) * 60 + 60 - timeinfo.tm_sec) * 1000UL;
 }
 
-void disconnectFromWifi() {
-    WiFi.disconnect(true);
-    Serial.println("WiFi disconnected");
+// charges the receive time of the running wait for the scale and switches it to `params`
+void setScanRadio(ScanParams params) {
+    unsigned long now = millis();
+    if (params.intervalMs > 0 && !firstScanStarted) {
+        firstScanStarted = true;
+        bootToScanMs = now - setupStartedAt;
+        LOG_INFO("First scan %lums after boot", bootToScanMs);
+    }
+    if (scanParams.intervalMs > 0) {
+        scanRadioMs += uint64_t(now - scanParamsAt) * scanParams.windowMs / scanParams.intervalMs;
+    }
+    scanParams = params;
+    scanParamsAt = now;
+}
+
+// receive time of the waits for the scale, the running one charged up to now
+uint64_t scanRadioTotalMs() {
+    ScanParams params = scanParams;
+    if (params.intervalMs == 0) {
+        return scanRadioMs;
+    }
+    return scanRadioMs + uint64_t(millis() - scanParamsAt) * params.windowMs / params.intervalMs;
 }
 
-void startScan() {
+// the wait for the scales uses the duty cycle of the plan and the duplicate filter; the presence
+// watch needs every advert, so the filter is off, and stays passive so the scale gets no scan requests
+bool startScan(ScanMode mode, ScanParams params) {
     NimBLEScan *pBLEScan = NimBLEDevice::getScan();
-    pBLEScan->setScanCallbacks(&scanCallbacks);
-    if (pBLEScan->start(0, false)) {
-        Serial.println("BLE scan started successfully, waiting for scale device...");
-    } else {
-        Serial.println("Failed to start scan");
+    pBLEScan->setScanCallbacks(&scanCallbacks, mode == ScanMode::PRESENCE);
+    pBLEScan->setDuplicateFilter(mode == ScanMode::WAIT); // the controller reports each device once per scan, not every beacon interval
+    pBLEScan->setInterval(params.intervalMs);
+    pBLEScan->setWindow(params.windowMs);
+    if (!pBLEScan->start(0, false)) {
+        LOG_ERROR("Failed to start scan");
+        return false;
     }
+    if (mode == ScanMode::WAIT) {
+        LOG_DEBUG("BLE scan started (%u ms every %u ms), waiting for scale device...", params.windowMs, params.intervalMs);
+    }
+    return true;
 }
 
-String buildCurrentTimeString() {
-    time_t now = time(nullptr);
-    struct tm timeinfo;
-    if (localtime_r(&now, &timeinfo) != nullptr) {
-        char buffer[25];
-        strftime(buffer, sizeof(buffer), "%d.%m.%Y - %H:%M:%S ", &timeinfo);
-        return String(buffer);
+// starts, switches or stops the scan for what the sessions need after this pass, and charges
+// the receive time of the wait for a scale: the scan, or the direct connect of the single scale
+void updateScan() {
+    bool waiting = false;
+    bool presence = false;
+    ScanParams connectParams = {};
+    for (size_t i = 0; i < scaleCount; i++) {
+        const ScaleSession &session = scales[i];
+        AppState state = session.state;
+        presence = presence || state == AppState::WAIT_FOR_SCALE_TO_DISAPPEAR;
+        if (state != AppState::SCANNING || session.found) {
+            continue;
+        }
+        if (!session.directConnectStarted) {
+            waiting = waiting || !useDirectConnect(session); // else the session starts its direct connect with the next pass
+        } else if (!session.directConnectFailed) {
+            connectParams = session.directConnectParams;
+        }
+    }
+
+    ScanMode mode = presence ? ScanMode::PRESENCE : waiting ? ScanMode::WAIT : ScanMode::OFF;
+    ScanParams params = mode == ScanMode::PRESENCE ? CONTINUOUS_SCAN : scanSchedule.paramsAt(localHour());
+    NimBLEScan *pBLEScan = NimBLEDevice::getScan();
+    if (mode != scanMode || (mode != ScanMode::OFF && (!pBLEScan->isScanning() || params != scanModeParams))) {
+        pBLEScan->stop();
+        scanMode = mode;
+        scanModeParams = params;
+        if (mode != ScanMode::OFF) {
+            startScan(mode, params);
+        }
+        if (mode == ScanMode::PRESENCE) {
+            // adverts missed while the scan was off, for a connect, are neither absence nor a pause
+            for (size_t i = 0; i < scaleCount; i++) {
+                if (scales[i].state == AppState::WAIT_FOR_SCALE_TO_DISAPPEAR) {
+                    scales[i].advertAt = millis();
+                }
+            }
+        }
+    }
+
+    ScanParams radio = waiting && pBLEScan->isScanning() ? params : connectParams;
+    if (radio != scanParams) {
+        setScanRadio(radio);
     }
-    return String(now);
 }
 
-void syncTime() {
-    connectToWifi();
-    delay(100);
+// how long the BLE task may block for the scan: until the plan of the next hour, or until a
+// scan that failed to start is tried again
+uint32_t scanWaitMs() {
+    if (scanMode == ScanMode::OFF) {
+        return WAIT_FOREVER;
+    }
+    if (!NimBLEDevice::getScan()->isScanning()) {
+        return DIRECT_CONNECT_RETRY_MS;
+    }
+    return scanMode == ScanMode::WAIT ? msUntilNextHour() : WAIT_FOREVER;
+}
 
-    // Sync time via NTP
-    configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);
+// the updateScan() of the pass watches the adverts of the scale from now on
+void startPresenceWatch(ScaleSession &session) {
+    session.advertAt = millis();
+    session.wokeUp = false;
+    session.sessionEndedAt = millis();
+}
+
+void formatTime(char *buffer, size_t size, time_t at) {
     struct tm timeinfo;
-    if (getLocalTime(&timeinfo)) {
-        connectToMqtt();
-        mqttClient.publish((String(MAIN_TOPIC) + BOOT_TIME_TOPIC).c_str(), buildCurrentTimeString().c_str(), true);
-        mqttClient.loop();
-        delay(1000); // wait for publish
+    if (localtime_r(&at, &timeinfo) != nullptr) {
+        strftime(buffer, size, "%d.%m.%Y - %H:%M:%S ", &timeinfo);
+        return;
+    }
+    snprintf(buffer, size, "%ld", (long)at);
+}
+
+void formatCurrentTime(char *buffer, size_t size) {
+    formatTime(buffer, size, time(nullptr));
+}
+
+void publishValue(const TopicTable &topics, Topic topic, unsigned long value) {
+    char payload[12];
+    snprintf(payload, sizeof(payload), "%lu", value);
+    mqttClient.publish(topics[topic], payload, true);
+}
+
+// the topics of the scale a measurement came from; a record of a scale that is no longer
+// configured goes out under the main topic
+const TopicTable &topicsFor(uint8_t scale) {
+    return scale < scaleCount ? scales[scale].topics : TOPICS;
+}
+
+// no heap allocation: fixed buffers and the compile-time topic table. Only the measurement goes
+// at QoS 1; the status values before it are QoS 0, PubSubClient drops one that fails without a
+// word, and its PUBACK does not cover them. They are retained and refreshed with every measurement.
+// A record that cannot be formatted never will be, it is dropped and counted instead of blocking the log
+bool publishMeasurement(uint32_t seq) {
+    char measurementJson[MEASUREMENT_JSON_SIZE];
+    if (!writeMeasurementJson(measurementJson, sizeof(measurementJson))) {
+        unpublishableCount++;
+        LOG_ERROR("Logged measurement %lu cannot be formatted, dropped", (unsigned long)seq);
+        return true;
+    }
+
+    const TopicTable &topics = topicsFor(measurement.scale);
+    const ScaleSession *session = measurement.scale < scaleCount ? &scales[measurement.scale] : nullptr;
+    if (session) {
+        publishValue(topics, Topic::BATTERY_LEVEL, session->batteryLevel);
+    }
+    publishValue(TOPICS, Topic::LOOP_COUNT, loopCount);
+
+    char timeStr[25];
+    formatCurrentTime(timeStr, sizeof(timeStr));
+    mqttClient.publish(topics[Topic::MEASUREMENT_TIME], timeStr, true);
+
+    publishValue(TOPICS, Topic::MEASUREMENT_COUNT, measurementCount);
+    if (session) {
+        publishValue(topics, Topic::DEPARTURE_TIME, session->lastDepartureMs);
+        publishValue(topics, Topic::BACK_TO_BACK, session->backToBackCount);
+    }
+
+    if (persistentConnection) {
+        publishValue(TOPICS, Topic::WIFI_ON_TIME, wifiOnTimeMs / 1000);
+        publishValue(TOPICS, Topic::LATENCY_SAVED, latencySavedMs);
+    }
+
+    // the user's running statistics next to the raw value, as of the newest measurement folded in
+    const UserTrend *trend = session ? session->trends.of(measurement.pID) : nullptr;
+    char trendJson[TREND_JSON_SIZE];
+    if (trend && writeTrendJson(trendJson, sizeof(trendJson), measurement.pID, *trend)) {
+        mqttClient.publish(topics[Topic::TREND], trendJson, true);
+    }
+
+    if (!qos1.publish(topics[Topic::MEASUREMENT], measurementJson, true, seq)) {
+        return false;
+    }
+    if (bleTrace) {
+        writeTrace(TraceType::PUBLISHED, measurement.scale);
+    }
+    // the JSON does not fit a log event, the measurement itself was logged when it was stored
+    LOG_INFO("Published measurement %lu (user %u, %s)", (unsigned long)seq, measurement.pID, measurement.time);
+    return true;
+}
+
+// logs the decoded `measurement` of `session` and folds it into the trend of its user
+void recordMeasurement(ScaleSession &session) {
+    measurement.scale = session.index;
+    storeMeasurement();
+    session.historyCursor.advance(measurement.pID, measurement.scaleTime);
+    session.trends.fold(measurement.pID, measurement.scaleTime, measurement.weightKg, measurement.fatPercentage,
+                        measurement.waterPercentage, measurement.musclePercentage);
+}
+
+// decodes the oldest queued frame into the measurement log, returns false when the queue is empty
+bool logNextFrame() {
+    RawFrame frame;
+    if (!frameQueue.pop(frame)) {
+        return false;
+    }
+
+    LOG_INFO_BYTES("Body Composition indication received: ", frame.data, frame.length);
+    LOG_DEBUG("Frame was queued for %lums", millis() - frame.receivedAt);
+
+    measurementCount++;
+
+    if (frame.scale >= scaleCount) {
+        return true; // a session of a configuration before a restart
+    }
+    ScaleSession &session = scales[frame.scale];
+    if (frame.receivedAt - session.lastFrameReceivedAt > MULTIPLE_PACKET_GAP_MS) {
+        session.decoder.reset(); // a first packet this old lost its second one
+    }
+    session.lastFrameReceivedAt = frame.receivedAt;
+
+    BcmResult result = buildMeasurementFromBodyCompositionFrame(session.decoder, frame.data, frame.length);
+    if (result == BcmResult::PENDING) {
+        LOG_DEBUG("First packet of a multiple packet measurement, waiting for the second");
+        return true;
+    }
+    if (result == BcmResult::UNSUCCESSFUL) {
+        LOG_INFO("Scale reported an unsuccessful measurement");
+        return true;
+    }
+    if (result != BcmResult::COMPLETE) {
+        LOG_INFO("Skipping measurement payload: unsupported format");
+        return true;
+    }
+
+    if (!session.historyCursor.isNew(measurement.pID, measurement.scaleTime)) {
+        historySkippedCount++;
+        LOG_DEBUG("Skipping stored measurement %s of user %d, already published", measurement.time, measurement.pID);
+        return true;
+    }
+
+    recordMeasurement(session);
+    logRetryAt = millis(); // a new measurement brings out the backlog
+    return true;
+}
+
+// one CBOR message for the whole batch, all of one scale, the newest measurement also as JSON for dashboards.
+// The batch is tagged with its oldest record: none of them leaves the log before its PUBACK
+bool publishMeasurementBatch(const LogRecord *records, uint32_t count) {
+    uint8_t payload[MEASUREMENT_BATCH_SIZE];
+    CborWriter cbor(payload, sizeof(payload));
+    cbor.array(count);
+    for (uint32_t i = 0; i < count; i++) {
+        writeMeasurementCbor(cbor, records[i]);
+    }
+    if (!qos1.publish(topicsFor(records[0].scale)[Topic::MEASUREMENT_BATCH], payload, cbor.length(), false, records[0].seq)) {
+        return false;
+    }
+    LOG_DEBUG("Published batch of %lu measurements, %lu bytes", (unsigned long)count, (unsigned long)cbor.length());
+
+    loadMeasurement(records[count - 1]);
+    return publishMeasurement(records[count - 1].seq);
+}
+
+// hands the next batch of logged measurements to the broker, returns false once every
+// logged measurement is out; they leave the log as their PUBACKs come in
+bool publishLogBatch() {
+    uint32_t first = measurementLog.firstPendingSeq();
+    if (publishedThrough >= first) {
+        first = publishedThrough + 1;
+    }
+    if (first > measurementLog.newestSeq()) {
+        return false;
+    }
+    uint32_t count = measurementLog.newestSeq() + 1 - first;
+    if (count > LOG_REPLAY_BATCH) {
+        count = LOG_REPLAY_BATCH;
+    }
+    if (qos1.inFlight() + count + 1 > QOS1_IN_FLIGHT_MAX) {
+        return true; // the window is full, wait for acknowledgements
+    }
+    LogRecord records[LOG_REPLAY_BATCH];
+    uint32_t readable = 0;
+    for (uint32_t seq = first; seq < first + count; seq++) {
+        if (!measurementLog.read(seq, records[readable])) {
+            LOG_ERROR("Logged measurement %lu unreadable, skipped", (unsigned long)seq);
+            continue;
+        }
+        readable++;
+    }
+    if (binaryBatches && readable > 0) {
+        // a batch goes to the topic of one scale, the records of the next one wait for the next pass
+        uint32_t sameScale = 1;
+        while (sameScale < readable && records[sameScale].scale == records[0].scale) {
+            sameScale++;
+        }
+        if (!publishMeasurementBatch(records, sameScale)) {
+            return true; // the connection is closed, published again after the reconnect
+        }
+        if (sameScale < readable) {
+            publishedThrough = records[sameScale].seq - 1;
+            return true;
+        }
+    } else {
+        for (uint32_t i = 0; i < readable; i++) {
+            loadMeasurement(records[i]);
+            if (!publishMeasurement(records[i].seq)) {
+                publishedThrough = records[i].seq - 1;
+                return true;
+            }
+        }
+    }
+    publishedThrough = first + count - 1;
+    return true;
+}
+
+// reads the PUBACKs and drops the acknowledged measurements from the log; false when the
+// broker stopped answering
+bool pollPublishAcks() {
+    qos1.poll();
+    uint32_t oldest = qos1.oldestSeqInFlight();
+    measurementLog.ack(oldest ? oldest - 1 : publishedThrough);
+    return !qos1.timedOut(PUBACK_TIMEOUT_MS);
+}
+
+// the connection is gone: whatever was not acknowledged is published again after the reconnect
+void rewindPublishing() {
+    qos1.clear();
+    publishedThrough = measurementLog.firstPendingSeq() - 1;
+}
+
+// MQTT 3.1.1 resends unacknowledged messages after a reconnect, not on the same connection
+void reconnectAndRepublish() {
+    LOG_ERROR("%s", mqttClient.connected() ? "No PUBACK from the broker!" : "Lost MQTT while publishing!");
+    disconnectFromMqtt();
+    rewindPublishing();
+    networkRetry.reset();
+    currentPublishState = PublishState::WIFI_CONNECTING;
+    LOG_DEBUG("Publish -> WIFI_CONNECTING");
+}
+
+// the network stays unreachable: keep the measurements in the log and try again later
+void postponePublishing() {
+    LOG_ERROR("Network unreachable, %lu measurements kept for later", (unsigned long)measurementLog.pendingCount());
+    if (!persistentConnection) {
         disconnectFromMqtt();
+        disconnectFromWifi();
+    }
+    networkRetry.reset();
+    rewindPublishing();
+    logRetryAt = millis() + LOG_RETRY_MS;
+    currentPublishState = PublishState::IDLE;
+    LOG_DEBUG("Publish -> IDLE");
+}
 
-        Serial.println(&timeinfo, "Time synced: %A, %B %d %Y %H:%M:%S");
+// ends the session but keeps its client and the attributes for the next one, so a
+// session allocates nothing and the module can run without periodic restarts
+void cleanupBleSession(ScaleSession &session) {
+    session.userControlPoint = nullptr; // owned by the client
+    session.userControlPointHandle = 0;
+    session.usesCachedHandles = false;
+    if (session.client->isConnected()) {
+        session.client->disconnect();
     } else {
-        Serial.println("Failed to sync time");
+        session.client->cancelConnect(); // pending direct connect
     }
-    disconnectFromWifi();
+    session.found = false;
+    session.directConnectStarted = false;
 }
 
-void checkRestart() {
-    // restart the ESP at 01:00 every day to avoid memory leaks
-    time_t now;
-    struct tm timeinfo;
-    time(&now);
-    localtime_r(&now, &timeinfo);
-    if (timeinfo.tm_hour == 1 && timeinfo.tm_min == 0) {
-        Serial.println("Restarting ESP32 to avoid memory leaks...");
-        delay(5000); // Wait a bit before restarting
-        ESP.restart();
+// asynchronous connect to the cached address: the controller answers the first advert
+// of the scale with a connect request, without a scan result or a host round trip
+void startDirectConnect(ScaleSession &session) {
+    cleanupBleSession(session); // the previous attempt
+    session.directConnectFailed = false;
+    session.directConnectStarted = true;
+    session.stateTimer = millis();
+
+    // the connect scans with the duty cycle of the plan, in 0.625 ms units
+    ScanParams params = scanSchedule.paramsAt(localHour());
+    session.directConnectParams = params;
+    session.client->setConnectionParams(BLE_GAP_INITIAL_CONN_ITVL_MIN, BLE_GAP_INITIAL_CONN_ITVL_MAX, BLE_GAP_INITIAL_CONN_LATENCY,
+                                        BLE_GAP_INITIAL_SUPERVISION_TIMEOUT, params.intervalMs * 16 / 10, params.windowMs * 16 / 10);
+    if (bleTrace) {
+        writeTrace(TraceType::CONNECT_START, session.index);
+    }
+    if (session.client->connect(session.gattCache.address(), false, true)) {
+        LOG_DEBUG("Direct connect to %s started (%u ms every %u ms)", session.gattCache.handles().address, params.windowMs,
+                                params.intervalMs);
+    } else {
+        LOG_ERROR("Failed to start direct connect");
+        session.directConnectFailed = true;
     }
 }
 
-void cleanupBleSession() {
-    if (pClient != nullptr) {
-        if (pClient->isConnected()) {
-            pClient->disconnect();
-        }
-        NimBLEDevice::deleteClient(pClient);
-        pClient = nullptr;
+// a restart keeps the counters and the clock: the RTC timer keeps running through it, and if
+// it was reset anyway, the time the last task pass saw stands in until the next SNTP sync
+void restoreRetainedState() {
+    if (retained.magic != RETAINED_MAGIC) {
+        // power-on, RTC memory holds noise
+        retained.magic = RETAINED_MAGIC;
+        retained.loopCount = 0;
+        retained.measurementCount = 0;
+        retained.knownTime = 0;
+    } else if (!clockValid() && retained.knownTime > CLOCK_VALID_AFTER) {
+        struct timeval tv = {time_t(retained.knownTime), 0};
+        settimeofday(&tv, nullptr);
+        LOG_INFO("Clock restored from RTC memory");
+    }
+    timeSynced = clockValid();
+}
+
+// runs in the lwIP task for every SNTP answer
+void onTimeSync(struct timeval *tv) {
+    timeSynced = true;
+    wakeTask(TaskId::PUBLISH); // the boot time can go out
+}
+
+// NVS namespace of a scale's cache or cursor, the first scale keeps the one of the single-scale firmware
+const char *scaleNamespace(char *buffer, size_t size, const char *name, size_t index) {
+    if (index == 0) {
+        snprintf(buffer, size, "%s", name);
+    } else {
+        snprintf(buffer, size, "%s%u", name, unsigned(index));
     }
-    if (scaleDevice != nullptr) {
-        delete scaleDevice;
-        scaleDevice = nullptr;
+    return buffer;
+}
+
+// the sessions of `count` scales and what they keep in NVS
+void beginScales(const ScaleConfig *configs, size_t count) {
+    scaleCount = count < MAX_SCALES ? count : MAX_SCALES;
+    for (size_t i = 0; i < scaleCount; i++) {
+        ScaleSession &session = scales[i];
+        session.config = &configs[i];
+        session.index = i;
+        session.topics = joinTopics(topicsFit(configs[i].topic) ? configs[i].topic : MAIN_TOPIC);
+        session.pinned = configs[i].address[0] != '\0';
+        if (session.pinned) {
+            session.pinnedAddress = NimBLEAddress(std::string(configs[i].address), BLE_ADDR_PUBLIC);
+        }
+        char name[16];
+        session.gattCache.begin(scaleNamespace(name, sizeof(name), "gatt", i));
+        session.historyCursor.begin(scaleNamespace(name, sizeof(name), "history", i));
+        session.trends.begin(scaleNamespace(name, sizeof(name), "trends", i));
     }
+}
 
-    // disable BLE to free memory
-    // NimBLEDevice::deinit();
+// after NimBLEDevice::init(); one client per scale, each holds its link for the whole uptime
+void createScaleClients() {
+    for (size_t i = 0; i < scaleCount; i++) {
+        ScaleSession &session = scales[i];
+        if (session.client == nullptr) {
+            session.client = NimBLEDevice::createClient();
+            session.client->setClientCallbacks(&clientCallbacks, false);
+            session.client->setConnectTimeout(DIRECT_CONNECT_WINDOW_MS); // the NimBLE default, also used after a scan
+        }
+    }
 }
 
 void setup() {
-    Serial.begin(115200);
-    delay(SERIAL_STARTUP_DELAY_MS); // Wait for CDC Serial to initialize
-
-    // Configure PWM
-    ledcSetup(PWM_CHANNEL, PWM_FREQ, PWM_RESOLUTION);
-    ledcAttachPin(BLUE_LED_PIN, PWM_CHANNEL);
-    setLed(false);
+    setupStartedAt = millis();
+    Serial.begin(115200); // nothing waits for the USB host, the scan starts right away
+    eventLog.registerTask(xTaskGetCurrentTaskHandle()); // its lines wait for the log task
+    restoreRetainedState();
+
+    // Configure PWM, clocked from RC_FAST so the pulse keeps running through light sleep
+    ledc_timer_config_t ledTimer = {};
+    ledTimer.speed_mode = LEDC_LOW_SPEED_MODE;
+    ledTimer.duty_resolution = ledc_timer_bit_t(PWM_RESOLUTION);
+    ledTimer.timer_num = LEDC_TIMER_0;
+    ledTimer.freq_hz = PWM_FREQ;
+    ledTimer.clk_cfg = LEDC_USE_RTC8M_CLK;
+    ledc_timer_config(&ledTimer);
+    ledc_channel_config_t ledChannel = {};
+    ledChannel.gpio_num = BLUE_LED_PIN;
+    ledChannel.speed_mode = LEDC_LOW_SPEED_MODE;
+    ledChannel.channel = PWM_CHANNEL;
+    ledChannel.timer_sel = LEDC_TIMER_0;
+    ledChannel.duty = MAX_DUTY; // Active LOW, off
+    ledc_channel_config(&ledChannel);
+    ledc_fade_func_install(0);
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON);
+
+    // the SoC sleeps between the scan windows while every task blocks; needs a core built
+    // with CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    esp_pm_config_esp32c3_t pmConfig = {CPU_MAX_FREQ_MHZ, CPU_MIN_FREQ_MHZ, true};
+    if (esp_pm_configure(&pmConfig) != ESP_OK) {
+        LOG_ERROR("Automatic light sleep not available, the SoC stays awake between scan windows");
+    }
 
     mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
+    mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+    mqttClient.setKeepAlive(MQTT_KEEPALIVE_S);
     mqttClient.setServer(MQTT_SERVER_IP, MQTT_SERVER_PORT);
 
-    syncTime();
+    beginScales(SCALES, SCALE_COUNT);
+    measurementLog.begin();
+    scanSchedule.begin(QUIET_SCAN, BUSY_SCAN);
+
+    // SNTP syncs in the background whenever the publish pipeline has WiFi up
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);
 
     NimBLEDevice::init("ESP32_SCALE");
     NimBLEDevice::setPower(ESP_PWR_LVL_P21); // max power
+    ble_gap_event_listener_register(&gapEventListener, onGapEvent, nullptr);
+
+    createScaleClients();
+
+    // WiFi comes up while the scale link is still open, so it has to use modem
+    // sleep to let the coexistence arbiter hand the radio to BLE
+    WiFi.setSleep(true);
+    esp_coex_preference_set(ESP_COEX_PREFER_BALANCE);
+
+    startTasks();
 }
 
-void loop() {
-    checkRestart();
+// a link to one of the scales is up or being set up
+bool bleSessionActive() {
+    for (size_t i = 0; i < scaleCount; i++) {
+        AppState state = scales[i].state;
+        if (state == AppState::CONNECTING || state == AppState::SYNC_HISTORY || state == AppState::WAIT_FOR_MEASUREMENT) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    switch (currentAppState) {
-        case AppState::SCANNING:
-            if (scaleDevice != nullptr) {
-                if(DEBUG) Serial.println("State -> CONNECTING");
-                currentAppState = AppState::CONNECTING;
-            } else {
-                NimBLEScan *pScan = NimBLEDevice::getScan();
-                if (!pScan->isScanning()) {
-                    currentMaxBrightness = 0.3;
-                    setLedModeBlink(1000, 3000);
-                    startScan();
+// records how long the BLE session stayed in the state it just left
+void trackAppState(ScaleSession &session) {
+    if (session.state != session.trackedState) {
+        appStateDwell[size_t(session.trackedState)].record(millis() - session.stateEnteredAt);
+        session.trackedState = session.state;
+        session.stateEnteredAt = millis();
+    }
+}
+
+uint64_t tasksBusyUs() {
+    uint64_t busyUs = 0;
+    for (uint64_t us : taskBusyUs) {
+        busyUs += us;
+    }
+    return busyUs;
+}
+
+// share of the time since the last stats message that no task spent in a pass, in percent
+float cpuIdlePercent() {
+    unsigned long elapsedMs = millis() - statsAt;
+    if (elapsedMs == 0) {
+        return 100.0f;
+    }
+    float busyPercent = (tasksBusyUs() - statsBusyUs) / 10.0f / elapsedMs;
+    return busyPercent < 100.0f ? 100.0f - busyPercent : 0.0f;
+}
+
+// uptime, heap (free, largest free block, minimum ever free), CPU idle, boot to first scan (ms), scan receive time (s), the
+// chance to miss an advert of the scale with this hour's scan plan (%), repeated frames dropped at the
+// indication and after the decode, logged measurements dropped as unformattable, log lines dropped with their
+// ring full, and a [count,p50,p90,max] in ms per AppState and Operation that occurred; false if it does not fit
+bool writeStatsJson(char *buffer, size_t size) {
+    char cpuIdle[8];
+    formatTenths(cpuIdle, sizeof(cpuIdle), cpuIdlePercent());
+    int length = snprintf(buffer, size, "{\"up\":%lu,\"heap\":[%lu,%lu,%lu],\"cpuIdle\":%s,\"bootToScan\":%lu,\"scanRx\":%lu,\"advertMiss\":%u,\"dedup\":[%lu,%lu],\"unpublishable\":%lu,\"logDropped\":%lu",
+                          millis() / 1000, (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMaxAllocHeap(),
+                          (unsigned long)ESP.getMinFreeHeap(), cpuIdle, bootToScanMs, (unsigned long)(scanRadioTotalMs() / 1000),
+                          scanSchedule.paramsAt(localHour()).missPercent(), (unsigned long)dedupHits.load(),
+                          (unsigned long)historySkippedCount, (unsigned long)unpublishableCount,
+                          (unsigned long)eventLog.dropped());
+    for (size_t i = 0; i < APP_STATE_COUNT + size_t(Operation::COUNT); i++) {
+        const LatencyHistogram &histogram = i < APP_STATE_COUNT ? appStateDwell[i] : operationLatency[i - APP_STATE_COUNT];
+        if (histogram.count() == 0 || length < 0 || (size_t)length >= size) {
+            continue;
+        }
+        buffer[length++] = ',';
+        const char *name = i < APP_STATE_COUNT ? APP_STATE_NAMES[i] : OPERATION_NAMES[i - APP_STATE_COUNT];
+        length += histogram.format(buffer + length, size - length, name);
+    }
+    if (length < 0 || (size_t)length + 1 >= size) {
+        return false;
+    }
+    buffer[length++] = '}';
+    buffer[length] = '\0';
+    return true;
+}
+
+// once per publishing round, at QoS 1 so the disconnect waits for it too
+void publishStats() {
+    char statsJson[STATS_JSON_SIZE];
+    if (!writeStatsJson(statsJson, sizeof(statsJson))) {
+        LOG_ERROR("Stats do not fit STATS_JSON_SIZE");
+        return;
+    }
+    qos1.publish(TOPICS[Topic::STATS], statsJson, true, 0);
+    statsBusyUs = tasksBusyUs();
+    statsAt = millis();
+}
+
+// notices frames the indication callback queued during this session
+void trackSessionFrames(ScaleSession &session) {
+    uint32_t received = session.framesReceived - session.frameBase;
+    if (received != session.measurementCount) {
+        session.measurementCount = received;
+        session.lastIndicationAt = millis();
+    }
+}
+
+// what brings the network up: logged measurements and, after a power-on, the clock; the boot
+// time only goes out on its own over a connection that is up anyway
+bool publishingWanted() {
+    if (measurementLog.pendingCount() > 0) {
+        return true;
+    }
+    return mqttClient.connected() ? bootTimePending && timeSynced : !timeSynced;
+}
+
+// WiFi stays up for the first SNTP answer after a power-on, at most NTP_SYNC_TIMEOUT_MS
+bool awaitingTimeSync() {
+    return !timeSynced && millis() - wifiConnectedAt < NTP_SYNC_TIMEOUT_MS;
+}
+
+// smartscale/bootTime, once per boot as soon as the clock is known
+void publishBootTime() {
+    if (!bootTimePending || !timeSynced) {
+        return;
+    }
+    char timeStr[25];
+    formatTime(timeStr, sizeof(timeStr), time(nullptr) - time_t((millis() - setupStartedAt) / 1000));
+    if (qos1.publish(TOPICS[Topic::BOOT_TIME], timeStr, true, 0)) {
+        bootTimePending = false;
+        LOG_INFO("Boot time %s", timeStr);
+    }
+}
+
+void runPublishPipeline() {
+    switch (currentPublishState) {
+        case PublishState::IDLE:
+            if (publishingWanted() && (mqttClient.connected() || (long)(millis() - logRetryAt) >= 0)) {
+                if (mqttClient.connected()) {
+                    // persistent connection: the handshake this publish would have paid for was saved
+                    latencySavedMs += measurementLog.pendingCount() > 0 ? lastNetworkSetupMs : 0;
+                    currentPublishState = PublishState::PUBLISHING;
+                    LOG_DEBUG("Publish -> PUBLISHING");
+                } else {
+                    networkRetry.reset();
+                    currentPublishState = PublishState::WIFI_CONNECTING;
+                    LOG_DEBUG("Publish -> WIFI_CONNECTING");
                 }
+            } else if (persistentConnection) {
+                maintainPersistentConnection();
             }
             break;
 
-        case AppState::CONNECTING:
-            loopCount++;
+        case PublishState::WIFI_CONNECTING:
+            if (pollWifi()) {
+                currentPublishState = PublishState::MQTT_CONNECTING;
+                LOG_DEBUG("Publish -> MQTT_CONNECTING");
+            } else if (networkRetry.exhausted()) {
+                postponePublishing();
+            }
+            break;
 
-            setLedModeBlink(50, 100);
+        case PublishState::MQTT_CONNECTING:
+            if (WiFi.status() != WL_CONNECTED) {
+                LOG_ERROR("Lost WiFi while connecting to MQTT!");
+                wifiConnectStarted = false;
+                currentPublishState = PublishState::WIFI_CONNECTING;
+                LOG_DEBUG("Publish -> WIFI_CONNECTING");
+            } else if (pollMqtt()) {
+                currentPublishState = PublishState::PUBLISHING;
+                LOG_DEBUG("Publish -> PUBLISHING");
+            } else if (networkRetry.exhausted()) {
+                postponePublishing();
+            }
+            break;
 
-            if (connectToScaleDevice()) {
-                currentMaxBrightness = 1.0;
-                setLedModeBlink(500, 500);
-                stateTimer = millis(); // reset timer for the next delayed state
-                currentAppState = AppState::WAIT_FOR_MEASUREMENT;
-                Serial.println("Waiting for measurement or timeout(30sec)...");
-                if(DEBUG) Serial.println("State -> WAIT_FOR_MEASUREMENT");
-            } else {
-                Serial.println("Failed to connect, restarting scan...");
-                cleanupBleSession();
+        case PublishState::PUBLISHING:
+            if (!mqttClient.connected() || !pollPublishAcks()) {
+                reconnectAndRepublish();
+            } else if (!publishLogBatch()) { // one batch per pass, so a backlog does not stall the task
+                publishBootTime();
+                publishStats();
+                currentPublishState = PublishState::WAIT_FOR_PUBLISH;
+                LOG_DEBUG("Publish -> WAIT_FOR_PUBLISH");
+            }
+            break;
 
-                currentAppState = AppState::SCANNING;
-                if(DEBUG) Serial.println("State -> SCANNING");
+        case PublishState::WAIT_FOR_PUBLISH:
+            if (!mqttClient.connected() || !pollPublishAcks()) {
+                reconnectAndRepublish();
+            } else if (measurementLog.newestSeq() > publishedThrough || (bootTimePending && timeSynced)) {
+                // another frame arrived over the still open BLE link, or SNTP just set the clock
+                currentPublishState = PublishState::PUBLISHING;
+                LOG_DEBUG("Publish -> PUBLISHING");
+            } else if (qos1.inFlight() == 0 && !bleSessionActive() && !awaitingTimeSync()) {
+                // the broker has everything, no need to wait any longer
+                if (!timeSynced) {
+                    LOG_INFO("No SNTP answer, the clock is set with the next publishing round");
+                    logRetryAt = millis() + LOG_RETRY_MS;
+                }
+                if (!persistentConnection) {
+                    disconnectFromMqtt();
+                    disconnectFromWifi();
+                }
+                currentPublishState = PublishState::IDLE;
+                LOG_DEBUG("Publish -> IDLE");
+            } else if (qos1.inFlight() == 0) {
+                mqttClient.loop(); // keep-alive while the BLE session lingers
             }
             break;
+    } // end switch publish state
+}
 
-        case AppState::WAIT_FOR_MEASUREMENT:
-            if (millis() - stateTimer > WAIT_FOR_MEASUREMENT_TIMEOUT_MS) {
-                Serial.println("Measurement timeout, disconnecting...");
+// BLE session state machine of one scale, one step per pass of the BLE task
+void runBleSession(ScaleSession &session) {
+    switch (session.state) {
+        case AppState::SCANNING:
+            if (session.scanStartedAt == 0) {
+                session.scanStartedAt = millis(); // a restart of the scan or the direct connect continues the same wait
+            }
+            if (session.found || session.client->isConnected()) {
+                recordLatency(Operation::SCAN, millis() - session.scanStartedAt);
+                session.scanStartedAt = 0;
+                session.stepOnAt = millis();
+                scanSchedule.recordSession(localHour());
+                LOG_DEBUG("Scale %u State -> CONNECTING", session.index);
+                session.state = AppState::CONNECTING;
+            } else if (useDirectConnect(session)) {
+                bool planChanged = session.directConnectStarted && !session.directConnectFailed &&
+                                   scanSchedule.paramsAt(localHour()) != session.directConnectParams;
+                if (!session.directConnectStarted || planChanged ||
+                    (session.directConnectFailed && millis() - session.stateTimer > DIRECT_CONNECT_RETRY_MS)) {
+                    startDirectConnect(session);
+                }
+            } else if (session.directConnectStarted) {
+                LOG_INFO("Cached scale not seen for a long time, scanning by name");
+                cleanupBleSession(session); // updateScan() starts the scan
+            }
+            break;
 
-                disconnectFromScaleDevice();
-                cleanupBleSession();
+        case AppState::CONNECTING:
+            loopCount++;
 
-                stateTimer = millis();
-                currentAppState = AppState::WAIT_FOR_SCALE_TO_DISAPPEAR;
-                if(DEBUG) Serial.println("State -> WAIT_FOR_SCALE_TO_DISAPPEAR");
+            session.frameBase = session.framesReceived;
+            session.measurementCount = 0;
+            if (connectToScaleDevice(session)) {
+                if (bleTrace) {
+                    writeTrace(TraceType::SUBSCRIBED, session.index);
+                }
+                session.lastSeenAt = millis();
+                if (session.departedAt != 0 && session.stepOnAt - session.departedAt < BACK_TO_BACK_MS) {
+                    // the fixed wait for the scale to power down would have missed this one
+                    session.backToBackCount++;
+                    LOG_INFO("Back-to-back session %lums after the scale powered down", session.stepOnAt - session.departedAt);
+                }
+                session.departedAt = 0;
+                session.stateTimer = millis(); // reset timer for the next delayed state
+                if (userControlPointAvailable(session)) {
+                    session.historyUser = 0;
+                    session.historyConsentSent = false;
+                    session.state = AppState::SYNC_HISTORY;
+                    LOG_DEBUG("Scale %u State -> SYNC_HISTORY", session.index);
+                } else {
+                    session.state = AppState::WAIT_FOR_MEASUREMENT;
+                    LOG_INFO("Waiting for measurement or timeout(30sec)...");
+                    LOG_DEBUG("Scale %u State -> WAIT_FOR_MEASUREMENT", session.index);
+                }
+            } else {
+                LOG_ERROR("Failed to connect, restarting scan...");
+                cleanupBleSession(session);
 
-            } else if (!pClient || !pClient->isConnected()) {
-                Serial.println("Lost connection while waiting for measurement!");
-                cleanupBleSession();
+                session.state = AppState::SCANNING;
+                LOG_DEBUG("Scale %u State -> SCANNING", session.index);
+            }
+            break;
 
-                currentAppState = AppState::SCANNING;
-                if(DEBUG) Serial.println("State -> SCANNING");
+        case AppState::SYNC_HISTORY:
+            trackSessionFrames(session);
+
+            if (!session.client->isConnected() || session.historyUser >= sizeof(SCALE_USERS) / sizeof(SCALE_USERS[0])) {
+                // WAIT_FOR_MEASUREMENT handles a lost connection
+                session.stateTimer = millis();
+                session.state = AppState::WAIT_FOR_MEASUREMENT;
+                LOG_INFO("Waiting for measurement or timeout(30sec)...");
+                LOG_DEBUG("Scale %u State -> WAIT_FOR_MEASUREMENT", session.index);
+            } else if (!session.historyConsentSent) {
+                requestUserHistory(session, SCALE_USERS[session.historyUser]);
+                session.historyConsentSent = true;
+                session.historyTimer = millis();
+            } else {
+                int16_t result = session.ucpResult;
+                unsigned long quietSince = max(session.historyTimer, session.lastIndicationAt);
+                bool complete = result == UCP_RESULT_SUCCESS && millis() - quietSince > HISTORY_QUIET_MS;
+                bool refused = result != -1 && result != UCP_RESULT_SUCCESS;
+
+                if (complete || refused || millis() - session.historyTimer > HISTORY_USER_TIMEOUT_MS) {
+                    if (refused) {
+                        LOG_ERROR("Scale refused consent for user %d (result %d)", SCALE_USERS[session.historyUser].index, result);
+                    }
+                    session.historyUser++;
+                    session.historyConsentSent = false;
+                }
             }
             break;
 
-        case AppState::PUBLISH_MEASUREMENT:
-            disconnectFromScaleDevice();
-            cleanupBleSession();
+        case AppState::WAIT_FOR_MEASUREMENT:
+            trackSessionFrames(session);
+
+            if (session.measurementCount > 0 && millis() - session.lastIndicationAt > MEASUREMENT_LINGER_MS) {
+                LOG_INFO("Received %u measurement(s), disconnecting...", session.measurementCount);
+
+                disconnectFromScaleDevice(session);
+                cleanupBleSession(session);
 
-            connectToWifi();
-            connectToMqtt();
+                LOG_INFO("Waiting for scale to disappear...");
+                startPresenceWatch(session);
+                session.stateTimer = millis();
+                session.state = AppState::WAIT_FOR_SCALE_TO_DISAPPEAR;
+                LOG_DEBUG("Scale %u State -> WAIT_FOR_SCALE_TO_DISAPPEAR", session.index);
 
-            // Publish battery level
-            char batteryStr[4];
-            snprintf(batteryStr, sizeof(batteryStr), "%d", batteryLevel);
-            mqttClient.publish((String(MAIN_TOPIC) + BATTERY_LEVEL_TOPIC).c_str(), batteryStr, true);
-            mqttClient.publish(MEASUREMENT_COUNT_TOPIC, String(measurementCount).c_str(), true);
-            mqttClient.publish(LOOP_COUNT_TOPIC, String(loopCount).c_str(), true);
-            {
-                String measurementJson;
-                if (generateMeasurementJson(measurementJson)) {
-                    char topic[64];
+            } else if (session.measurementCount == 0 && millis() - session.stateTimer > WAIT_FOR_MEASUREMENT_TIMEOUT_MS) {
+                LOG_ERROR("Measurement timeout, disconnecting...");
 
-                    snprintf(topic, sizeof(topic), "%s%s", MAIN_TOPIC, MEASUREMENT_TOPIC);
-                    mqttClient.publish(topic, measurementJson.c_str(), true);
+                disconnectFromScaleDevice(session);
+                cleanupBleSession(session);
 
-                    snprintf(topic, sizeof(topic), "%s%s", MAIN_TOPIC, MEASUREMENT_TIME_TOPIC);
-                    mqttClient.publish(topic, buildCurrentTimeString().c_str(), true);
+                startPresenceWatch(session);
+                session.stateTimer = millis();
+                session.state = AppState::WAIT_FOR_SCALE_TO_DISAPPEAR;
+                LOG_DEBUG("Scale %u State -> WAIT_FOR_SCALE_TO_DISAPPEAR", session.index);
 
-                    char countStr[12];
-                    snprintf(countStr, sizeof(countStr), "%d", measurementCount);
-                    snprintf(topic, sizeof(topic), "%s%s", MAIN_TOPIC, MEASUREMENT_COUNT_TOPIC);
-                    mqttClient.publish(topic, countStr, true);
+            } else if (!session.client->isConnected()) {
+                cleanupBleSession(session);
 
-                    Serial.printf("Published measurement: %s\n", measurementJson.c_str());
+                if (session.measurementCount > 0) {
+                    // the scale usually powers down on its own once it has delivered its frames
+                    LOG_INFO("Scale disconnected, waiting for scale to disappear...");
+                    startPresenceWatch(session);
+                    session.stateTimer = millis();
+                    session.state = AppState::WAIT_FOR_SCALE_TO_DISAPPEAR;
+                    LOG_DEBUG("Scale %u State -> WAIT_FOR_SCALE_TO_DISAPPEAR", session.index);
                 } else {
-                    Serial.println("No valid measurement to publish");
+                    LOG_ERROR("Lost connection while waiting for measurement!");
+                    session.state = AppState::SCANNING;
+                    LOG_DEBUG("Scale %u State -> SCANNING", session.index);
                 }
             }
+            break;
 
-            mqttClient.loop();  // process MQTT
+        case AppState::WAIT_FOR_SCALE_TO_DISAPPEAR: {
+            unsigned long lastAdvertAt = session.advertAt;
+            bool gone = millis() - lastAdvertAt > SCALE_ABSENT_MS;
+            if (gone || session.wokeUp || millis() - session.stateTimer > BT_DISCONNECT_DELAY_MS) {
+                session.departedAt = lastAdvertAt; // after a wake-up, the advert that ended the pause
+                if (session.wokeUp) {
+                    LOG_INFO("Scale woke up again");
+                } else if (gone) {
+                    session.lastDepartureMs = lastAdvertAt - session.sessionEndedAt;
+                    LOG_INFO("Scale powered down %lums after the session", (unsigned long)session.lastDepartureMs);
+                } else {
+                    LOG_INFO("Scale still advertising, scanning again");
+                }
 
-            stateTimer = millis();
-            currentAppState = AppState::WAIT_FOR_PUBLISH;
-            if(DEBUG) Serial.println("State -> WAIT_FOR_PUBLISH");
+                session.stateTimer = millis();
+                session.state = AppState::SCANNING;
+                LOG_DEBUG("Scale %u State -> SCANNING", session.index);
+            }
+            break;
+        }
+
+        default:
             break;
+    } // end switch app state
+}
+
+// the LED follows the session furthest along: a fast blink while connecting, a bright pulse
+// while connected, a pulse dimming out over the longest wait for the scale to power down,
+// and a slow one while waiting for the scales
+void updateLed() {
+    LedShow show = LedShow::SCANNING;
+    for (size_t i = 0; i < scaleCount; i++) {
+        LedShow shown = LedShow::SCANNING;
+        switch (scales[i].state) {
+            case AppState::CONNECTING: shown = LedShow::CONNECTING; break;
+            case AppState::SYNC_HISTORY:
+            case AppState::WAIT_FOR_MEASUREMENT: shown = LedShow::CONNECTED; break;
+            case AppState::WAIT_FOR_SCALE_TO_DISAPPEAR: shown = LedShow::DISAPPEARING; break;
+            default: break;
+        }
+        show = max(show, shown);
+    }
+    if (show == ledShow) {
+        return;
+    }
+    ledShow = show;
+    switch (show) {
+        case LedShow::CONNECTING: setLedModeBlink(50, 100); break;
+        case LedShow::CONNECTED: setLedModeBlink(500, 500, FULL_BRIGHTNESS); break;
+        case LedShow::DISAPPEARING: setLedModeBlink(500, 500, DEFAULT_MAX_BRIGHTNESS, BT_DISCONNECT_DELAY_MS); break;
+        default: setLedModeBlink(1000, 3000); break;
+    }
+}
+
+// ms from now until `deadline` (a millis() value), 0 once it passed
+uint32_t msUntil(unsigned long deadline) {
+    long remaining = (long)(deadline - millis());
+    return remaining > 0 ? remaining : 0;
+}
 
-        case AppState::WAIT_FOR_PUBLISH:
-            if (millis() - stateTimer > WAIT_FOR_PUBLISH_DELAY_MS) {
-                disconnectFromMqtt();
-                Serial.println("Waiting for scale to disappear...");
+// how long the BLE task may block after a pass for this session: until the next timeout of
+// its state. The NimBLE callbacks wake it for a scan result, a connect, a disconnect, a frame,
+// a consent response and a scale that woke up again
+uint32_t bleSessionWaitMs(const ScaleSession &session) {
+    switch (session.state) {
+        case AppState::SCANNING:
+            if (session.found || session.client->isConnected()) {
+                return 0;
+            }
+            if (session.directConnectStarted) {
+                return session.directConnectFailed ? msUntil(session.stateTimer + DIRECT_CONNECT_RETRY_MS + 1) : msUntilNextHour();
+            }
+            return useDirectConnect(session) ? 0 : WAIT_FOREVER; // scanWaitMs() covers the scan
 
-                stateTimer = millis();
-                currentAppState = AppState::WAIT_FOR_SCALE_TO_DISAPPEAR;
-                if(DEBUG) Serial.println("State -> WAIT_FOR_SCALE_TO_DISAPPEAR");
+        case AppState::SYNC_HISTORY:
+            if (!session.historyConsentSent) {
+                return 0;
             }
-            break;
+            return min(msUntil(max(session.historyTimer, session.lastIndicationAt) + HISTORY_QUIET_MS + 1),
+                       msUntil(session.historyTimer + HISTORY_USER_TIMEOUT_MS + 1));
+
+        case AppState::WAIT_FOR_MEASUREMENT:
+            if (session.measurementCount > 0) {
+                return msUntil(session.lastIndicationAt + MEASUREMENT_LINGER_MS + 1);
+            }
+            return msUntil(session.stateTimer + WAIT_FOR_MEASUREMENT_TIMEOUT_MS + 1);
 
         case AppState::WAIT_FOR_SCALE_TO_DISAPPEAR:
-            currentMaxBrightness = map(millis() - stateTimer, 0, BT_DISCONNECT_DELAY_MS, DEFAULT_MAX_BRIGHTNESS, 0);
-            currentMaxBrightness = constrain(currentMaxBrightness, 0, DEFAULT_MAX_BRIGHTNESS);
+            return min(msUntil(session.advertAt + SCALE_ABSENT_MS + 1), msUntil(session.stateTimer + BT_DISCONNECT_DELAY_MS + 1));
+
+        default:
+            return 0;
+    }
+}
+
+// the sessions one after the other, then the scan and the LED for all of them
+uint32_t bleTaskPass() {
+    bool wasActive = bleSessionActive();
+    for (size_t i = 0; i < scaleCount; i++) {
+        runBleSession(scales[i]);
+        trackAppState(scales[i]);
+    }
+    updateScan();
+    updateLed();
+    if (wasActive && !bleSessionActive()) {
+        wakeTask(TaskId::PUBLISH); // WAIT_FOR_PUBLISH disconnects once the sessions are over
+    }
+    uint32_t waitMs = scanWaitMs();
+    for (size_t i = 0; i < scaleCount; i++) {
+        waitMs = min(waitMs, bleSessionWaitMs(scales[i]));
+    }
+    return waitMs;
+}
 
-            if (millis() - stateTimer > BT_DISCONNECT_DELAY_MS) {
+// how long the publish task may block after a pass; a queued frame and the end of a BLE
+// session wake it, the network side has no events and is polled
+uint32_t publishWaitMs() {
+    if (!frameQueue.empty()) {
+        return 0;
+    }
+    switch (currentPublishState) {
+        case PublishState::IDLE:
+            if (persistentConnection) {
+                return mqttClient.connected() ? MQTT_KEEPALIVE_POLL_MS : NETWORK_POLL_MS;
+            }
+            return publishingWanted() ? msUntil(logRetryAt) : WAIT_FOREVER;
+
+        case PublishState::WIFI_CONNECTING:
+        case PublishState::MQTT_CONNECTING:
+            return NETWORK_POLL_MS;
+
+        case PublishState::PUBLISHING:
+            return 0;
 
-                stateTimer = millis();
-                currentAppState = AppState::SCANNING;
-                if(DEBUG) Serial.println("State -> SCANNING");
+        case PublishState::WAIT_FOR_PUBLISH:
+            if (qos1.inFlight() > 0) {
+                return PUBACK_POLL_MS;
             }
-            break;
+            return bleSessionActive() || awaitingTimeSync() ? MQTT_KEEPALIVE_POLL_MS : 0;
+    }
+    return 0;
+}
 
-    } // end switch app state
+uint32_t publishTaskPass() {
+    trackWifiOnTime();
+    logNextFrame(); // one frame per pass, so a burst does not stall the pipeline
+    runPublishPipeline();
+    return publishWaitMs();
+}
 
-    switch (currentLedMode) {
-        case LedMode::PULSE: {
-            unsigned long period = blinkOnDurationMs + blinkOffDurationMs;
-            if (period == 0)
-                period = 1000;
+// writes the log lines the other tasks left, blocking on the UART here instead of in them
+uint32_t logTaskPass() {
+    while (eventLog.drainOne()) {
+    }
+    return WAIT_FOREVER;
+}
 
-            float phase = (float)(millis() % period) / period * 2 * PI;
-            float val = (1.0f - cos(phase)) / 2.0f;
+struct AppTask {
+    TaskId id;
+    const char *name;
+    uint32_t (*pass)(); // returns how long the task may block, WAIT_FOREVER until it is woken
+    StackType_t *stack;
+    uint32_t stackSize; // bytes, as ESP-IDF counts them
+    UBaseType_t priority;
+    StaticTask_t buffer;
+};
 
-            int brightness = val * currentMaxBrightness;
-            int duty = MAX_DUTY - brightness; // Active LOW
-            ledcWrite(PWM_CHANNEL, duty);
-            break;
-        }
+StackType_t bleTaskStack[6144];
+StackType_t publishTaskStack[6144];
+StackType_t ledTaskStack[2048];
+StackType_t logTaskStack[3072];
+
+// the BLE session runs above the others, its timing matters most; the Arduino loop task had priority 1
+AppTask appTasks[] = {
+    {TaskId::BLE, "ble", bleTaskPass, bleTaskStack, sizeof(bleTaskStack), 3},
+    {TaskId::PUBLISH, "publish", publishTaskPass, publishTaskStack, sizeof(publishTaskStack), 2},
+    {TaskId::LED, "led", ledTaskPass, ledTaskStack, sizeof(ledTaskStack), 1},
+    {TaskId::LOG, "log", logTaskPass, logTaskStack, sizeof(logTaskStack), 1},
+};
 
-        case LedMode::OFF:
-            break;
-    } // end switch led mode
+static_assert(sizeof(appTasks) / sizeof(appTasks[0]) == size_t(TaskId::COUNT), "one AppTask per TaskId");
+
+uint32_t runTaskPass(AppTask &task) {
+    unsigned long startedAt = micros();
+    uint32_t waitMs = task.pass();
+    if (timeSynced) {
+        retained.knownTime = uint32_t(time(nullptr));
+    }
+    taskBusyUs[size_t(task.id)] += micros() - startedAt;
+    taskPasses[size_t(task.id)]++;
+    return waitMs;
+}
+
+void taskMain(void *parameter) {
+    AppTask &task = *static_cast<AppTask *>(parameter);
+    for (;;) {
+        uint32_t waitMs = runTaskPass(task);
+        // at least a tick, so a task with more work to do still lets the lower priority ones run
+        ulTaskNotifyTake(pdTRUE, waitMs == WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(waitMs > 0 ? waitMs : 1));
+    }
+}
+
+// stacks and queues are static, nothing here touches the heap
+void startTasks() {
+    ledCommands.begin();
+    // every task has its log ring before the first one runs
+    vTaskSuspendAll();
+    for (AppTask &task : appTasks) {
+        taskHandles[size_t(task.id)] =
+            xTaskCreateStatic(taskMain, task.name, task.stackSize, &task, task.priority, task.stack, &task.buffer);
+        eventLog.registerTask(taskHandles[size_t(task.id)]);
+    }
+    eventLog.setDrainTask(taskHandles[size_t(TaskId::LOG)]);
+    xTaskResumeAll();
+    ledCommands.setReceiver(taskHandles[size_t(TaskId::LED)]);
+    statsAt = millis();
+}
+
+// everything runs in the tasks setup() started, the Arduino loop task has nothing left to do
+void loop() {
+    vTaskDelete(nullptr);
 }